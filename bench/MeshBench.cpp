@@ -0,0 +1,480 @@
+// Times the mesh library against synthetic G3D data and prints the results as JSON.
+//
+// MeshBench [--hierarchies N] [--lods N] [--strips N] [--sections N] [--section-vertices N] [--mode v12|v32]
+//           [--normals 0|1] [--layers N] [--iterations N] [--threads N] [--seed N] [--out results.json]
+//           [--validate 0|1]
+//
+// With --validate 1 nothing is timed: every strip format and PRIM type is decoded with MeshLibrary::SetDecodeValidation
+// on and the exit code is 1 if any vertex differs from the reference decode or any strip from Renderer::KickVertex.
+// It also checks that removing a mesh between its background build and Update gives back its decoded bytes.
+
+#include "G3DFile.h"
+#include "Mesh.h"
+#include "MeshValidation.h"
+#include "SyntheticG3D.h"
+
+#include "ed3D.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace Bench
+		{
+			// Counted by the stub RenderMesh.
+			extern std::atomic<uint64_t> gRenderedMeshCount;
+
+			struct BenchConfig {
+				SyntheticG3DConfig g3d;
+				int iterations = 20;
+				int threadCount = 4;
+				std::string outPath;
+				bool bValidate = false;
+			};
+
+			struct BenchResult {
+				std::string name;
+				int iterations = 0;
+				uint64_t items = 0;
+				double totalMs = 0.0;
+			};
+
+			class Stopwatch
+			{
+			public:
+				void Start()
+				{
+					start = std::chrono::steady_clock::now();
+				}
+
+				void Stop()
+				{
+					elapsed += std::chrono::steady_clock::now() - start;
+				}
+
+				double GetMilliseconds() const
+				{
+					return std::chrono::duration<double, std::milli>(elapsed).count();
+				}
+
+			private:
+				std::chrono::steady_clock::time_point start;
+				std::chrono::steady_clock::duration elapsed = {};
+			};
+
+			// Runs body once per iteration, only the spans it brackets with the stopwatch are counted.
+			template<typename Body>
+			static BenchResult Measure(const char* name, int iterations, uint64_t itemsPerIteration, Body&& body)
+			{
+				Stopwatch stopwatch;
+
+				for (int i = 0; i < iterations; i++) {
+					body(stopwatch);
+				}
+
+				fprintf(stderr, "%s: %.3f ms\n", name, stopwatch.GetMilliseconds());
+				return { name, iterations, itemsPerIteration * iterations, stopwatch.GetMilliseconds() };
+			}
+
+			static void PrintUsage()
+			{
+				fprintf(stderr,
+					"MeshBench [--hierarchies N] [--lods N] [--strips N] [--sections N] [--section-vertices N] [--mode v12|v32]\n"
+					"          [--normals 0|1] [--layers N] [--iterations N] [--threads N] [--seed N] [--out results.json]\n"
+					"          [--validate 0|1]\n");
+			}
+
+			static bool ParseArguments(int argc, char** argv, BenchConfig& config)
+			{
+				for (int i = 1; i < argc; i++) {
+					const std::string arg = argv[i];
+
+					if (arg == "--help" || arg == "-h") {
+						PrintUsage();
+						exit(0);
+					}
+
+					if (i + 1 >= argc) {
+						fprintf(stderr, "Missing value for %s\n", arg.c_str());
+						return false;
+					}
+
+					const char* pValue = argv[++i];
+
+					if (arg == "--hierarchies") {
+						config.g3d.hierarchyCount = atoi(pValue);
+					}
+					else if (arg == "--lods") {
+						config.g3d.lodCount = atoi(pValue);
+					}
+					else if (arg == "--strips") {
+						config.g3d.stripsPerObject = atoi(pValue);
+					}
+					else if (arg == "--sections") {
+						config.g3d.sectionsPerStrip = atoi(pValue);
+					}
+					else if (arg == "--section-vertices") {
+						config.g3d.sectionVertexCount = atoi(pValue);
+					}
+					else if (arg == "--mode") {
+						config.g3d.bV12 = strcmp(pValue, "v32") != 0;
+					}
+					else if (arg == "--normals") {
+						config.g3d.bNormals = atoi(pValue) != 0;
+					}
+					else if (arg == "--layers") {
+						config.g3d.textureLayerCount = std::clamp(atoi(pValue), 1, G3D::Strip::gMaxTextureLayers);
+					}
+					else if (arg == "--iterations") {
+						config.iterations = std::max(atoi(pValue), 1);
+					}
+					else if (arg == "--threads") {
+						config.threadCount = std::max(atoi(pValue), 1);
+					}
+					else if (arg == "--seed") {
+						config.g3d.seed = static_cast<uint32_t>(strtoul(pValue, nullptr, 10));
+					}
+					else if (arg == "--out") {
+						config.outPath = pValue;
+					}
+					else if (arg == "--validate") {
+						config.bValidate = atoi(pValue) != 0;
+					}
+					else {
+						fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+						PrintUsage();
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			static void WriteJson(FILE* pFile, const BenchConfig& config, const SyntheticG3D& g3d, const std::vector<BenchResult>& results)
+			{
+				fprintf(pFile, "{\n");
+				fprintf(pFile, "  \"config\": {\n");
+				fprintf(pFile, "    \"hierarchies\": %d,\n", config.g3d.hierarchyCount);
+				fprintf(pFile, "    \"lods\": %d,\n", config.g3d.lodCount);
+				fprintf(pFile, "    \"strips_per_object\": %d,\n", config.g3d.stripsPerObject);
+				fprintf(pFile, "    \"sections_per_strip\": %d,\n", config.g3d.sectionsPerStrip);
+				fprintf(pFile, "    \"section_vertices\": %d,\n", config.g3d.sectionVertexCount);
+				fprintf(pFile, "    \"mode\": \"%s\",\n", config.g3d.bV12 ? "v12" : "v32");
+				fprintf(pFile, "    \"normals\": %s,\n", config.g3d.bNormals ? "true" : "false");
+				fprintf(pFile, "    \"layers\": %d,\n", config.g3d.textureLayerCount);
+				fprintf(pFile, "    \"iterations\": %d,\n", config.iterations);
+				fprintf(pFile, "    \"threads\": %d,\n", config.threadCount);
+				fprintf(pFile, "    \"seed\": %u,\n", config.g3d.seed);
+				fprintf(pFile, "    \"strip_count\": %zu,\n", g3d.GetStrips().size());
+				fprintf(pFile, "    \"file_bytes\": %zu\n", g3d.GetFileSize());
+				fprintf(pFile, "  },\n");
+				fprintf(pFile, "  \"results\": [\n");
+
+				for (size_t i = 0; i < results.size(); i++) {
+					const BenchResult& result = results[i];
+					const double nsPerItem = result.items ? (result.totalMs * 1000000.0) / static_cast<double>(result.items) : 0.0;
+
+					fprintf(pFile, "    { \"name\": \"%s\", \"iterations\": %d, \"items\": %llu, \"total_ms\": %.4f, \"ns_per_item\": %.2f }%s\n",
+						result.name.c_str(), result.iterations, static_cast<unsigned long long>(result.items), result.totalMs, nsPerItem, i + 1 < results.size() ? "," : "");
+				}
+
+				fprintf(pFile, "  ]\n");
+				fprintf(pFile, "}\n");
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace Renderer::Kya;
+	using namespace Renderer::Kya::Bench;
+
+	BenchConfig config;
+	if (!ParseArguments(argc, argv, config)) {
+		return 1;
+	}
+
+	if (config.bValidate) {
+		return RunValidation(config.g3d);
+	}
+
+	SyntheticG3D g3d(config.g3d);
+	ed_g3d_manager* pManager = g3d.GetManager();
+
+	const std::vector<ed_3d_strip*>& strips = g3d.GetStrips();
+	const uint64_t stripCount = strips.size();
+
+	std::vector<BenchResult> results;
+
+	results.push_back(Measure("g3d_construct", config.iterations, stripCount, [&](Stopwatch& stopwatch) {
+		stopwatch.Start();
+		G3D mesh(pManager, "Synthetic.g3d");
+		stopwatch.Stop();
+	}));
+
+	results.push_back(Measure("g3d_construct_lazy", config.iterations, stripCount, [&](Stopwatch& stopwatch) {
+		stopwatch.Start();
+		G3D mesh(pManager, "Synthetic.g3d", nullptr, true);
+		stopwatch.Stop();
+	}));
+
+	{
+		// The same file written out with offsets, then mapped and resolved in place.
+		const std::string g3dPath = "MeshBench.g3d";
+
+		if (!g3d.WriteFile(g3dPath)) {
+			fprintf(stderr, "Failed to write %s\n", g3dPath.c_str());
+			return 1;
+		}
+
+		G3DFile file;
+
+		results.push_back(Measure("g3d_file_open", config.iterations, stripCount, [&](Stopwatch& stopwatch) {
+			stopwatch.Start();
+			const bool bOpened = file.Open(g3dPath);
+			stopwatch.Stop();
+
+			if (!bOpened) {
+				fprintf(stderr, "%s\n", file.GetError().c_str());
+			}
+		}));
+
+		if (file.IsOpen()) {
+			G3D mesh(file.GetManager(), g3dPath, nullptr, true);
+			fprintf(stderr, "g3d_file_open mapped %zu bytes, %zu strips\n", file.GetSize(), mesh.GetStrips().size());
+		}
+
+		file.Close();
+		remove(g3dPath.c_str());
+	}
+
+	{
+		G3D mesh(pManager, "Synthetic.g3d", nullptr, true);
+		std::vector<G3D::Strip>& meshStrips = mesh.GetStrips();
+
+		results.push_back(Measure("preprocess_vertices", config.iterations, meshStrips.size(), [&](Stopwatch& stopwatch) {
+			for (G3D::Strip& strip : meshStrips) {
+				G3D::Strip::LayerTarget target;
+				target.pMesh = strip.CreateSimpleMesh(nullptr);
+
+				stopwatch.Start();
+				strip.PreProcessVertices(&target, 1);
+				stopwatch.Stop();
+
+				strip.deferredName = target.pMesh->GetName();
+				strip.pSimpleMesh.reset();
+			}
+		}));
+	}
+
+	if (config.g3d.textureLayerCount > 1) {
+		const int layerCount = config.g3d.textureLayerCount;
+
+		results.push_back(Measure("layer_build", config.iterations, stripCount * (layerCount - 1), [&](Stopwatch& stopwatch) {
+			G3D mesh(pManager, "Synthetic.g3d", nullptr, true);
+
+			for (const G3D::Strip& strip : mesh.GetStrips()) {
+				strip.EnsureDecoded();
+
+				stopwatch.Start();
+				for (int layer = 1; layer < layerCount; layer++) {
+					strip.GetSimpleMesh(layer);
+				}
+				stopwatch.Stop();
+			}
+		}));
+	}
+
+	{
+		// A sphere over half of each hierarchy's LOD 0 bounds, so the query both prunes and takes whole subtrees.
+		G3D mesh(pManager, "Synthetic.g3d", nullptr, true);
+		std::vector<const G3D::Strip*> visibleStrips;
+		uint64_t visibleCount = 0;
+
+		results.push_back(Measure("query_strips_sphere", config.iterations, mesh.GetHierarchies().size(), [&](Stopwatch& stopwatch) {
+			visibleCount = 0;
+
+			stopwatch.Start();
+			for (G3D::Index hierarchyIndex = 0; hierarchyIndex < mesh.GetHierarchies().size(); hierarchyIndex++) {
+				const G3D::Range lodRange = mesh.GetHierarchies()[hierarchyIndex].lods;
+				if (lodRange.count == 0 || mesh.GetLods()[lodRange.first].stripBounds.IsEmpty()) {
+					continue;
+				}
+
+				BoundingSphere sphere = BoundingSphere::FromBox(mesh.GetLods()[lodRange.first].stripBounds.GetBounds());
+				sphere.radius *= 0.5f;
+
+				visibleStrips.clear();
+				mesh.QueryHierarchyStrips(sphere, hierarchyIndex, 0, visibleStrips);
+				visibleCount += visibleStrips.size();
+			}
+			stopwatch.Stop();
+		}));
+
+		fprintf(stderr, "query_strips_sphere found %llu strips\n", static_cast<unsigned long long>(visibleCount));
+
+		// Cameras spread from inside the bounds to far away, each hierarchy keeping its previous pick.
+		std::vector<int> previousLods(mesh.GetHierarchies().size(), -1);
+		constexpr int cameraCount = 64;
+
+		results.push_back(Measure("select_lod", config.iterations, mesh.GetHierarchies().size() * cameraCount, [&](Stopwatch& stopwatch) {
+			G3D::LodViewParams view;
+			view.projectionScale = 500.0f;
+
+			stopwatch.Start();
+			for (int camera = 0; camera < cameraCount; camera++) {
+				view.cameraPosition[2] = static_cast<float>(camera * camera);
+
+				for (G3D::Index hierarchyIndex = 0; hierarchyIndex < mesh.GetHierarchies().size(); hierarchyIndex++) {
+					previousLods[hierarchyIndex] = mesh.SelectLod(hierarchyIndex, view, previousLods[hierarchyIndex]);
+				}
+			}
+			stopwatch.Stop();
+		}));
+	}
+
+	MeshLibrary::AddMesh(pManager, "Synthetic.g3d");
+	const MeshLibrary& library = GetMeshLibrary();
+
+	{
+		// Same lookups through std::unordered_map for comparison with the flat strip cache.
+		std::unordered_map<const ed_3d_strip*, const G3D::Strip*> stripMap;
+		for (ed_3d_strip* pStrip : strips) {
+			stripMap[pStrip] = library.FindStrip(pStrip);
+		}
+
+		std::vector<const ed_3d_strip*> lookups;
+		constexpr int lookupRepeats = 16;
+
+		for (int i = 0; i < lookupRepeats; i++) {
+			lookups.insert(lookups.end(), strips.begin(), strips.end());
+		}
+
+		std::shuffle(lookups.begin(), lookups.end(), std::mt19937(config.g3d.seed));
+
+		uintptr_t sink = 0;
+
+		results.push_back(Measure("find_strip", config.iterations, lookups.size(), [&](Stopwatch& stopwatch) {
+			stopwatch.Start();
+			for (const ed_3d_strip* pStrip : lookups) {
+				sink ^= reinterpret_cast<uintptr_t>(library.FindStrip(pStrip));
+			}
+			stopwatch.Stop();
+		}));
+
+		results.push_back(Measure("find_strip_unordered_map", config.iterations, lookups.size(), [&](Stopwatch& stopwatch) {
+			stopwatch.Start();
+			for (const ed_3d_strip* pStrip : lookups) {
+				sink ^= reinterpret_cast<uintptr_t>(stripMap.find(pStrip)->second);
+			}
+			stopwatch.Stop();
+		}));
+
+		if (sink == 1) {
+			fprintf(stderr, "\n");
+		}
+	}
+
+	{
+		std::vector<edNODE> nodes(strips.size());
+		std::vector<const edNODE*> nodePointers;
+
+		for (size_t i = 0; i < strips.size(); i++) {
+			nodes[i] = {};
+			nodes[i].pData = strips[i];
+			nodePointers.push_back(&nodes[i]);
+		}
+
+		results.push_back(Measure("render_node", config.iterations, nodes.size(), [&](Stopwatch& stopwatch) {
+			stopwatch.Start();
+			for (const edNODE& node : nodes) {
+				library.RenderNode(&node);
+			}
+			stopwatch.Stop();
+		}));
+
+		results.push_back(Measure("render_nodes", config.iterations, nodes.size(), [&](Stopwatch& stopwatch) {
+			stopwatch.Start();
+			library.RenderNodes(nodePointers.data(), nodePointers.size());
+			stopwatch.Stop();
+		}));
+
+		// Every thread renders all the nodes, the last layer lazily, while this one keeps evicting under a tiny budget so
+		// the lookups and builds race the writer the way render threads would.
+		results.push_back(Measure("render_node_concurrent", config.iterations, nodes.size() * config.threadCount, [&](Stopwatch& stopwatch) {
+			std::atomic<int> runningThreads = config.threadCount;
+			std::vector<std::thread> threads;
+
+			MeshLibrary::SetDecodedBudget(1);
+
+			stopwatch.Start();
+			for (int i = 0; i < config.threadCount; i++) {
+				threads.emplace_back([&]() {
+					library.RenderNodes(nodePointers.data(), nodePointers.size());
+					for (const edNODE& node : nodes) {
+						library.RenderNode(&node, config.g3d.textureLayerCount - 1);
+					}
+
+					runningThreads--;
+				});
+			}
+
+			while (runningThreads > 0) {
+				GetMeshLibraryMutable().Update();
+				std::this_thread::yield();
+			}
+
+			for (std::thread& thread : threads) {
+				thread.join();
+			}
+			stopwatch.Stop();
+
+			MeshLibrary::SetDecodedBudget(0);
+		}));
+
+		fprintf(stderr, "Rendered %llu meshes\n", static_cast<unsigned long long>(gRenderedMeshCount));
+	}
+
+	for (const MeshLibrary::MeshStats& stats : library.GetMeshStats()) {
+		fprintf(stderr, "%s: hall %.3f ms, csta %.3f ms, decode %.3f ms, %u/%u strips decoded, %llu vertices, %zu resident bytes, %zu bytes reclaimed\n",
+			stats.name.c_str(), stats.timings.hallMs, stats.timings.cstaMs, stats.timings.stripDecodeMs, stats.decodedStripCount, stats.stripCount,
+			static_cast<unsigned long long>(stats.vertexCount), stats.residentBytes, stats.reclaimedBytes);
+	}
+
+	const MeshLibrary::Counters counters = MeshLibrary::GetCounters();
+	fprintf(stderr, "find_strip %llu hits, %llu misses, %llu strip decodes in %.3f ms\n", static_cast<unsigned long long>(counters.findStripHits),
+		static_cast<unsigned long long>(counters.findStripMisses), static_cast<unsigned long long>(counters.stripDecodes), counters.stripDecodeMs);
+
+	MeshLibrary::RemoveMesh(pManager);
+
+	FILE* pOut = stdout;
+	if (!config.outPath.empty()) {
+		pOut = fopen(config.outPath.c_str(), "w");
+		if (!pOut) {
+			fprintf(stderr, "Failed to open %s\n", config.outPath.c_str());
+			return 1;
+		}
+	}
+
+	WriteJson(pOut, config, g3d, results);
+
+	if (pOut != stdout) {
+		fclose(pOut);
+	}
+
+	return 0;
+}
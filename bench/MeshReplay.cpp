@@ -0,0 +1,643 @@
+// Plays back a trace recorded by MeshLibrary::StartTrace and prints frame times and library counters as JSON.
+// Meshes are loaded from the .g3d files the trace names, display list strips are rebuilt from the data in the trace.
+// The calls are replayed one after the other on this thread, in the order the trace recorded them.
+//
+// MeshReplay --trace capture.kmtr [--data dir] [--layers N] [--lazy 0|1] [--dedup 0|1] [--budget bytes] [--out results.json]
+
+#include "G3DFile.h"
+#include "Mesh.h"
+#include "MeshTrace.h"
+
+#include "ed3D.h"
+#include "edList.h"
+#include "port.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace Bench
+		{
+			constexpr uint32_t gGifTagCopyCode = 0x6c018000;
+			constexpr size_t gAlignment = 16;
+
+			struct ReplayConfig {
+				std::string tracePath;
+				std::string dataDir;
+
+				// Texture layers of mesh strips, the trace only holds the layer counts of display list strips.
+				int textureLayerCount = 1;
+
+				bool bLazy = false;
+				bool bDeduplicate = false;
+				size_t decodedBudget = 0;
+				std::string outPath;
+			};
+
+			// Time spent in one MeshLibrary entry point over the whole replay.
+			struct OpTotal {
+				const char* name = "";
+				uint64_t calls = 0;
+				double totalMs = 0.0;
+			};
+
+			static void PrintUsage()
+			{
+				fprintf(stderr, "MeshReplay --trace capture.kmtr [--data dir] [--layers N] [--lazy 0|1] [--dedup 0|1] [--budget bytes] [--out results.json]\n");
+			}
+
+			static bool ParseArguments(int argc, char** argv, ReplayConfig& config)
+			{
+				for (int i = 1; i < argc; i++) {
+					const std::string arg = argv[i];
+
+					if (arg == "--help" || arg == "-h") {
+						PrintUsage();
+						exit(0);
+					}
+
+					if (i + 1 >= argc) {
+						fprintf(stderr, "Missing value for %s\n", arg.c_str());
+						return false;
+					}
+
+					const char* pValue = argv[++i];
+
+					if (arg == "--trace") {
+						config.tracePath = pValue;
+					}
+					else if (arg == "--data") {
+						config.dataDir = pValue;
+					}
+					else if (arg == "--layers") {
+						config.textureLayerCount = std::max(atoi(pValue), 1);
+					}
+					else if (arg == "--lazy") {
+						config.bLazy = atoi(pValue) != 0;
+					}
+					else if (arg == "--dedup") {
+						config.bDeduplicate = atoi(pValue) != 0;
+					}
+					else if (arg == "--budget") {
+						config.decodedBudget = static_cast<size_t>(strtoull(pValue, nullptr, 10));
+					}
+					else if (arg == "--out") {
+						config.outPath = pValue;
+					}
+					else {
+						fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+						PrintUsage();
+						return false;
+					}
+				}
+
+				if (config.tracePath.empty()) {
+					fprintf(stderr, "Missing --trace\n");
+					PrintUsage();
+					return false;
+				}
+
+				return true;
+			}
+
+			// Bump allocator in the low 4GB, the rebuilt strips are read through LOAD_POINTER_CAST like loaded data.
+			// Nothing is freed before the replay ends.
+			class AddressableArena
+			{
+			public:
+				AddressableArena() = default;
+
+				~AddressableArena()
+				{
+					for (const Block& block : blocks) {
+#ifdef _WIN32
+						VirtualFree(block.pData, 0, MEM_RELEASE);
+#else
+						munmap(block.pData, block.size);
+#endif
+					}
+				}
+
+				AddressableArena(const AddressableArena&) = delete;
+				AddressableArena& operator=(const AddressableArena&) = delete;
+
+				void* Allocate(size_t size)
+				{
+					size = (size + gAlignment - 1) & ~(gAlignment - 1);
+
+					if (blocks.empty() || blocks.back().used + size > blocks.back().size) {
+						if (!AddBlock(std::max(size, gBlockSize))) {
+							return nullptr;
+						}
+					}
+
+					Block& block = blocks.back();
+					void* p = block.pData + block.used;
+					memset(p, 0, size);
+					block.used += size;
+					return p;
+				}
+
+			private:
+				static constexpr size_t gBlockSize = 16 * 1024 * 1024;
+
+				struct Block {
+					uint8_t* pData = nullptr;
+					size_t size = 0;
+					size_t used = 0;
+				};
+
+				bool AddBlock(size_t size)
+				{
+					void* p = nullptr;
+
+#ifdef _WIN32
+					for (uintptr_t base = 0x10000000; base < 0x80000000 && !p; base += 0x1000000) {
+						p = VirtualAlloc(reinterpret_cast<void*>(base), size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+					}
+#else
+					int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_32BIT
+					flags |= MAP_32BIT;
+#endif
+					p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+					p = p == MAP_FAILED ? nullptr : p;
+#endif
+
+					if (!p || reinterpret_cast<uintptr_t>(p) + size > 0x100000000ull) {
+						fprintf(stderr, "Failed to allocate %zu bytes in the low 4GB\n", size);
+						return false;
+					}
+
+					blocks.push_back({ static_cast<uint8_t*>(p), size, 0 });
+					return true;
+				}
+
+				std::vector<Block> blocks;
+			};
+
+			template<typename Field>
+			static void StorePointer(Field& field, const void* p)
+			{
+				field = static_cast<Field>(reinterpret_cast<uintptr_t>(p));
+			}
+
+			// A display list strip rebuilt from the trace. The strip itself is a template, every slot caching it copies
+			// it over its own strip and points the VIF list back at the shared packets.
+			struct DlistContent {
+				const ed_3d_strip* pTemplate = nullptr;
+				const edpkt_data* pVifList = nullptr;
+				int textureLayerCount = 1;
+			};
+
+			static bool BuildDlistContent(AddressableArena& arena, const MeshTraceStripData& data, DlistContent& content)
+			{
+				const size_t sectionCount = data.gifTags.size() / sizeof(edpkt_data);
+
+				if (data.strip.size() != sizeof(ed_3d_strip) || sectionCount == 0 || data.gifTags.size() % sizeof(edpkt_data) != 0) {
+					return false;
+				}
+
+				auto copy = [&arena](const std::vector<uint8_t>& bytes) -> void* {
+					if (bytes.empty()) {
+						return nullptr;
+					}
+
+					void* p = arena.Allocate(bytes.size());
+					if (p) {
+						memcpy(p, bytes.data(), bytes.size());
+					}
+
+					return p;
+				};
+
+				ed_3d_strip* pStrip = static_cast<ed_3d_strip*>(arena.Allocate(sizeof(ed_3d_strip)));
+				edpkt_data* pVifList = static_cast<edpkt_data*>(arena.Allocate(sectionCount * 3 * sizeof(edpkt_data)));
+				edpkt_data* pGifPackets = static_cast<edpkt_data*>(copy(data.gifTags));
+
+				if (!pStrip || !pVifList || !pGifPackets) {
+					return false;
+				}
+
+				memcpy(pStrip, data.strip.data(), sizeof(ed_3d_strip));
+				pStrip->meshCount = static_cast<short>(sectionCount);
+				pStrip->pNext = 0;
+
+				// The same layout the exporter writes: a packet whose second quad carries the GIF tag copy, then the end code.
+				for (size_t j = 0; j < sectionCount; j++) {
+					edpkt_data* pPkt = pVifList + (j * 3);
+					StorePointer(pPkt[1].asU32[1], pGifPackets + j);
+					pPkt[1].asU32[3] = gGifTagCopyCode;
+					pPkt[2].asU32[0] = gVifEndCode;
+				}
+
+				StorePointer(pStrip->pVertexBuf, copy(data.vertices));
+				StorePointer(pStrip->pNormalBuf, copy(data.normals));
+				StorePointer(pStrip->pColorBuf, copy(data.colors));
+				StorePointer(pStrip->pSTBuf, copy(data.st));
+
+				content.pTemplate = pStrip;
+				content.pVifList = pVifList;
+				content.textureLayerCount = std::max(data.textureLayerCount, 1);
+				return true;
+			}
+
+			static double GetPercentile(std::vector<double> values, double percentile)
+			{
+				if (values.empty()) {
+					return 0.0;
+				}
+
+				const size_t index = std::min(values.size() - 1, static_cast<size_t>(percentile * static_cast<double>(values.size())));
+				std::nth_element(values.begin(), values.begin() + index, values.end());
+				return values[index];
+			}
+
+			static void WriteJson(FILE* pFile, const ReplayConfig& config, const std::vector<double>& frameMs, const std::vector<OpTotal>& ops,
+				uint64_t unknownDraws, uint64_t skippedDraws)
+			{
+				double totalMs = 0.0;
+				double maxMs = 0.0;
+
+				for (double ms : frameMs) {
+					totalMs += ms;
+					maxMs = std::max(maxMs, ms);
+				}
+
+				const MeshLibrary::Counters counters = MeshLibrary::GetCounters();
+
+				fprintf(pFile, "{\n");
+				fprintf(pFile, "  \"config\": {\n");
+				fprintf(pFile, "    \"trace\": \"%s\",\n", config.tracePath.c_str());
+				fprintf(pFile, "    \"layers\": %d,\n", config.textureLayerCount);
+				fprintf(pFile, "    \"lazy\": %s,\n", config.bLazy ? "true" : "false");
+				fprintf(pFile, "    \"dedup\": %s,\n", config.bDeduplicate ? "true" : "false");
+				fprintf(pFile, "    \"budget\": %zu\n", config.decodedBudget);
+				fprintf(pFile, "  },\n");
+				fprintf(pFile, "  \"frames\": {\n");
+				fprintf(pFile, "    \"count\": %zu,\n", frameMs.size());
+				fprintf(pFile, "    \"mean_ms\": %.4f,\n", frameMs.empty() ? 0.0 : totalMs / static_cast<double>(frameMs.size()));
+				fprintf(pFile, "    \"p50_ms\": %.4f,\n", GetPercentile(frameMs, 0.5));
+				fprintf(pFile, "    \"p90_ms\": %.4f,\n", GetPercentile(frameMs, 0.9));
+				fprintf(pFile, "    \"p99_ms\": %.4f,\n", GetPercentile(frameMs, 0.99));
+				fprintf(pFile, "    \"max_ms\": %.4f\n", maxMs);
+				fprintf(pFile, "  },\n");
+				fprintf(pFile, "  \"ops\": [\n");
+
+				for (size_t i = 0; i < ops.size(); i++) {
+					fprintf(pFile, "    { \"name\": \"%s\", \"calls\": %llu, \"total_ms\": %.4f }%s\n", ops[i].name, static_cast<unsigned long long>(ops[i].calls),
+						ops[i].totalMs, i + 1 < ops.size() ? "," : "");
+				}
+
+				fprintf(pFile, "  ],\n");
+				fprintf(pFile, "  \"counters\": {\n");
+				fprintf(pFile, "    \"unknown_draws\": %llu,\n", static_cast<unsigned long long>(unknownDraws));
+				fprintf(pFile, "    \"skipped_draws\": %llu,\n", static_cast<unsigned long long>(skippedDraws));
+				fprintf(pFile, "    \"find_strip_hits\": %llu,\n", static_cast<unsigned long long>(counters.findStripHits));
+				fprintf(pFile, "    \"find_strip_misses\": %llu,\n", static_cast<unsigned long long>(counters.findStripMisses));
+				fprintf(pFile, "    \"strip_decodes\": %llu,\n", static_cast<unsigned long long>(counters.stripDecodes));
+				fprintf(pFile, "    \"strip_decode_ms\": %.4f,\n", counters.stripDecodeMs);
+				fprintf(pFile, "    \"lazy_layer_builds\": %llu,\n", static_cast<unsigned long long>(counters.lazyLayerBuilds));
+				fprintf(pFile, "    \"dlist_recaches\": %llu,\n", static_cast<unsigned long long>(counters.dlistRecaches));
+				fprintf(pFile, "    \"dlist_unchanged\": %llu,\n", static_cast<unsigned long long>(counters.dlistUnchanged));
+				fprintf(pFile, "    \"decoded_bytes\": %zu\n", MeshLibrary::GetDecodedBytes());
+				fprintf(pFile, "  }\n");
+				fprintf(pFile, "}\n");
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	using namespace Renderer::Kya;
+	using namespace Renderer::Kya::Bench;
+
+	using Clock = std::chrono::steady_clock;
+
+	ReplayConfig config;
+	if (!ParseArguments(argc, argv, config)) {
+		return 1;
+	}
+
+	MeshTraceReader reader;
+	if (!reader.Open(config.tracePath)) {
+		fprintf(stderr, "%s: %s\n", config.tracePath.c_str(), reader.GetError().c_str());
+		return 1;
+	}
+
+	AddressableArena arena;
+
+	// Display list slots, each keeping the one strip pointer the library caches it under.
+	struct DlistSlot {
+		ed_3d_strip* pStrip = nullptr;
+		bool bCached = false;
+		int textureLayerCount = 1;
+	};
+
+	std::unordered_map<uint64_t, DlistContent> dlistContents;
+	std::unordered_map<uint64_t, DlistSlot> dlistSlots;
+	std::unordered_map<const ed_3d_strip*, int> dlistLayerCounts;
+
+	// Draws of strips the trace couldn't name go to a strip the library never sees, so they miss like they did when recorded.
+	ed_3d_strip* pUnknownStrip = static_cast<ed_3d_strip*>(arena.Allocate(sizeof(ed_3d_strip)));
+	if (!pUnknownStrip) {
+		return 1;
+	}
+
+	// The library only sees layer counts through this, display list strips hold what the trace recorded.
+	MeshLibrary::SetTextureLayerCountFunc([&dlistLayerCounts, &config](const ed_3d_strip* pStrip) {
+		auto layerCount = dlistLayerCounts.find(pStrip);
+		return layerCount != dlistLayerCounts.end() ? layerCount->second : config.textureLayerCount;
+	});
+
+	MeshLibrary::SetLazyDecoding(config.bLazy);
+	MeshLibrary::SetDeduplication(config.bDeduplicate);
+	MeshLibrary::SetDecodedBudget(config.decodedBudget);
+
+	MeshLibrary& library = GetMeshLibraryMutable();
+
+	std::unordered_map<uint64_t, std::unique_ptr<G3DFile>> files;
+
+	// Loaded strips by source hash, identical strips in different files are interchangeable for a draw.
+	std::unordered_multimap<uint64_t, ed_3d_strip*> stripsByHash;
+	std::unordered_map<uint64_t, uint64_t> stripHashes;
+
+	// Strip ids resolved since the last mesh came or went.
+	std::unordered_map<uint64_t, ed_3d_strip*> resolvedStrips;
+
+	enum Op {
+		OpAddMesh,
+		OpRemoveMesh,
+		OpUpdate,
+		OpCacheDlistStrip,
+		OpReleaseDlistStrip,
+		OpRenderNode,
+		OpRenderNodes,
+		OpCount
+	};
+
+	std::vector<OpTotal> ops(OpCount);
+	ops[OpAddMesh].name = "add_mesh";
+	ops[OpRemoveMesh].name = "remove_mesh";
+	ops[OpUpdate].name = "update";
+	ops[OpCacheDlistStrip].name = "cache_dlist_strip";
+	ops[OpReleaseDlistStrip].name = "release_dlist_strip";
+	ops[OpRenderNode].name = "render_node";
+	ops[OpRenderNodes].name = "render_nodes";
+
+	std::vector<double> frameMs;
+	double currentFrameMs = 0.0;
+	uint64_t unknownDraws = 0;
+	uint64_t skippedDraws = 0;
+
+	// Times one library call into its op and the current frame.
+	auto timed = [&](Op op, auto&& call) {
+		const Clock::time_point start = Clock::now();
+		call();
+		const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		ops[op].calls++;
+		ops[op].totalMs += ms;
+		currentFrameMs += ms;
+	};
+
+	auto resolveStrip = [&](MeshTraceStripRef stripRef, int textureLayerIndex) -> ed_3d_strip* {
+		if (stripRef & 1) {
+			auto slot = dlistSlots.find(stripRef >> 1);
+			if (slot == dlistSlots.end() || !slot->second.bCached) {
+				return pUnknownStrip;
+			}
+
+			// Only the recorded layers are in the trace, the library would read past them.
+			return textureLayerIndex < slot->second.textureLayerCount ? slot->second.pStrip : nullptr;
+		}
+
+		const uint64_t stripId = stripRef >> 1;
+
+		auto resolved = resolvedStrips.find(stripId);
+		if (resolved != resolvedStrips.end()) {
+			return resolved->second;
+		}
+
+		ed_3d_strip* pStrip = pUnknownStrip;
+
+		auto hash = stripHashes.find(stripId);
+		if (hash != stripHashes.end()) {
+			auto loaded = stripsByHash.find(hash->second);
+			if (loaded != stripsByHash.end()) {
+				pStrip = loaded->second;
+			}
+		}
+
+		resolvedStrips.emplace(stripId, pStrip);
+		return pStrip;
+	};
+
+	std::vector<edNODE> nodes;
+	std::vector<const edNODE*> nodePointers;
+
+	auto buildNodes = [&](const MeshTraceReader::Event& event) {
+		nodes.clear();
+		nodePointers.clear();
+		nodes.reserve(event.nodes.size());
+
+		for (const MeshTraceReader::Node& traceNode : event.nodes) {
+			ed_3d_strip* pStrip = resolveStrip(traceNode.stripRef, event.textureLayerIndex);
+			if (!pStrip) {
+				skippedDraws++;
+				continue;
+			}
+
+			if (pStrip == pUnknownStrip) {
+				unknownDraws++;
+			}
+
+			edNODE& node = nodes.emplace_back();
+			node = {};
+			node.header.typeField.flags = static_cast<decltype(node.header.typeField.flags)>(traceNode.flags);
+			node.pData = pStrip;
+		}
+
+		for (const edNODE& node : nodes) {
+			nodePointers.push_back(&node);
+		}
+	};
+
+	MeshTraceReader::Event event;
+
+	while (reader.Next(event)) {
+		switch (event.type) {
+		case MeshTraceRecord::EndFrame:
+			timed(OpUpdate, [&]() { library.Update(); });
+			frameMs.push_back(currentFrameMs);
+			currentFrameMs = 0.0;
+			break;
+		case MeshTraceRecord::AddMesh: {
+			std::unique_ptr<G3DFile> pFile = std::make_unique<G3DFile>();
+			const std::string path = config.dataDir.empty() ? event.name : config.dataDir + "/" + event.name;
+
+			if (!pFile->Open(path)) {
+				fprintf(stderr, "%s: %s\n", path.c_str(), pFile->GetError().c_str());
+				break;
+			}
+
+			ed_g3d_manager* pManager = pFile->GetManager();
+			timed(OpAddMesh, [&]() { MeshLibrary::AddMesh(pManager, event.name); });
+
+			if (const G3D* pMesh = library.GetMesh(library.FindMesh(pManager))) {
+				for (const G3D::Strip& strip : pMesh->GetStrips()) {
+					if (!strip.sections.empty()) {
+						stripsByHash.emplace(strip.ComputeSourceHash(), strip.pStrip);
+					}
+				}
+			}
+
+			files[event.id] = std::move(pFile);
+			resolvedStrips.clear();
+			break;
+		}
+		case MeshTraceRecord::RemoveMesh: {
+			auto file = files.find(event.id);
+			if (file == files.end()) {
+				break;
+			}
+
+			ed_g3d_manager* pManager = file->second->GetManager();
+
+			if (const G3D* pMesh = library.GetMesh(library.FindMesh(pManager))) {
+				for (const G3D::Strip& strip : pMesh->GetStrips()) {
+					if (strip.sections.empty()) {
+						continue;
+					}
+
+					auto range = stripsByHash.equal_range(strip.ComputeSourceHash());
+
+					for (auto it = range.first; it != range.second; ++it) {
+						if (it->second == strip.pStrip) {
+							stripsByHash.erase(it);
+							break;
+						}
+					}
+				}
+			}
+
+			timed(OpRemoveMesh, [&]() { MeshLibrary::RemoveMesh(pManager); });
+
+			files.erase(file);
+			resolvedStrips.clear();
+			break;
+		}
+		case MeshTraceRecord::DefineStrip:
+			stripHashes[event.id] = event.hash;
+			break;
+		case MeshTraceRecord::DlistContent: {
+			DlistContent content;
+			if (!BuildDlistContent(arena, event.stripData, content)) {
+				fprintf(stderr, "Skipping malformed display list strip %016llx\n", static_cast<unsigned long long>(event.hash));
+				break;
+			}
+
+			dlistContents[event.hash] = content;
+			break;
+		}
+		case MeshTraceRecord::CacheDlistStrip: {
+			auto content = dlistContents.find(event.hash);
+			if (content == dlistContents.end()) {
+				break;
+			}
+
+			DlistSlot& slot = dlistSlots[event.id];
+			if (!slot.pStrip) {
+				slot.pStrip = static_cast<ed_3d_strip*>(arena.Allocate(sizeof(ed_3d_strip)));
+				if (!slot.pStrip) {
+					return 1;
+				}
+			}
+
+			memcpy(slot.pStrip, content->second.pTemplate, sizeof(ed_3d_strip));
+			slot.pStrip->vifListOffset = static_cast<int>(reinterpret_cast<const char*>(content->second.pVifList) - reinterpret_cast<const char*>(slot.pStrip));
+			slot.bCached = true;
+			slot.textureLayerCount = content->second.textureLayerCount;
+			dlistLayerCounts[slot.pStrip] = slot.textureLayerCount;
+
+			timed(OpCacheDlistStrip, [&]() { library.CacheDlistStrip(slot.pStrip); });
+			break;
+		}
+		case MeshTraceRecord::ReleaseDlistStrip: {
+			auto slot = dlistSlots.find(event.id);
+			if (slot == dlistSlots.end() || !slot->second.bCached) {
+				break;
+			}
+
+			slot->second.bCached = false;
+			timed(OpReleaseDlistStrip, [&]() { MeshLibrary::ReleaseDlistStrip(slot->second.pStrip); });
+			break;
+		}
+		case MeshTraceRecord::RenderNode:
+			buildNodes(event);
+
+			if (!nodes.empty()) {
+				timed(OpRenderNode, [&]() { library.RenderNode(&nodes.front(), event.textureLayerIndex); });
+			}
+
+			break;
+		case MeshTraceRecord::RenderNodes:
+			buildNodes(event);
+			timed(OpRenderNodes, [&]() { library.RenderNodes(nodePointers.data(), nodePointers.size(), event.textureLayerIndex); });
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (!reader.GetError().empty()) {
+		fprintf(stderr, "%s: %s\n", config.tracePath.c_str(), reader.GetError().c_str());
+		return 1;
+	}
+
+	// Calls after the last Update make up a frame of their own.
+	if (currentFrameMs > 0.0) {
+		frameMs.push_back(currentFrameMs);
+	}
+
+	fprintf(stderr, "Replayed %zu frames, %llu draws of unknown strips, %llu draws past the recorded layers\n", frameMs.size(),
+		static_cast<unsigned long long>(unknownDraws), static_cast<unsigned long long>(skippedDraws));
+
+	FILE* pOut = stdout;
+	if (!config.outPath.empty()) {
+		pOut = fopen(config.outPath.c_str(), "w");
+		if (!pOut) {
+			fprintf(stderr, "Failed to open %s\n", config.outPath.c_str());
+			return 1;
+		}
+	}
+
+	WriteJson(pOut, config, frameMs, ops, unknownDraws, skippedDraws);
+
+	if (pOut != stdout) {
+		fclose(pOut);
+	}
+
+	// The library still points into the mapped files and the arena.
+	library.Clear();
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+// Runs the MeshBench --validate checks linked against the engine renderer, so the section kernels are compared with
+// its Renderer::KickVertex rather than the bench stub. CTest runs it when it is built, the exit code is 1 on any mismatch.
+//
+// MeshValidate [--seed N]
+
+#include "MeshValidation.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+int main(int argc, char** argv)
+{
+	using namespace Renderer::Kya::Bench;
+
+	SyntheticG3DConfig config;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+
+		if (arg == "--seed" && i + 1 < argc) {
+			config.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}
+		else {
+			fprintf(stderr, "MeshValidate [--seed N]\n");
+			return arg == "--help" || arg == "-h" ? 0 : 1;
+		}
+	}
+
+	return RunValidation(config);
+}
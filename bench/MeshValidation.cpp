@@ -0,0 +1,95 @@
+#include "MeshValidation.h"
+
+#include "G3DFile.h"
+#include "Mesh.h"
+
+#include <cstdio>
+#include <thread>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace Bench
+		{
+			// Removes a mesh the ingestion worker has built but Update hasn't published, returns whether every byte it
+			// decoded was handed back.
+			static bool ValidateIngestCancel(const SyntheticG3DConfig& config)
+			{
+				SyntheticG3D g3d(config);
+
+				// G3Ds built outside the library keep their bytes counted, so only the difference is looked at.
+				const size_t bytesBefore = MeshLibrary::GetDecodedBytes();
+
+				MeshLibrary::SetAsyncIngestion(true);
+				MeshLibrary::AddMesh(g3d.GetManager(), "Cancel.g3d");
+
+				while (GetMeshLibrary().GetLoadState(g3d.GetManager()) != MeshLibrary::LoadState::Built) {
+					std::this_thread::yield();
+				}
+
+				const size_t builtBytes = MeshLibrary::GetDecodedBytes() - bytesBefore;
+				MeshLibrary::RemoveMesh(g3d.GetManager());
+				GetMeshLibraryMutable().Update();
+				MeshLibrary::SetAsyncIngestion(false);
+
+				const size_t decodedBytes = MeshLibrary::GetDecodedBytes() - bytesBefore;
+				const size_t meshCount = GetMeshLibrary().GetMeshStats().size();
+				fprintf(stderr, "validate: ingest cancel %zu bytes built, %zu bytes and %zu meshes left\n", builtBytes, decodedBytes, meshCount);
+
+				return builtBytes != 0 && decodedBytes == 0 && meshCount == 0;
+			}
+		}
+	}
+}
+
+int Renderer::Kya::Bench::RunValidation(const SyntheticG3DConfig& config)
+{
+	// Enough random skips to hit every queue path: dropped list primitives, strips sliding past a vertex.
+	constexpr int validateSkipPercent = 30;
+
+	MeshLibrary::SetDecodeValidation(true);
+	MeshLibrary::ResetCounters();
+
+	uint64_t stripCount = 0;
+
+	for (const bool bV12 : { true, false }) {
+		for (const bool bNormals : { true, false }) {
+			for (uint32_t primType = 0; primType < 8; primType++) {
+				SyntheticG3DConfig g3dConfig = config;
+				g3dConfig.bV12 = bV12;
+				g3dConfig.bNormals = bNormals;
+				g3dConfig.primType = primType;
+				g3dConfig.skipPercent = validateSkipPercent;
+
+				SyntheticG3D g3d(g3dConfig);
+				G3D mesh(g3d.GetManager(), "Validate.g3d", nullptr, true);
+
+				for (const G3D::Strip& strip : mesh.GetStrips()) {
+					strip.EnsureDecoded();
+
+					for (int layer = 1; layer < g3dConfig.textureLayerCount; layer++) {
+						strip.GetSimpleMesh(layer);
+					}
+				}
+
+				stripCount += mesh.GetStrips().size();
+			}
+		}
+	}
+
+	MeshLibrary::SetDecodeValidation(false);
+
+	const MeshLibrary::Counters counters = MeshLibrary::GetCounters();
+	fprintf(stderr, "validate: %llu strips, %llu decode mismatches, %llu assembly mismatches\n", static_cast<unsigned long long>(stripCount),
+		static_cast<unsigned long long>(counters.decodeMismatches), static_cast<unsigned long long>(counters.assemblyMismatches));
+
+	const bool bIngestCancelled = ValidateIngestCancel(config);
+
+	if (counters.decodeMismatches != 0 || counters.assemblyMismatches != 0 || !bIngestCancelled) {
+		fprintf(stderr, "validate: FAILED\n");
+		return 1;
+	}
+
+	return 0;
+}
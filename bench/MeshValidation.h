@@ -0,0 +1,19 @@
+#pragma once
+
+#include "SyntheticG3D.h"
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace Bench
+		{
+			// Decodes every layer of every strip in each vertex format, normal and PRIM combination with
+			// MeshLibrary::SetDecodeValidation on, then removes a mesh between its background build and Update. Returns 1
+			// if any vertex differs from the reference decode, any strip from Renderer::KickVertex or the removed mesh
+			// keeps decoded bytes, 0 otherwise. KickVertex is whichever renderer is linked: the stub in MeshBench, the
+			// engine's in MeshValidate.
+			int RunValidation(const SyntheticG3DConfig& config);
+		}
+	}
+}
@@ -0,0 +1,112 @@
+// Stand-ins for the renderer entry points the mesh library calls, so the benchmark measures the library and not
+// the renderer. KickVertex is the plain one vertex at a time GS queue, the library's section kernels are checked
+// against it when decode validation is on.
+
+#include "renderer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace Bench
+		{
+			// Atomic since the concurrent benchmark renders from several threads.
+			std::atomic<uint64_t> gRenderedMeshCount = 0;
+			std::atomic<uint64_t> gRenderedIndexCount = 0;
+		}
+	}
+
+	void KickVertex(GSVertexUnprocessedNormal& vtx, GIFReg::GSPrim primReg, uint32_t skip, VertexBufferData& vertexBufferData)
+	{
+		using IndexType = std::remove_reference_t<decltype(*vertexBufferData.index.buff)>;
+
+		auto& vertex = vertexBufferData.vertex;
+		auto& index = vertexBufferData.index;
+
+		const uint32_t prim = static_cast<uint32_t>(primReg.PRIM);
+
+		vertex.buff[vertex.tail] = vtx;
+		vertex.tail++;
+
+		// Point, line, line strip, triangle, triangle strip, triangle fan, sprite and the invalid 7.
+		constexpr size_t vertexCounts[8] = { 1, 2, 2, 3, 3, 3, 2, 1 };
+		const size_t vertexCount = vertexCounts[prim];
+
+		size_t head = vertex.head;
+		const size_t tail = vertex.tail;
+
+		if (tail - head < vertexCount) {
+			return;
+		}
+
+		if (skip != 0 || prim == 7) {
+			// Lists drop the primitive's vertices, strips slide past one, fans keep everything.
+			if (prim == 2 || prim == 4) {
+				vertex.head = head + 1;
+			}
+			else if (prim != 5) {
+				vertex.tail = head;
+			}
+
+			return;
+		}
+
+		IndexType* pIndex = index.buff + index.tail;
+
+		switch (prim) {
+		case 0:
+			pIndex[0] = static_cast<IndexType>(head);
+			vertex.head = vertex.next = head + 1;
+			break;
+		case 1:
+		case 6:
+			pIndex[0] = static_cast<IndexType>(head);
+			pIndex[1] = static_cast<IndexType>(head + 1);
+			vertex.head = vertex.next = head + 2;
+			break;
+		case 3:
+			pIndex[0] = static_cast<IndexType>(head);
+			pIndex[1] = static_cast<IndexType>(head + 1);
+			pIndex[2] = static_cast<IndexType>(head + 2);
+			vertex.head = vertex.next = head + 3;
+			break;
+		case 2:
+		case 4:
+			// Strips move their live vertices back down over the ones already drawn.
+			if (vertex.next < head) {
+				for (size_t i = 0; i < vertexCount; i++) {
+					vertex.buff[vertex.next + i] = vertex.buff[head + i];
+				}
+
+				head = vertex.next;
+				vertex.tail = head + vertexCount;
+			}
+
+			for (size_t i = 0; i < vertexCount; i++) {
+				pIndex[i] = static_cast<IndexType>(head + i);
+			}
+
+			vertex.head = head + 1;
+			vertex.next = head + vertexCount;
+			break;
+		case 5:
+			pIndex[0] = static_cast<IndexType>(head);
+			pIndex[1] = static_cast<IndexType>(tail - 2);
+			pIndex[2] = static_cast<IndexType>(tail - 1);
+			vertex.next = tail;
+			break;
+		}
+
+		index.tail += vertexCount;
+	}
+
+	void RenderMesh(SimpleMesh* pMesh, uint32_t /*renderFlags*/)
+	{
+		Kya::Bench::gRenderedMeshCount.fetch_add(1, std::memory_order_relaxed);
+		Kya::Bench::gRenderedIndexCount.fetch_add(pMesh->GetVertexBufferData().GetIndexTail(), std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,385 @@
+#include "SyntheticG3D.h"
+
+#include "port.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace Bench
+		{
+			constexpr uint32_t gGifTagCopyCode = 0x6c018000;
+			constexpr size_t gAlignment = 16;
+
+			// Gouraud, textured, ORed over the configured PRIM type.
+			constexpr uint64_t gStripPrimFlags = (1 << 3) | (1 << 4);
+
+			// Packed STQ, RGBA, XYZ2.
+			constexpr uint64_t gStripRegs = 0x512;
+
+			constexpr uint32_t gSkipFlag = 0x8000;
+			constexpr uint32_t gV12Flag = 0x400;
+			constexpr int gLayerSectionStride = 0x14;
+
+			// Container for everything after the HALL, the library never looks inside it.
+			constexpr uint32_t gGeometryChunkHash = 0x4d4f4547; // GEOM
+
+			struct Vertex12 {
+				int16_t x;
+				int16_t y;
+				int16_t z;
+				int16_t flags;
+			};
+
+			struct Vertex32 {
+				float x;
+				float y;
+				float z;
+				uint32_t flags;
+			};
+
+			struct Normal {
+				int16_t x;
+				int16_t y;
+				int16_t z;
+				int16_t pad;
+			};
+
+			static size_t AlignUp(size_t value, size_t alignment)
+			{
+				return (value + alignment - 1) & ~(alignment - 1);
+			}
+
+			static uint32_t NextRandom(uint32_t& state)
+			{
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				return state;
+			}
+
+			static int GetStripVertexCount(const SyntheticG3DConfig& config)
+			{
+				return config.sectionsPerStrip * config.sectionVertexCount;
+			}
+
+			// Quads per layer in the ST buffer, enough for the base stream or a per section layer stream.
+			static int GetStLayerStride(const SyntheticG3DConfig& config)
+			{
+				const int entries = std::max(GetStripVertexCount(config), config.sectionsPerStrip * gLayerSectionStride);
+				return (entries + 3) / 4;
+			}
+
+			static size_t EstimateFileSize(const SyntheticG3DConfig& config)
+			{
+				const size_t vertexCount = GetStripVertexCount(config);
+
+				size_t stripBytes = sizeof(ed_3d_strip) + gAlignment;
+				stripBytes += (config.sectionsPerStrip * 3 * sizeof(edpkt_data)) + gAlignment;
+				stripBytes += (config.sectionsPerStrip * sizeof(edpkt_data)) + gAlignment;
+				stripBytes += (vertexCount * sizeof(Vertex32)) + gAlignment;
+				stripBytes += (vertexCount * sizeof(Normal)) + gAlignment;
+				stripBytes += (vertexCount * sizeof(uint32_t)) + gAlignment;
+				stripBytes += 16 + (static_cast<size_t>(config.textureLayerCount) * GetStLayerStride(config) * 16) + gAlignment;
+
+				const size_t objectBytes = sizeof(ed_Chunck) + sizeof(ed_g3d_object) + sizeof(ed_hash_code) + (gAlignment * 2) + (config.stripsPerObject * stripBytes);
+				const size_t hierarchyBytes = sizeof(ed_Chunck) + sizeof(ed_g3d_hierarchy) + (config.lodCount * sizeof(ed3DLod)) + gAlignment + (config.lodCount * objectBytes);
+
+				return (sizeof(ed_Chunck) * 3) + (config.hierarchyCount * sizeof(ed_hash_code)) + (config.hierarchyCount * hierarchyBytes) + 4096;
+			}
+
+			static void* AllocateAddressable(size_t size)
+			{
+				// LOAD_POINTER_CAST reads 32 bit fields, so the file has to sit in the low 4GB like real loaded data.
+#ifdef _WIN32
+				for (uintptr_t base = 0x10000000; base < 0x80000000; base += 0x1000000) {
+					if (void* p = VirtualAlloc(reinterpret_cast<void*>(base), size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)) {
+						return p;
+					}
+				}
+
+				return nullptr;
+#else
+				int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_32BIT
+				flags |= MAP_32BIT;
+#endif
+				void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+				return p == MAP_FAILED ? nullptr : p;
+#endif
+			}
+
+			static void FreeAddressable(void* p, size_t size)
+			{
+#ifdef _WIN32
+				VirtualFree(p, 0, MEM_RELEASE);
+#else
+				munmap(p, size);
+#endif
+			}
+		}
+	}
+}
+
+Renderer::Kya::Bench::SyntheticG3D::SyntheticG3D(const SyntheticG3DConfig& inConfig)
+	: config(inConfig)
+	, random(inConfig.seed ? inConfig.seed : 1)
+{
+	assert(config.sectionVertexCount >= 3 && config.sectionVertexCount <= gLayerSectionStride);
+	assert(config.sectionsPerStrip > 0 && config.textureLayerCount > 0);
+
+	capacity = EstimateFileSize(config);
+	pFile = static_cast<uint8_t*>(AllocateAddressable(capacity));
+	assert(pFile);
+
+	// Chunk payloads directly follow their header, the HALL header is followed by the HASH chunk and its table.
+	ed_Chunck* pHALL = static_cast<ed_Chunck*>(AllocateBytes((sizeof(ed_Chunck) * 2) + (config.hierarchyCount * sizeof(ed_hash_code))));
+	pHALL->hash = HASH_CODE_HALL;
+
+	ed_Chunck* pHASH = pHALL + 1;
+	ed_hash_code* pHashCodes = reinterpret_cast<ed_hash_code*>(pHASH + 1);
+	pHASH->hash = HASH_CODE_HASH;
+	pHASH->size = static_cast<int>(sizeof(ed_Chunck) + (config.hierarchyCount * sizeof(ed_hash_code)));
+
+	// HIER chunks follow the hash table inside the HALL, so the HALL holds the table plus one chunk per hierarchy.
+	std::vector<ed_Chunck*> hierarchyChunks;
+	for (int i = 0; i < config.hierarchyCount; i++) {
+		ed_Chunck* pHIER = static_cast<ed_Chunck*>(AllocateBytes(sizeof(ed_Chunck) + sizeof(ed_g3d_hierarchy) + (config.lodCount * sizeof(ed3DLod))));
+		pHIER->hash = HASH_CODE_HIER;
+		pHIER->size = static_cast<int>(sizeof(ed_Chunck) + sizeof(ed_g3d_hierarchy) + (config.lodCount * sizeof(ed3DLod)));
+
+		StorePointer(pHashCodes[i].pData, pHIER);
+		hierarchyChunks.push_back(pHIER);
+	}
+
+	used = AlignUp(used, gAlignment);
+
+	// Chunks are walked by their next offsets, which cover any alignment padding between them.
+	ed_Chunck* pPreviousChunk = pHASH;
+	for (ed_Chunck* pHIER : hierarchyChunks) {
+		pPreviousChunk->nextChunckOffset = static_cast<int>(reinterpret_cast<uint8_t*>(pHIER) - reinterpret_cast<uint8_t*>(pPreviousChunk));
+		pPreviousChunk = pHIER;
+	}
+
+	pPreviousChunk->nextChunckOffset = static_cast<int>((pFile + used) - reinterpret_cast<uint8_t*>(pPreviousChunk));
+
+	pHALL->size = static_cast<int>(used);
+	pHALL->nextChunckOffset = pHALL->size;
+
+	ed_Chunck* pGEOM = Allocate<ed_Chunck>();
+	pGEOM->hash = gGeometryChunkHash;
+
+	for (ed_Chunck* pHIER : hierarchyChunks) {
+		ed_g3d_hierarchy* pHierarchy = reinterpret_cast<ed_g3d_hierarchy*>(pHIER + 1);
+		pHierarchy->lodCount = config.lodCount;
+
+		for (int lodIndex = 0; lodIndex < config.lodCount; lodIndex++) {
+			StorePointer(pHierarchy->aLods[lodIndex].pObj, BuildObject());
+		}
+	}
+
+	pGEOM->size = static_cast<int>((pFile + used) - reinterpret_cast<uint8_t*>(pGEOM));
+	pGEOM->nextChunckOffset = pGEOM->size;
+
+	manager.fileBufferStart = reinterpret_cast<char*>(pFile);
+	manager.HALL = pHALL;
+}
+
+Renderer::Kya::Bench::SyntheticG3D::~SyntheticG3D()
+{
+	FreeAddressable(pFile, capacity);
+}
+
+void* Renderer::Kya::Bench::SyntheticG3D::AllocateBytes(size_t size)
+{
+	used = AlignUp(used, gAlignment);
+	assert(used + size <= capacity);
+
+	void* p = pFile + used;
+	memset(p, 0, size);
+	used += size;
+	return p;
+}
+
+bool Renderer::Kya::Bench::SyntheticG3D::WriteFile(const std::string& path) const
+{
+	std::vector<uint8_t> image(pFile, pFile + used);
+
+	for (size_t fieldOffset : pointerFields) {
+		uint32_t value;
+		memcpy(&value, image.data() + fieldOffset, sizeof(value));
+		value -= static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pFile));
+		memcpy(image.data() + fieldOffset, &value, sizeof(value));
+	}
+
+	FILE* pOut = fopen(path.c_str(), "wb");
+	if (!pOut) {
+		return false;
+	}
+
+	const bool bWritten = fwrite(image.data(), 1, image.size(), pOut) == image.size();
+	return fclose(pOut) == 0 && bWritten;
+}
+
+void Renderer::Kya::Bench::SyntheticG3D::StorePointer(int& field, const void* p)
+{
+	field = static_cast<int>(reinterpret_cast<uintptr_t>(p));
+	assert(LOAD_POINTER_CAST(const void*, field) == p);
+	pointerFields.push_back(reinterpret_cast<uint8_t*>(&field) - pFile);
+}
+
+void Renderer::Kya::Bench::SyntheticG3D::StorePointer(uint32_t& field, const void* p)
+{
+	field = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p));
+	assert(LOAD_POINTER_CAST(const void*, field) == p);
+	pointerFields.push_back(reinterpret_cast<uint8_t*>(&field) - pFile);
+}
+
+ed_hash_code* Renderer::Kya::Bench::SyntheticG3D::BuildObject()
+{
+	ed_hash_code* pHashCode = Allocate<ed_hash_code>();
+
+	ed_Chunck* pOBJ = static_cast<ed_Chunck*>(AllocateBytes(sizeof(ed_Chunck) + sizeof(ed_g3d_object)));
+	pOBJ->hash = HASH_CODE_OBJ;
+	pOBJ->size = static_cast<int>(sizeof(ed_Chunck) + sizeof(ed_g3d_object));
+	pOBJ->nextChunckOffset = pOBJ->size;
+
+	ed_g3d_object* pObject = reinterpret_cast<ed_g3d_object*>(pOBJ + 1);
+
+	StorePointer(pHashCode->pData, pOBJ);
+
+	ed_3d_strip* pPrevious = nullptr;
+
+	for (int i = 0; i < config.stripsPerObject; i++) {
+		ed_3d_strip* pStrip = BuildStrip();
+
+		if (pPrevious) {
+			StorePointer(pPrevious->pNext, pStrip);
+		}
+		else {
+			StorePointer(pObject->p3DData, pStrip);
+		}
+
+		pPrevious = pStrip;
+	}
+
+	pObject->stripCount = config.stripsPerObject;
+	return pHashCode;
+}
+
+ed_3d_strip* Renderer::Kya::Bench::SyntheticG3D::BuildStrip()
+{
+	ed_3d_strip* pStrip = Allocate<ed_3d_strip>();
+	pStrip->flags = config.bV12 ? gV12Flag : 0;
+	pStrip->meshCount = static_cast<short>(config.sectionsPerStrip);
+
+	// Per section: a packet whose second quad carries the GIF tag copy, then the end code.
+	edpkt_data* pVifList = Allocate<edpkt_data>(config.sectionsPerStrip * 3);
+	edpkt_data* pGifPackets = Allocate<edpkt_data>(config.sectionsPerStrip);
+
+	pStrip->vifListOffset = static_cast<int>(reinterpret_cast<char*>(pVifList) - reinterpret_cast<char*>(pStrip));
+
+	const uint64_t prim = (config.primType & 0x7) | gStripPrimFlags;
+
+	for (int j = 0; j < config.sectionsPerStrip; j++) {
+		edpkt_data* pPkt = pVifList + (j * 3);
+		StorePointer(pPkt[1].asU32[1], pGifPackets + j);
+		pPkt[1].asU32[3] = gGifTagCopyCode;
+		pPkt[2].asU32[0] = gVifEndCode;
+
+		const uint64_t eop = j == config.sectionsPerStrip - 1 ? 1 : 0;
+		pGifPackets[j].asU64[0] = static_cast<uint64_t>(config.sectionVertexCount) | (eop << 15) | (1ull << 46) | (prim << 47) | (3ull << 60);
+		pGifPackets[j].asU64[1] = gStripRegs;
+	}
+
+	WriteStripStreams(pStrip);
+
+	strips.push_back(pStrip);
+	return pStrip;
+}
+
+void Renderer::Kya::Bench::SyntheticG3D::WriteStripStreams(ed_3d_strip* pStrip)
+{
+	const int totalVtxCount = GetStripVertexCount(config);
+
+	// Sections overlap by two vertices in the position and normal streams.
+	const int sourceVtxCount = totalVtxCount - ((config.sectionsPerStrip - 1) * 2);
+
+	auto isSkipped = [this](int sourceIndex) {
+		// The first two vertices of the strip only prime the triangle strip. The random skips only draw a number when
+		// asked for, so the default files stay the same.
+		return sourceIndex < 2 || (config.skipPercent > 0 && static_cast<int>(NextRandom(random) % 100) < config.skipPercent);
+	};
+
+	if (config.bV12) {
+		Vertex12* pVertices = Allocate<Vertex12>(sourceVtxCount);
+
+		for (int i = 0; i < sourceVtxCount; i++) {
+			pVertices[i].x = static_cast<int16_t>((NextRandom(random) % 0x8000) - 0x4000);
+			pVertices[i].y = static_cast<int16_t>((NextRandom(random) % 0x8000) - 0x4000);
+			pVertices[i].z = static_cast<int16_t>((NextRandom(random) % 0x8000) - 0x4000);
+			pVertices[i].flags = static_cast<int16_t>(isSkipped(i) ? gSkipFlag : 0);
+		}
+
+		StorePointer(pStrip->pVertexBuf, pVertices);
+	}
+	else {
+		Vertex32* pVertices = Allocate<Vertex32>(sourceVtxCount);
+
+		for (int i = 0; i < sourceVtxCount; i++) {
+			pVertices[i].x = static_cast<float>(NextRandom(random) % 20000) * 0.01f - 100.0f;
+			pVertices[i].y = static_cast<float>(NextRandom(random) % 20000) * 0.01f - 100.0f;
+			pVertices[i].z = static_cast<float>(NextRandom(random) % 20000) * 0.01f - 100.0f;
+			pVertices[i].flags = isSkipped(i) ? gSkipFlag : 0;
+		}
+
+		StorePointer(pStrip->pVertexBuf, pVertices);
+	}
+
+	if (config.bNormals) {
+		Normal* pNormals = Allocate<Normal>(sourceVtxCount);
+
+		for (int i = 0; i < sourceVtxCount; i++) {
+			pNormals[i].x = static_cast<int16_t>(NextRandom(random));
+			pNormals[i].y = static_cast<int16_t>(NextRandom(random));
+			pNormals[i].z = static_cast<int16_t>(NextRandom(random));
+		}
+
+		StorePointer(pStrip->pNormalBuf, pNormals);
+	}
+
+	uint32_t* pColors = Allocate<uint32_t>(totalVtxCount);
+	for (int i = 0; i < totalVtxCount; i++) {
+		pColors[i] = (NextRandom(random) & 0x00ffffff) | 0x80000000;
+	}
+
+	StorePointer(pStrip->pColorBuf, pColors);
+
+	// 16 byte header, word 1 is the layer stride in quads, then one ST stream per layer.
+	const int stLayerStride = GetStLayerStride(config);
+	int* pSTHeader = static_cast<int*>(AllocateBytes(16 + (static_cast<size_t>(config.textureLayerCount) * stLayerStride * 16)));
+	pSTHeader[1] = stLayerStride;
+
+	for (int layer = 0; layer < config.textureLayerCount; layer++) {
+		int16_t* pStq = reinterpret_cast<int16_t*>(pSTHeader + (layer * stLayerStride * 4) + 4);
+
+		for (int i = 0; i < stLayerStride * 4; i++) {
+			pStq[(i * 2) + 0] = static_cast<int16_t>(NextRandom(random) % 1024);
+			pStq[(i * 2) + 1] = static_cast<int16_t>(NextRandom(random) % 1024);
+		}
+	}
+
+	StorePointer(pStrip->pSTBuf, pSTHeader);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ed3D.h"
+#include "ed3D/ed3DG3D.h"
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace Bench
+		{
+			struct SyntheticG3DConfig {
+				int hierarchyCount = 32;
+				int lodCount = 2;
+				int stripsPerObject = 8;
+				int sectionsPerStrip = 4;
+
+				// Vertices per GIF section, at most 0x14 since layer ST streams are laid out per section at that stride.
+				int sectionVertexCount = 0x14;
+
+				bool bV12 = true;
+				bool bNormals = true;
+				// More than one so the default benchmark run covers the layer build.
+				int textureLayerCount = 2;
+
+				// PRIM type every strip draws with, a triangle strip by default.
+				uint32_t primType = 4;
+				// Chance in percent of each vertex after the first two carrying the skip flag.
+				int skipPercent = 0;
+				uint32_t seed = 1;
+			};
+
+			// Builds a G3D file in memory with the chunk, strip and VIF/GIF layout the mesh library reads: a HALL of
+			// hierarchies, each LOD holding an object with a chain of strips. No CSTA cluster is generated.
+			// The objects and strips sit in a GEOM chunk after the HALL, so the file is a flat run of top level chunks.
+			class SyntheticG3D
+			{
+			public:
+				explicit SyntheticG3D(const SyntheticG3DConfig& config);
+				~SyntheticG3D();
+
+				SyntheticG3D(const SyntheticG3D&) = delete;
+				SyntheticG3D& operator=(const SyntheticG3D&) = delete;
+
+				ed_g3d_manager* GetManager() { return &manager; }
+				const std::vector<ed_3d_strip*>& GetStrips() const { return strips; }
+				size_t GetFileSize() const { return used; }
+
+				// Writes the file as it sits on disk, with every pointer field back to an offset from the start of the file.
+				bool WriteFile(const std::string& path) const;
+
+			private:
+				template<typename T>
+				T* Allocate(size_t count = 1)
+				{
+					return static_cast<T*>(AllocateBytes(sizeof(T) * count));
+				}
+
+				void* AllocateBytes(size_t size);
+
+				// Packs a pointer into the 32 bit form LOAD_POINTER_CAST reads, remembering the field for WriteFile.
+				void StorePointer(int& field, const void* p);
+				void StorePointer(uint32_t& field, const void* p);
+
+				ed_Chunck* BuildHierarchyChunk();
+				ed_hash_code* BuildObject();
+				ed_3d_strip* BuildStrip();
+				void WriteStripStreams(ed_3d_strip* pStrip);
+
+				SyntheticG3DConfig config;
+				ed_g3d_manager manager = {};
+				std::vector<ed_3d_strip*> strips;
+
+				// Offsets of the fields holding a pointer.
+				std::vector<size_t> pointerFields;
+
+				uint8_t* pFile = nullptr;
+				size_t capacity = 0;
+				size_t used = 0;
+				uint32_t random = 0;
+			};
+		}
+	}
+}
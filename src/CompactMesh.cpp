@@ -0,0 +1,172 @@
+#include "CompactMesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Same scales the strip decoder applies to int12 positions and int15 normals.
+		constexpr float gInt12Scale = 1.0f / 4096.0f;
+		constexpr float gInt15Scale = 1.0f / 32768.0f;
+
+		// Quantizes value as value / scale, only succeeding when that is an int16 that converts back exactly.
+		static bool QuantizeExact(const float value, const float scale, int16_t& out)
+		{
+			const float scaled = value / scale;
+			if (!(scaled >= -32768.0f && scaled <= 32767.0f)) {
+				return false;
+			}
+
+			out = static_cast<int16_t>(scaled);
+			return static_cast<float>(out) * scale == value;
+		}
+
+		static bool QuantizePositionsExact(const CompactMesh::ExpandedVertex* pVertices, size_t vertexCount, std::vector<CompactMesh::Vertex>& vertices)
+		{
+			for (size_t i = 0; i < vertexCount; i++) {
+				for (int c = 0; c < 3; c++) {
+					if (!QuantizeExact(pVertices[i].xyz[c], gInt12Scale, vertices[i].position[c])) {
+						return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		static void QuantizePositionsToBounds(const CompactMesh::ExpandedVertex* pVertices, size_t vertexCount, CompactMesh& mesh, std::vector<CompactMesh::Vertex>& vertices)
+		{
+			float minimum[3] = { pVertices[0].xyz[0], pVertices[0].xyz[1], pVertices[0].xyz[2] };
+			float maximum[3] = { minimum[0], minimum[1], minimum[2] };
+
+			for (size_t i = 1; i < vertexCount; i++) {
+				for (int c = 0; c < 3; c++) {
+					minimum[c] = std::min(minimum[c], pVertices[i].xyz[c]);
+					maximum[c] = std::max(maximum[c], pVertices[i].xyz[c]);
+				}
+			}
+
+			float halfExtent = 0.0f;
+			for (int c = 0; c < 3; c++) {
+				mesh.positionOffset[c] = (minimum[c] + maximum[c]) * 0.5f;
+				halfExtent = std::max(halfExtent, (maximum[c] - minimum[c]) * 0.5f);
+			}
+
+			mesh.positionScale = halfExtent > 0.0f ? halfExtent / 32767.0f : 1.0f;
+
+			for (size_t i = 0; i < vertexCount; i++) {
+				for (int c = 0; c < 3; c++) {
+					const float quantized = std::round((pVertices[i].xyz[c] - mesh.positionOffset[c]) / mesh.positionScale);
+					vertices[i].position[c] = static_cast<int16_t>(std::clamp(quantized, -32767.0f, 32767.0f));
+				}
+			}
+		}
+	}
+}
+
+bool Renderer::Kya::CompactMesh::Build(const ExpandedVertex* pVertices, size_t vertexCount, const void* pIndices, size_t indexSize, size_t indexCount)
+{
+	vertices.clear();
+	indices.clear();
+
+	if (vertexCount == 0 || vertexCount > 0x10000) {
+		return false;
+	}
+
+	std::vector<Vertex> compact(vertexCount);
+
+	for (size_t i = 0; i < vertexCount; i++) {
+		const ExpandedVertex& in = pVertices[i];
+		Vertex& out = compact[i];
+
+		if (in.q != 1.0f) {
+			return false;
+		}
+
+		out.flags = in.flags;
+
+		for (int c = 0; c < 4; c++) {
+			if (in.rgba[c] > 0xff) {
+				return false;
+			}
+
+			out.rgba[c] = static_cast<uint8_t>(in.rgba[c]);
+		}
+
+		for (int c = 0; c < 2; c++) {
+			if (!QuantizeExact(in.st[c], 1.0f, out.st[c])) {
+				return false;
+			}
+		}
+
+		for (int c = 0; c < 4; c++) {
+			if (!QuantizeExact(in.normal[c], gInt15Scale, out.normal[c])) {
+				return false;
+			}
+		}
+	}
+
+	if (QuantizePositionsExact(pVertices, vertexCount, compact)) {
+		positionScale = gInt12Scale;
+		positionOffset[0] = positionOffset[1] = positionOffset[2] = 0.0f;
+	}
+	else {
+		QuantizePositionsToBounds(pVertices, vertexCount, *this, compact);
+	}
+
+	indices.resize(indexCount);
+
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t index = 0;
+		memcpy(&index, static_cast<const uint8_t*>(pIndices) + (i * indexSize), std::min(indexSize, sizeof(index)));
+		indices[i] = static_cast<uint16_t>(index);
+	}
+
+	vertices = std::move(compact);
+	return true;
+}
+
+Renderer::Kya::CompactMesh::ExpandedVertex Renderer::Kya::CompactMesh::GetVertex(size_t index) const
+{
+	const Vertex& in = vertices[index];
+
+	ExpandedVertex out;
+	out.st[0] = static_cast<float>(in.st[0]);
+	out.st[1] = static_cast<float>(in.st[1]);
+	out.q = 1.0f;
+
+	for (int c = 0; c < 4; c++) {
+		out.rgba[c] = in.rgba[c];
+		out.normal[c] = static_cast<float>(in.normal[c]) * gInt15Scale;
+	}
+
+	for (int c = 0; c < 3; c++) {
+		out.xyz[c] = positionOffset[c] + (static_cast<float>(in.position[c]) * positionScale);
+	}
+
+	out.flags = in.flags;
+	return out;
+}
+
+void Renderer::Kya::CompactMesh::ExpandVertices(ExpandedVertex* pOut) const
+{
+	for (size_t i = 0; i < vertices.size(); i++) {
+		pOut[i] = GetVertex(i);
+	}
+}
+
+void Renderer::Kya::CompactMesh::ExpandIndices(void* pOut, size_t indexSize) const
+{
+	for (size_t i = 0; i < indices.size(); i++) {
+		const uint32_t index = indices[i];
+		memcpy(static_cast<uint8_t*>(pOut) + (i * indexSize), &index, std::min(indexSize, sizeof(index)));
+	}
+}
+
+size_t Renderer::Kya::CompactMesh::GetBytes() const
+{
+	return (vertices.size() * sizeof(Vertex)) + (indices.size() * sizeof(uint16_t));
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Quantized copy of a decoded strip mesh, see MeshLibrary::SetCompactStorage. Colours, ST, normals and v12
+		// positions come from integer source data and round trip exactly, v32 positions are quantized over the mesh bounds.
+		class CompactMesh
+		{
+		public:
+			// Float vertex as decoded, same layout as GSVertexUnprocessedNormal.
+			struct ExpandedVertex {
+				float st[2];
+				float q;
+				uint32_t rgba[4];
+				float xyz[3];
+				uint32_t flags;
+				float normal[4];
+			};
+
+			struct Vertex {
+				uint32_t flags;
+				uint8_t rgba[4];
+				int16_t position[3];
+				int16_t st[2];
+				int16_t normal[4];
+			};
+
+			// Returns false and stays empty when the mesh has components the compact layout can't hold.
+			bool Build(const ExpandedVertex* pVertices, size_t vertexCount, const void* pIndices, size_t indexSize, size_t indexCount);
+
+			ExpandedVertex GetVertex(size_t index) const;
+
+			// Writes every vertex, or every index at the given index size, back out in full.
+			void ExpandVertices(ExpandedVertex* pOut) const;
+			void ExpandIndices(void* pOut, size_t indexSize) const;
+
+			size_t GetVertexCount() const { return vertices.size(); }
+			size_t GetIndexCount() const { return indices.size(); }
+			bool IsEmpty() const { return vertices.empty(); }
+			size_t GetBytes() const;
+
+			// position = positionOffset + quantized * positionScale
+			float positionScale = 0.0f;
+			float positionOffset[3] = {};
+
+		private:
+			std::vector<Vertex> vertices;
+			std::vector<uint16_t> indices;
+		};
+	}
+}
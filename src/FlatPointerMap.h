@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "MeshEpoch.h"
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Open addressing map from a pointer key to a pointer value, stored in one flat array.
+		// Linear probing over a power of two table, so a lookup is normally a single cache line.
+		//
+		// Find is safe against one writer running Set, Erase or Clear at the same time. Slots are written value first
+		// and key last, and a table outgrown by a rehash is retired through pEpoch, so callers of Find on other threads
+		// must be pinned in it. Without an epoch domain old tables are freed straight away and the map is single threaded.
+		template<typename Key, typename Value>
+		class FlatPointerMap
+		{
+		public:
+			explicit FlatPointerMap(EpochDomain* pEpoch = nullptr)
+				: pEpoch(pEpoch)
+			{
+			}
+
+			~FlatPointerMap()
+			{
+				delete pTable.load(std::memory_order_relaxed);
+			}
+
+			FlatPointerMap(const FlatPointerMap&) = delete;
+			FlatPointerMap& operator=(const FlatPointerMap&) = delete;
+
+			Value* Find(const Key* pKey) const
+			{
+				const Table* pCurrent = pTable.load(std::memory_order_acquire);
+				if (!pCurrent) {
+					return nullptr;
+				}
+
+				for (size_t index = pCurrent->GetHomeSlot(pKey);; index = (index + 1) & pCurrent->mask) {
+					const Slot& slot = pCurrent->slots[index];
+					const Key* pSlotKey = slot.pKey.load(std::memory_order_acquire);
+
+					if (pSlotKey == pKey) {
+						return slot.pValue.load(std::memory_order_acquire);
+					}
+
+					if (pSlotKey == nullptr) {
+						return nullptr;
+					}
+				}
+			}
+
+			// Inserts or overwrites the value for pKey.
+			void Set(const Key* pKey, Value* pValue)
+			{
+				Table* pCurrent = pTable.load(std::memory_order_relaxed);
+
+				if (!pCurrent || (pCurrent->usedSlots + 1) * 4 > pCurrent->GetCapacity() * 3) {
+					const size_t capacity = pCurrent ? pCurrent->GetCapacity() : 0;
+					pCurrent = Rehash(!pCurrent ? 64 : (count + 1) * 4 > capacity * 3 ? capacity * 2 : capacity);
+				}
+
+				for (size_t index = pCurrent->GetHomeSlot(pKey);; index = (index + 1) & pCurrent->mask) {
+					Slot& slot = pCurrent->slots[index];
+					const Key* pSlotKey = slot.pKey.load(std::memory_order_relaxed);
+
+					if (pSlotKey == pKey) {
+						slot.pValue.store(pValue, std::memory_order_release);
+						return;
+					}
+
+					// Tombstones are left for the next rehash. Reusing one in place could hand a reader that matched the
+					// erased key the value of the new one.
+					if (pSlotKey == nullptr) {
+						// A reader that finds the key must also find its value.
+						slot.pValue.store(pValue, std::memory_order_relaxed);
+						slot.pKey.store(pKey, std::memory_order_release);
+						pCurrent->usedSlots++;
+						count++;
+						return;
+					}
+				}
+			}
+
+			bool Erase(const Key* pKey)
+			{
+				Table* pCurrent = pTable.load(std::memory_order_relaxed);
+				if (!pCurrent) {
+					return false;
+				}
+
+				for (size_t index = pCurrent->GetHomeSlot(pKey);; index = (index + 1) & pCurrent->mask) {
+					Slot& slot = pCurrent->slots[index];
+					const Key* pSlotKey = slot.pKey.load(std::memory_order_relaxed);
+
+					if (pSlotKey == pKey) {
+						slot.pKey.store(GetTombstone(), std::memory_order_release);
+						slot.pValue.store(nullptr, std::memory_order_release);
+						count--;
+						return true;
+					}
+
+					if (pSlotKey == nullptr) {
+						return false;
+					}
+				}
+			}
+
+			// Writer side only.
+			template<typename Func>
+			void ForEach(Func func) const
+			{
+				const Table* pCurrent = pTable.load(std::memory_order_relaxed);
+				if (!pCurrent) {
+					return;
+				}
+
+				for (size_t index = 0; index < pCurrent->GetCapacity(); index++) {
+					const Slot& slot = pCurrent->slots[index];
+					const Key* pSlotKey = slot.pKey.load(std::memory_order_relaxed);
+
+					if (pSlotKey != nullptr && pSlotKey != GetTombstone()) {
+						func(pSlotKey, slot.pValue.load(std::memory_order_relaxed));
+					}
+				}
+			}
+
+			void Clear()
+			{
+				RetireTable(pTable.exchange(nullptr, std::memory_order_acq_rel));
+				count = 0;
+			}
+
+			inline size_t Size() const { return count; }
+
+		private:
+			struct Slot {
+				std::atomic<const Key*> pKey = nullptr;
+				std::atomic<Value*> pValue = nullptr;
+			};
+
+			struct Table {
+				explicit Table(size_t capacity)
+					: slots(new Slot[capacity])
+					, mask(capacity - 1)
+				{
+				}
+
+				size_t GetHomeSlot(const Key* pKey) const
+				{
+					uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(pKey));
+					hash ^= hash >> 33;
+					hash *= 0xff51afd7ed558ccdull;
+					hash ^= hash >> 33;
+					return static_cast<size_t>(hash) & mask;
+				}
+
+				inline size_t GetCapacity() const { return mask + 1; }
+
+				std::unique_ptr<Slot[]> slots;
+				size_t mask = 0;
+
+				// Live plus tombstones, which is what bounds the probe length.
+				size_t usedSlots = 0;
+			};
+
+			static const Key* GetTombstone() { return reinterpret_cast<const Key*>(uintptr_t(1)); }
+
+			// Builds the new table off to the side and swaps it in whole, readers see either table complete.
+			Table* Rehash(size_t newCapacity)
+			{
+				Table* pOld = pTable.load(std::memory_order_relaxed);
+				Table* pNew = new Table(newCapacity);
+				count = 0;
+
+				if (pOld) {
+					for (size_t index = 0; index < pOld->GetCapacity(); index++) {
+						const Slot& slot = pOld->slots[index];
+						const Key* pSlotKey = slot.pKey.load(std::memory_order_relaxed);
+
+						if (pSlotKey != nullptr && pSlotKey != GetTombstone()) {
+							InsertUnique(pNew, pSlotKey, slot.pValue.load(std::memory_order_relaxed));
+						}
+					}
+				}
+
+				pTable.store(pNew, std::memory_order_release);
+				RetireTable(pOld);
+				return pNew;
+			}
+
+			// Only for filling a table no reader has seen yet.
+			void InsertUnique(Table* pInto, const Key* pKey, Value* pValue)
+			{
+				size_t index = pInto->GetHomeSlot(pKey);
+				while (pInto->slots[index].pKey.load(std::memory_order_relaxed) != nullptr) {
+					index = (index + 1) & pInto->mask;
+				}
+
+				pInto->slots[index].pKey.store(pKey, std::memory_order_relaxed);
+				pInto->slots[index].pValue.store(pValue, std::memory_order_relaxed);
+				pInto->usedSlots++;
+				count++;
+			}
+
+			void RetireTable(Table* pOld)
+			{
+				if (!pOld) {
+					return;
+				}
+
+				if (pEpoch) {
+					pEpoch->Retire([pOld]() { delete pOld; });
+				}
+				else {
+					delete pOld;
+				}
+			}
+
+			std::atomic<Table*> pTable = nullptr;
+			EpochDomain* pEpoch = nullptr;
+
+			// Live entries, writer side only.
+			size_t count = 0;
+		};
+	}
+}
@@ -0,0 +1,625 @@
+#include "G3DFile.h"
+
+#include "ed3D.h"
+#include "ed3D/ed3DG3D.h"
+#include "port.h"
+
+#include <cstring>
+#include <unordered_set>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		constexpr uint32_t gGifTagCopyCode = 0x6c018000;
+		constexpr uint32_t gV12Flag = 0x400;
+
+		// NLOOP, the vertex count of a section, is the low 15 bits of its GIF tag.
+		constexpr uint64_t gGifTagLoopMask = 0x7fff;
+
+		constexpr size_t gVertex12Size = 8;
+		constexpr size_t gVertex32Size = 16;
+		constexpr size_t gColorSize = 4;
+		constexpr size_t gStSize = 4;
+		constexpr size_t gStHeaderSize = 16;
+
+		// G3D reads the cluster strip count from the last entry.
+		constexpr int gClusterStripCountIndex = 4;
+
+		// Resolved offsets have to fit the 32 bit fields LOAD_POINTER_CAST reads.
+		constexpr uint64_t gAddressableLimit = 0x100000000ull;
+	}
+}
+
+// Walks the chunks G3D reads in the same order it does, checking each against the file before turning its offset
+// fields into pointers.
+class Renderer::Kya::G3DFile::Resolver
+{
+public:
+	Resolver(uint8_t* pBegin, size_t size)
+		: pBegin(pBegin)
+		, pEnd(pBegin + size)
+	{
+	}
+
+	bool ResolveFile(ed_g3d_manager& manager);
+
+	inline const std::string& GetError() const { return error; }
+
+private:
+	bool Fail(const char* reason, const void* pAt)
+	{
+		error = std::string(reason) + " at offset " + std::to_string(reinterpret_cast<uintptr_t>(pAt) - reinterpret_cast<uintptr_t>(pBegin));
+		return false;
+	}
+
+	bool Contains(const void* p, size_t size, const void* pLimit) const
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+		const uintptr_t limit = reinterpret_cast<uintptr_t>(pLimit);
+		return address >= reinterpret_cast<uintptr_t>(pBegin) && address <= limit && size <= limit - address;
+	}
+
+	ed_Chunck* CheckChunk(void* p, const void* pLimit, const char* reason)
+	{
+		ed_Chunck* pChunk = static_cast<ed_Chunck*>(p);
+
+		if (reinterpret_cast<uintptr_t>(p) % alignof(ed_Chunck) != 0 || !Contains(p, sizeof(ed_Chunck), pLimit) ||
+			pChunk->size < static_cast<int>(sizeof(ed_Chunck)) || !Contains(p, static_cast<size_t>(pChunk->size), pLimit)) {
+			Fail(reason, p);
+			return nullptr;
+		}
+
+		return pChunk;
+	}
+
+	// Turns an offset field into a pointer to size bytes inside the file, 0 stays null.
+	template<typename T, typename Field>
+	bool Resolve(Field& field, size_t size, T*& pOut, const char* reason)
+	{
+		if (field == 0) {
+			pOut = nullptr;
+			return true;
+		}
+
+		// Fields reached again, through a shared object or the first section's GIF tag copy, already hold a pointer.
+		if (resolvedFields.insert(&field).second) {
+			const uintptr_t address = reinterpret_cast<uintptr_t>(pBegin) + static_cast<uint32_t>(field);
+
+			if (address % alignof(T) != 0 || !Contains(reinterpret_cast<void*>(address), size, pEnd)) {
+				return Fail(reason, &field);
+			}
+
+			field = static_cast<Field>(address);
+		}
+
+		pOut = LOAD_POINTER_CAST(T*, field);
+		return Contains(pOut, size, pEnd) ? true : Fail(reason, &field);
+	}
+
+	template<typename Field>
+	bool ResolveStrips(Field& firstStrip, int64_t stripCount)
+	{
+		// Larger counts could only come from a chain looping back on itself.
+		if (stripCount > static_cast<int64_t>((pEnd - pBegin) / sizeof(ed_3d_strip))) {
+			return Fail("Strip count larger than the file", &firstStrip);
+		}
+
+		ed_3d_strip* pStrip = nullptr;
+		if (!Resolve(firstStrip, sizeof(ed_3d_strip), pStrip, "Strip offset out of range")) {
+			return false;
+		}
+
+		for (int64_t i = 0; i < stripCount; i++) {
+			if (!pStrip) {
+				return Fail("Strip chain ends early", &firstStrip);
+			}
+
+			if (!ResolveStrip(*pStrip)) {
+				return false;
+			}
+
+			// G3D never follows the last strip's next field.
+			if (i + 1 < stripCount && !Resolve(pStrip->pNext, sizeof(ed_3d_strip), pStrip, "Strip offset out of range")) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool ResolveHALL(ed_Chunck* pHALL);
+	bool ResolveCSTA(ed_Chunck* pCSTA);
+	bool ResolveHierarchy(ed_hash_code& hashCode);
+	bool ResolveLod(ed3DLod& lod);
+	bool ResolveStrip(ed_3d_strip& strip);
+
+	uint8_t* pBegin;
+	uint8_t* pEnd;
+
+	std::unordered_set<const void*> resolvedFields;
+	std::string error;
+};
+
+bool Renderer::Kya::G3DFile::Resolver::ResolveFile(ed_g3d_manager& manager)
+{
+	const size_t fileSize = static_cast<size_t>(pEnd - pBegin);
+	size_t offset = 0;
+
+	// Trailing bytes too short for a chunk header are padding.
+	while (offset < fileSize && fileSize - offset >= sizeof(ed_Chunck)) {
+		ed_Chunck* pChunk = CheckChunk(pBegin + offset, pEnd, "Chunk overruns the file");
+		if (!pChunk) {
+			return false;
+		}
+
+		if (pChunk->nextChunckOffset < static_cast<int>(sizeof(ed_Chunck))) {
+			return Fail("Chunk has no next offset", pChunk);
+		}
+
+		if (pChunk->hash == HASH_CODE_HALL || pChunk->hash == HASH_CODE_CSTA) {
+			ed_Chunck*& pFound = pChunk->hash == HASH_CODE_HALL ? manager.HALL : manager.CSTA;
+
+			if (pFound) {
+				return Fail("Duplicate HALL or CSTA chunk", pChunk);
+			}
+
+			pFound = pChunk;
+		}
+
+		offset += pChunk->nextChunckOffset;
+	}
+
+	if (!manager.HALL && !manager.CSTA) {
+		return Fail("No HALL or CSTA chunk", pBegin);
+	}
+
+	if (manager.HALL && !ResolveHALL(manager.HALL)) {
+		return false;
+	}
+
+	if (manager.CSTA && !ResolveCSTA(manager.CSTA)) {
+		return false;
+	}
+
+	manager.fileBufferStart = reinterpret_cast<char*>(pBegin);
+	return true;
+}
+
+bool Renderer::Kya::G3DFile::Resolver::ResolveHALL(ed_Chunck* pHALL)
+{
+	uint8_t* const pHallEnd = reinterpret_cast<uint8_t*>(pHALL) + pHALL->size;
+
+	ed_Chunck* pHASH = CheckChunk(pHALL + 1, pHallEnd, "HALL hash table overruns the HALL");
+	if (!pHASH) {
+		return false;
+	}
+
+	if (pHASH->hash != HASH_CODE_HASH) {
+		return Fail("HALL does not start with a hash table", pHASH);
+	}
+
+	// G3D counts the chunks from the hash table on, the ones after the table are the hierarchies.
+	const size_t hallEnd = static_cast<size_t>(pHallEnd - pBegin);
+	size_t chunkCount = 0;
+
+	for (size_t offset = static_cast<size_t>(reinterpret_cast<uint8_t*>(pHASH) - pBegin); offset < hallEnd; chunkCount++) {
+		ed_Chunck* pChunk = CheckChunk(pBegin + offset, pHallEnd, "HALL chunk overruns the HALL");
+		if (!pChunk) {
+			return false;
+		}
+
+		if (pChunk->nextChunckOffset < static_cast<int>(sizeof(ed_Chunck))) {
+			return Fail("HALL chunk has no next offset", pChunk);
+		}
+
+		offset += pChunk->nextChunckOffset;
+	}
+
+	const size_t hashCodeCount = (pHASH->size - sizeof(ed_Chunck)) / sizeof(ed_hash_code);
+
+	if (chunkCount - 1 > hashCodeCount) {
+		return Fail("HALL has more hierarchies than hash codes", pHASH);
+	}
+
+	ed_hash_code* pHashCodes = reinterpret_cast<ed_hash_code*>(pHASH + 1);
+
+	for (size_t i = 0; i + 1 < chunkCount; i++) {
+		if (!ResolveHierarchy(pHashCodes[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Renderer::Kya::G3DFile::Resolver::ResolveCSTA(ed_Chunck* pCSTA)
+{
+	uint8_t* const pCstaEnd = reinterpret_cast<uint8_t*>(pCSTA) + pCSTA->size;
+
+	ed_Chunck* pClusterTypeChunk = CheckChunk(pCSTA + 1, pCstaEnd, "Cluster chunk overruns the CSTA");
+	if (!pClusterTypeChunk) {
+		return false;
+	}
+
+	if (pClusterTypeChunk->hash == HASH_CODE_CDOA) {
+		return Fail("CDOA clusters are not supported", pClusterTypeChunk);
+	}
+
+	if (pClusterTypeChunk->hash != HASH_CODE_CDQA) {
+		// G3D skips any other cluster type.
+		return true;
+	}
+
+	uint8_t* const pClusterTypeEnd = reinterpret_cast<uint8_t*>(pClusterTypeChunk) + pClusterTypeChunk->size;
+	MeshData_CSTA* pMeshData = reinterpret_cast<MeshData_CSTA*>(pClusterTypeChunk + 1);
+
+	if (!Contains(pMeshData, sizeof(MeshData_CSTA), pClusterTypeEnd)) {
+		return Fail("CDQA header overruns its chunk", pClusterTypeChunk);
+	}
+
+	if (reinterpret_cast<uint8_t*>(pMeshData + 1) >= pClusterTypeEnd) {
+		// No CDQU, nothing for G3D to process.
+		return true;
+	}
+
+	ed_Chunck* pCDQU = CheckChunk(pMeshData + 1, pClusterTypeEnd, "CDQU chunk overruns the CDQA");
+	if (!pCDQU) {
+		return false;
+	}
+
+	ed_g3d_cluster* pCluster = reinterpret_cast<ed_g3d_cluster*>(pCDQU + 1);
+
+	if (!Contains(pCluster, sizeof(ed_g3d_cluster), reinterpret_cast<uint8_t*>(pCDQU) + pCDQU->size)) {
+		return Fail("Cluster overruns its CDQU chunk", pCDQU);
+	}
+
+	const uint32_t stripCount = pCluster->aClusterStripCounts[gClusterStripCountIndex];
+
+	if (stripCount != 0) {
+		if (pCluster->p3DStrip == 0) {
+			return Fail("Cluster has strips but no strip chain", pCluster);
+		}
+
+		if (!ResolveStrips(pCluster->p3DStrip, stripCount)) {
+			return false;
+		}
+	}
+
+	const uint32_t clusterHierCount = pCluster->clusterDetails.clusterHierCount;
+
+	if (clusterHierCount != 0) {
+		ed_Chunck* pHASH = reinterpret_cast<ed_Chunck*>(pCluster + 1);
+		ed_hash_code* pHashCodes = reinterpret_cast<ed_hash_code*>(pHASH + 1);
+
+		if (!Contains(pHashCodes, static_cast<size_t>(clusterHierCount) * sizeof(ed_hash_code), pEnd)) {
+			return Fail("Cluster hierarchy hash codes overrun the file", pHASH);
+		}
+
+		for (uint32_t i = 0; i < clusterHierCount; i++) {
+			if (!ResolveHierarchy(pHashCodes[i])) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool Renderer::Kya::G3DFile::Resolver::ResolveHierarchy(ed_hash_code& hashCode)
+{
+	ed_Chunck* pHIER = nullptr;
+	if (!Resolve(hashCode.pData, sizeof(ed_Chunck), pHIER, "Hierarchy offset out of range")) {
+		return false;
+	}
+
+	if (!pHIER) {
+		return Fail("Hierarchy hash code has no chunk", &hashCode);
+	}
+
+	if (!CheckChunk(pHIER, pEnd, "Hierarchy chunk overruns the file")) {
+		return false;
+	}
+
+	if (pHIER->hash != HASH_CODE_HIER) {
+		return Fail("Hierarchy hash code does not point at a HIER chunk", pHIER);
+	}
+
+	uint8_t* const pHierEnd = reinterpret_cast<uint8_t*>(pHIER) + pHIER->size;
+	ed_g3d_hierarchy* pHierarchy = reinterpret_cast<ed_g3d_hierarchy*>(pHIER + 1);
+
+	const size_t headerSize = reinterpret_cast<uint8_t*>(pHierarchy->aLods) - reinterpret_cast<uint8_t*>(pHierarchy);
+	if (!Contains(pHierarchy, headerSize, pHierEnd)) {
+		return Fail("Hierarchy overruns its HIER chunk", pHIER);
+	}
+
+	const int64_t lodCount = pHierarchy->lodCount;
+	if (lodCount < 0 || !Contains(pHierarchy->aLods, static_cast<size_t>(lodCount) * sizeof(ed3DLod), pHierEnd)) {
+		return Fail("Hierarchy LODs overrun its HIER chunk", pHIER);
+	}
+
+	for (int64_t i = 0; i < lodCount; i++) {
+		if (!ResolveLod(pHierarchy->aLods[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Renderer::Kya::G3DFile::Resolver::ResolveLod(ed3DLod& lod)
+{
+	ed_hash_code* pHashCode = nullptr;
+	if (!Resolve(lod.pObj, sizeof(ed_hash_code), pHashCode, "LOD object offset out of range")) {
+		return false;
+	}
+
+	if (!pHashCode) {
+		// G3D skips a LOD without an object.
+		return true;
+	}
+
+	ed_Chunck* pOBJ = nullptr;
+	if (!Resolve(pHashCode->pData, sizeof(ed_Chunck), pOBJ, "Object chunk offset out of range")) {
+		return false;
+	}
+
+	if (!pOBJ) {
+		return true;
+	}
+
+	if (!CheckChunk(pOBJ, pEnd, "Object chunk overruns the file")) {
+		return false;
+	}
+
+	ed_g3d_object* pObject = reinterpret_cast<ed_g3d_object*>(pOBJ + 1);
+
+	if (!Contains(pObject, sizeof(ed_g3d_object), reinterpret_cast<uint8_t*>(pOBJ) + pOBJ->size)) {
+		return Fail("Object overruns its OBJ chunk", pOBJ);
+	}
+
+	if (pObject->p3DData == 0) {
+		return true;
+	}
+
+	return ResolveStrips(pObject->p3DData, pObject->stripCount);
+}
+
+bool Renderer::Kya::G3DFile::Resolver::ResolveStrip(ed_3d_strip& strip)
+{
+	if (strip.meshCount <= 0) {
+		return Fail("Strip has no sections", &strip);
+	}
+
+	edpkt_data* const pVifList = reinterpret_cast<edpkt_data*>(reinterpret_cast<uintptr_t>(&strip) + static_cast<intptr_t>(strip.vifListOffset));
+	edpkt_data* pPkt = pVifList;
+	uint64_t totalVtxCount = 0;
+
+	if (reinterpret_cast<uintptr_t>(pVifList) % alignof(edpkt_data) != 0) {
+		return Fail("Strip VIF list is misaligned", &strip);
+	}
+
+	for (int j = 0; j < strip.meshCount; j++) {
+		// Same walk as G3D, each section after the first starts on the packet following the previous end code.
+		if (j > 0) {
+			while (true) {
+				if (!Contains(pPkt, sizeof(edpkt_data), pEnd)) {
+					return Fail("Strip VIF list runs off the end of the file", &strip);
+				}
+
+				if (pPkt->asU32[0] == gVifEndCode) {
+					break;
+				}
+
+				pPkt++;
+			}
+
+			pPkt++;
+		}
+
+		if (!Contains(pPkt, sizeof(edpkt_data) * 2, pEnd)) {
+			return Fail("Strip VIF list runs off the end of the file", &strip);
+		}
+
+		// A section without its own GIF tag copy uses the one at the start of the list.
+		edpkt_data* pCopy = pPkt[1].asU32[3] == gGifTagCopyCode ? pPkt : pVifList;
+
+		if (!Contains(pCopy, sizeof(edpkt_data) * 2, pEnd) || pCopy[1].asU32[3] != gGifTagCopyCode) {
+			return Fail("Strip section has no GIF tag", &strip);
+		}
+
+		uint8_t* pGifPkt = nullptr;
+		if (!Resolve(pCopy[1].asU32[1], sizeof(edpkt_data), pGifPkt, "GIF tag offset out of range")) {
+			return false;
+		}
+
+		if (!pGifPkt) {
+			return Fail("Strip section has no GIF tag", &strip);
+		}
+
+		uint64_t tag;
+		memcpy(&tag, pGifPkt, sizeof(tag));
+		totalVtxCount += tag & gGifTagLoopMask;
+	}
+
+	// Sections overlap by two vertices in the position and normal streams.
+	const uint64_t overlap = static_cast<uint64_t>(strip.meshCount - 1) * 2;
+	if (totalVtxCount <= overlap) {
+		return Fail("Strip sections have too few vertices", &strip);
+	}
+
+	const size_t sourceVtxCount = static_cast<size_t>(totalVtxCount - overlap);
+	const size_t vertexSize = (strip.flags & gV12Flag) != 0 ? gVertex12Size : gVertex32Size;
+
+	uint32_t* pVertices = nullptr;
+	if (!Resolve(strip.pVertexBuf, sourceVtxCount * vertexSize, pVertices, "Vertex stream out of range")) {
+		return false;
+	}
+
+	edVertexNormal* pNormals = nullptr;
+	if (!Resolve(strip.pNormalBuf, sourceVtxCount * sizeof(edVertexNormal), pNormals, "Normal stream out of range")) {
+		return false;
+	}
+
+	uint32_t* pColors = nullptr;
+	if (!Resolve(strip.pColorBuf, static_cast<size_t>(totalVtxCount) * gColorSize, pColors, "Colour stream out of range")) {
+		return false;
+	}
+
+	uint32_t* pST = nullptr;
+	if (!Resolve(strip.pSTBuf, gStHeaderSize + (static_cast<size_t>(totalVtxCount) * gStSize), pST, "ST stream out of range")) {
+		return false;
+	}
+
+	if (!pVertices || !pColors || !pST) {
+		return Fail("Strip is missing a vertex, colour or ST stream", &strip);
+	}
+
+	return true;
+}
+
+Renderer::Kya::G3DFile::G3DFile()
+	: pManager(std::make_unique<ed_g3d_manager>())
+{
+}
+
+Renderer::Kya::G3DFile::~G3DFile()
+{
+	Close();
+}
+
+bool Renderer::Kya::G3DFile::Open(const std::string& path)
+{
+	Close();
+
+	if (!Map(path)) {
+		return false;
+	}
+
+	Resolver resolver(pMapped, mappedSize);
+
+	if (!resolver.ResolveFile(*pManager)) {
+		error = path + ": " + resolver.GetError();
+		Close();
+		return false;
+	}
+
+	error.clear();
+	return true;
+}
+
+void Renderer::Kya::G3DFile::Close()
+{
+	Unmap();
+	*pManager = ed_g3d_manager();
+}
+
+bool Renderer::Kya::G3DFile::Map(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		error = path + ": Could not open the file";
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(ed_Chunck))) {
+		CloseHandle(file);
+		error = path + ": File too small to hold a chunk";
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		error = path + ": Could not map the file";
+		return false;
+	}
+
+	// Resolved offsets are stored back as 32 bit pointers, so the view has to land in the low 4GB.
+	void* pView = nullptr;
+	for (uintptr_t base = 0x10000000; base < 0x80000000 && !pView; base += 0x1000000) {
+		pView = MapViewOfFileEx(mapping, FILE_MAP_COPY, 0, 0, 0, reinterpret_cast<void*>(base));
+	}
+
+	if (!pView) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		error = path + ": Could not map the file";
+		return false;
+	}
+
+	hFile = file;
+	hMapping = mapping;
+	pMapped = static_cast<uint8_t*>(pView);
+	mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		error = path + ": Could not open the file";
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(ed_Chunck))) {
+		close(fd);
+		error = path + ": File too small to hold a chunk";
+		return false;
+	}
+
+	// Private and writable, resolving a field copies its page and leaves the file alone.
+	int flags = MAP_PRIVATE;
+#ifdef MAP_32BIT
+	// Resolved offsets are stored back as 32 bit pointers, so the view has to land in the low 4GB.
+	flags |= MAP_32BIT;
+#endif
+
+	void* pView = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ | PROT_WRITE, flags, fd, 0);
+	close(fd);
+
+	if (pView == MAP_FAILED) {
+		error = path + ": Could not map the file";
+		return false;
+	}
+
+	pMapped = static_cast<uint8_t*>(pView);
+	mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
+
+	if (reinterpret_cast<uintptr_t>(pMapped) + mappedSize > gAddressableLimit) {
+		Unmap();
+		error = path + ": Could not map the file below 4GB";
+		return false;
+	}
+
+	return true;
+}
+
+void Renderer::Kya::G3DFile::Unmap()
+{
+	if (pMapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(pMapped);
+		CloseHandle(hMapping);
+		CloseHandle(hFile);
+		hMapping = nullptr;
+		hFile = nullptr;
+#else
+		munmap(pMapped, mappedSize);
+#endif
+	}
+
+	pMapped = nullptr;
+	mappedSize = 0;
+}
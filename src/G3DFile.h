@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct ed_g3d_manager;
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// A .g3d file mapped straight from disk, for Standalone builds where no engine has loaded and installed it.
+		// On disk the pointer fields of the chunks and strips hold offsets from the start of the file. Open resolves the
+		// ones the mesh library reads in place, then the manager can go to MeshLibrary::AddMesh like an engine loaded one.
+		// The mapping is copy on write, so only the pages holding a resolved field get a private copy and the vertex,
+		// colour and ST streams stay shared with the page cache.
+		//
+		// Every chunk, offset and stream is checked against the file before anything is resolved, and a malformed file
+		// fails Open with a reason instead of tripping an assert in G3D. Texture layers past the first are sized by the
+		// material, not the file, so only the base ST stream is checked.
+		class G3DFile
+		{
+		public:
+			G3DFile();
+			~G3DFile();
+
+			G3DFile(const G3DFile&) = delete;
+			G3DFile& operator=(const G3DFile&) = delete;
+
+			bool Open(const std::string& path);
+
+			// Remove the mesh from the library first, its strips point into the mapping.
+			void Close();
+
+			inline bool IsOpen() const { return pMapped != nullptr; }
+
+			// Null until Open succeeds.
+			inline ed_g3d_manager* GetManager() const { return IsOpen() ? pManager.get() : nullptr; }
+			inline size_t GetSize() const { return mappedSize; }
+
+			// Why the last Open failed.
+			inline const std::string& GetError() const { return error; }
+
+		private:
+			class Resolver;
+
+			bool Map(const std::string& path);
+			void Unmap();
+
+			uint8_t* pMapped = nullptr;
+			size_t mappedSize = 0;
+			std::unique_ptr<ed_g3d_manager> pManager;
+			std::string error;
+
+#ifdef _WIN32
+			void* hFile = nullptr;
+			void* hMapping = nullptr;
+#endif
+		};
+	}
+}
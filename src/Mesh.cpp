@@ -6,6 +6,32 @@
 #include "renderer.h"
 #include "port.h"
 #include "port/vu1_emu.h"
+#include "FlatPointerMap.h"
+#include "MeshEpoch.h"
+#include "MeshHash.h"
+#include "MeshTrace.h"
+#include "StripCacheFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MESH_SIMD_AVX2
+#define MESH_SIMD_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define MESH_SIMD_SSE2
+#endif
 
 #ifdef LOG_SUPPORT
 #define MESH_LOG(level, format, ...) MY_LOG_CATEGORY("MeshLibrary", level, format, ##__VA_ARGS__)
@@ -24,583 +50,3138 @@ namespace Renderer
 
 		static MeshLibrary gMeshLibrary;
 
-		using StripCache = std::unordered_map<const ed_3d_strip*, Renderer::Kya::G3D::Strip*>;
-		static StripCache gStripCache;
+		// Strips for display lists. Released strips keep their mesh, the next dlist strip to take one decodes over that
+		// mesh rather than allocating its own.
+		class DlistStripPool
+		{
+		public:
+			G3D::Strip* Acquire()
+			{
+				if (freeStrips.empty()) {
+					strips.push_back(std::make_unique<G3D::Strip>());
+					return strips.back().get();
+				}
+
+				G3D::Strip* pStrip = freeStrips.back();
+				freeStrips.pop_back();
+				return pStrip;
+			}
+
+			void Release(G3D::Strip* pStrip)
+			{
+				freeStrips.push_back(pStrip);
+			}
+
+			std::vector<std::unique_ptr<G3D::Strip>> strips;
+			std::vector<G3D::Strip*> freeStrips;
 
-		static std::unordered_map<const ed_3d_strip*, Renderer::Kya::G3D::Object*> gObjectCache;
+			// Meshes of re-decoded strips, back from the epoch once no reader can be drawing them.
+			static constexpr size_t gMaxSpareMeshes = 64;
+			std::vector<G3D::SimpleMeshPtr> spareMeshes;
+		};
+
+		// Declared ahead of the epoch, whose destructor may still hand strips and meshes back to it.
+		static DlistStripPool gDlistStripPool;
+
+		static EpochDomain gEpoch;
+
+		using StripCache = FlatPointerMap<ed_3d_strip, Renderer::Kya::G3D::Strip>;
+		static StripCache gStripCache(&gEpoch);
 
-		static Gif_Tag ExtractGifTagFromVifList(ed_3d_strip* pStrip, int index = 0)
+		// Writer side only, so it frees outgrown tables straight away.
+		static StripCache gDlistStripCache;
+
+		// Keeps object alive until no reader can still be using it.
+		template<typename T>
+		static void RetireObject(T&& object)
 		{
-			// Pull the prim reg out from the gif packet, not a big fan of this.
-			char* const pVifList = reinterpret_cast<char*>(pStrip) + pStrip->vifListOffset;
-			edpkt_data* pPkt = reinterpret_cast<edpkt_data*>(pVifList);
+			auto pRetired = std::make_shared<std::decay_t<T>>(std::move(object));
+			gEpoch.Retire([pRetired]() mutable { pRetired.reset(); });
+		}
+
+		// The pool outlives SetParallelConstruction(false) since the ingest worker may still be using it.
+		static std::unique_ptr<ThreadPool> gDecodePool;
+		static std::atomic<bool> gbParallelConstruction = false;
+
+		static ThreadPool* GetDecodePool()
+		{
+			return gbParallelConstruction ? gDecodePool.get() : nullptr;
+		}
+
+		static std::atomic<bool> gbLazyDecoding = false;
+		static std::atomic<bool> gbOptimizeMeshes = false;
+		static std::atomic<bool> gbDeduplicateMeshes = false;
+		static MeshLibrary::TextureLayerCountFunc gTextureLayerCountFunc;
+		static std::atomic<bool> gbCompactStorage = false;
+
+#ifdef MESH_VALIDATE_DECODE
+		static std::atomic<bool> gbValidateDecode = true;
+#else
+		static std::atomic<bool> gbValidateDecode = false;
+#endif
+
+		// Decoded meshes by content hash. Weak so a mesh goes away with the last strip using it.
+		static std::mutex gSharedMeshMutex;
+		static std::unordered_map<uint64_t, std::weak_ptr<SimpleMesh>> gSharedMeshes;
+		static MeshLibrary::DedupStats gDedupStats;
+
+		// Relaxed counters behind MeshLibrary::GetCounters, cheap enough to leave on in release builds. Each thread counts
+		// into one of a few shards on their own cache lines, so render threads finding strips together don't fight over
+		// one line. GetCounters sums the shards.
+		struct alignas(64) LibraryCounters {
+			std::atomic<uint64_t> findStripHits = 0;
+			std::atomic<uint64_t> findStripMisses = 0;
+			std::atomic<uint64_t> stripDecodes = 0;
+			std::atomic<uint64_t> stripDecodeNs = 0;
+			std::atomic<uint64_t> lazyLayerBuilds = 0;
+			std::atomic<uint64_t> compactExpansions = 0;
+			std::atomic<uint64_t> dlistRecaches = 0;
+			std::atomic<uint64_t> dlistUnchanged = 0;
+			std::atomic<uint64_t> decodeMismatches = 0;
+			std::atomic<uint64_t> assemblyMismatches = 0;
+		};
+
+		using LibraryCounter = std::atomic<uint64_t> LibraryCounters::*;
+
+		// Threads past this many share shards, which is still correct, just slower.
+		static constexpr size_t gCounterShardCount = 16;
+		static LibraryCounters gCounterShards[gCounterShardCount];
+		static std::atomic<uint32_t> gNextCounterShard = 0;
+
+		static LibraryCounters& GetThreadCounters()
+		{
+			thread_local LibraryCounters& counters = gCounterShards[gNextCounterShard.fetch_add(1, std::memory_order_relaxed) % gCounterShardCount];
+			return counters;
+		}
+
+		static void CountEvent(LibraryCounter counter, uint64_t amount = 1)
+		{
+			(GetThreadCounters().*counter).fetch_add(amount, std::memory_order_relaxed);
+		}
+
+		static uint64_t SumCounter(LibraryCounter counter)
+		{
+			uint64_t total = 0;
+
+			for (const LibraryCounters& shard : gCounterShards) {
+				total += (shard.*counter).load(std::memory_order_relaxed);
+			}
+
+			return total;
+		}
+
+		// Adds its lifetime to a millisecond total or a nanosecond counter.
+		class ScopedTimer
+		{
+		public:
+			explicit ScopedTimer(double& totalMs)
+				: pTotalMs(&totalMs)
+				, start(std::chrono::steady_clock::now())
+			{
+			}
+
+			explicit ScopedTimer(LibraryCounter totalNs)
+				: totalNs(totalNs)
+				, start(std::chrono::steady_clock::now())
+			{
+			}
 
-			while (index > 0) {
-				if (pPkt->asU32[0] == gVifEndCode) {
-					index--;
+			~ScopedTimer()
+			{
+				const uint64_t elapsedNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+				if (pTotalMs) {
+					*pTotalMs += static_cast<double>(elapsedNs) / 1000000.0;
+				}
+				else {
+					CountEvent(totalNs, elapsedNs);
 				}
+			}
 
-				pPkt++;
+		private:
+			double* pTotalMs = nullptr;
+			LibraryCounter totalNs = nullptr;
+			std::chrono::steady_clock::time_point start;
+		};
+
+		static std::atomic<size_t> gDecodedBytes = 0;
+		static size_t gDecodedBudget = 0;
+		static std::atomic<uint32_t> gFrameIndex = 1;
+
+		// SelectLod clamps distances to this so a camera touching the bounds doesn't divide by zero.
+		constexpr float gMinLodDistance = 0.001f;
+
+		static size_t GetSimpleMeshBytes(SimpleMesh* pMesh);
+
+		// Drops a mesh's strips from the strip cache and the decoded byte count, ahead of the G3D being destroyed. Also
+		// used for meshes cancelled before they were published, which only the decoded byte count knows about.
+		static void ReleaseStrips(G3D& mesh)
+		{
+			for (G3D::Strip& strip : mesh.GetStrips()) {
+				if (gStripCache.Find(strip.pStrip) == &strip) {
+					gStripCache.Erase(strip.pStrip);
+				}
+
+				gDecodedBytes -= strip.residentBytes;
+				strip.residentBytes = 0;
+			}
+		}
+
+		// Builds queued meshes on a background thread and holds them until MeshLibrary::Update publishes them.
+		class MeshIngestQueue
+		{
+		public:
+			~MeshIngestQueue()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					bStopping = true;
+				}
+
+				condition.notify_all();
+
+				if (worker.joinable()) {
+					worker.join();
+				}
 			}
 
+			void Enqueue(ed_g3d_manager* pManager, std::string name)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					pending.push_back({ pManager, std::move(name) });
+					loadStates[pManager] = MeshLibrary::LoadState::Queued;
+
+					if (!worker.joinable()) {
+						worker = std::thread(&MeshIngestQueue::WorkerLoop, this);
+					}
+				}
+
+				condition.notify_one();
+			}
+
+			std::vector<G3D> TakeBuilt()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				return std::move(built);
+			}
+
+			void EnqueuePrefetch(const ed_g3d_manager* pManager, std::vector<const G3D::Strip*>&& strips)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					prefetches.push_back({ pManager, std::move(strips) });
+
+					if (!worker.joinable()) {
+						worker = std::thread(&MeshIngestQueue::WorkerLoop, this);
+					}
+				}
+
+				condition.notify_one();
+			}
+
+			// Drops queued prefetches for pManager, or all of them if null, and waits out any in flight.
+			void CancelPrefetches(const ed_g3d_manager* pManager)
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				for (auto it = prefetches.begin(); it != prefetches.end();) {
+					if (!pManager || it->pManager == pManager) {
+						it = prefetches.erase(it);
+					}
+					else {
+						++it;
+					}
+				}
+
+				prefetchDone.wait(lock, [this, pManager]() { return pPrefetching == nullptr || (pManager && pPrefetching != pManager); });
+			}
+
+			// Returns true if pManager was still queued or being built, it will never be handed out by TakeBuilt.
+			// A build in flight is waited out, so the caller may free the manager once this returns.
+			bool Cancel(const ed_g3d_manager* pManager)
+			{
+				CancelPrefetches(pManager);
+
+				std::unique_lock<std::mutex> lock(mutex);
+
+				bool bCancelled = false;
+
+				for (auto it = pending.begin(); it != pending.end();) {
+					if (it->pManager == pManager) {
+						it = pending.erase(it);
+						bCancelled = true;
+					}
+					else {
+						++it;
+					}
+				}
+
+				for (auto it = built.begin(); it != built.end();) {
+					if (it->GetManager() == pManager) {
+						ReleaseStrips(*it);
+						it = built.erase(it);
+						bCancelled = true;
+					}
+					else {
+						++it;
+					}
+				}
+
+				if (pBuilding == pManager) {
+					bCancelBuilding = true;
+					bCancelled = true;
+				}
+
+				buildDone.wait(lock, [this, pManager]() { return !pManager || pBuilding != pManager; });
+
+				loadStates.erase(pManager);
+				return bCancelled;
+			}
+
+			void SetLoadState(const ed_g3d_manager* pManager, MeshLibrary::LoadState state)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				loadStates[pManager] = state;
+			}
+
+			MeshLibrary::LoadState GetLoadState(const ed_g3d_manager* pManager)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto it = loadStates.find(pManager);
+				return it != loadStates.end() ? it->second : MeshLibrary::LoadState::Unknown;
+			}
+
+		private:
+			struct PendingMesh {
+				ed_g3d_manager* pManager;
+				std::string name;
+			};
+
+			struct PendingPrefetch {
+				const ed_g3d_manager* pManager;
+				std::vector<const G3D::Strip*> strips;
+			};
+
+			void WorkerLoop()
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				while (true) {
+					condition.wait(lock, [this]() { return bStopping || !pending.empty() || !prefetches.empty(); });
+
+					if (bStopping) {
+						return;
+					}
+
+					// Prefetches are for strips about to be drawn, so they go ahead of whole meshes.
+					if (!prefetches.empty()) {
+						PendingPrefetch prefetch = std::move(prefetches.front());
+						prefetches.pop_front();
+						pPrefetching = prefetch.pManager;
+
+						lock.unlock();
+						DecodePrefetch(prefetch.strips);
+						lock.lock();
+
+						pPrefetching = nullptr;
+						prefetchDone.notify_all();
+						continue;
+					}
+
+					PendingMesh next = std::move(pending.front());
+					pending.pop_front();
+					loadStates[next.pManager] = MeshLibrary::LoadState::Building;
+					pBuilding = next.pManager;
+					bCancelBuilding = false;
+
+					lock.unlock();
+					{
+						G3D mesh(next.pManager, next.name, GetDecodePool(), gbLazyDecoding);
+						lock.lock();
+
+						if (bCancelBuilding) {
+							ReleaseStrips(mesh);
+						}
+						else {
+							loadStates[next.pManager] = MeshLibrary::LoadState::Built;
+							built.emplace_back(std::move(mesh));
+						}
+					}
+
+					// Only cleared once a cancelled mesh is gone too, Cancel waits on it.
+					pBuilding = nullptr;
+					buildDone.notify_all();
+				}
+			}
+
+			static void DecodePrefetch(const std::vector<const G3D::Strip*>& strips)
+			{
+				auto decodeStrip = [&strips](int index) {
+					strips[index]->EnsureDecoded();
+				};
+
+				if (ThreadPool* pPool = GetDecodePool()) {
+					pPool->ParallelFor(static_cast<int>(strips.size()), decodeStrip);
+				}
+				else {
+					for (int i = 0; i < static_cast<int>(strips.size()); i++) {
+						decodeStrip(i);
+					}
+				}
+			}
+
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::condition_variable prefetchDone;
+			std::condition_variable buildDone;
+			std::deque<PendingMesh> pending;
+			std::deque<PendingPrefetch> prefetches;
+			const ed_g3d_manager* pPrefetching = nullptr;
+			std::vector<G3D> built;
+			std::unordered_map<const ed_g3d_manager*, MeshLibrary::LoadState> loadStates;
+			std::thread worker;
+			bool bStopping = false;
+
+			const ed_g3d_manager* pBuilding = nullptr;
+			bool bCancelBuilding = false;
+		};
+
+		static StripCacheFile gBakedStripCache;
+
+		static MeshIngestQueue gIngestQueue;
+		static bool gbAsyncIngestion = false;
+
+		// Render threads load it inside a read scope, a stopped trace is deleted through the epoch.
+		static std::atomic<MeshTraceWriter*> gTraceWriter = nullptr;
+
+		static uint8_t* GetSectionGifPacket(edpkt_data* pVifList, edpkt_data* pPkt)
+		{
+			// Pull the prim reg out from the gif packet, not a big fan of this.
 			if (pPkt[1].asU32[3] != gGifTagCopyCode) {
-				pPkt = reinterpret_cast<edpkt_data*>(pVifList);
+				pPkt = pVifList;
 			}
 
 			assert(pPkt[1].asU32[3] == gGifTagCopyCode);
 
-			uint8_t* const pGifPkt = LOAD_POINTER_CAST(uint8_t*, pPkt[1].asU32[1]);
+			return LOAD_POINTER_CAST(uint8_t*, pPkt[1].asU32[1]);
+		}
+
+		static Gif_Tag ExtractGifTag(uint8_t* pGifPkt)
+		{
 			Gif_Tag gifTag;
 			gifTag.setTag(pGifPkt, true);
 			return gifTag;
 		}
 
-		static void EmplaceHierarchy(std::vector<G3D::Hierarchy>& hierarchies, ed_g3d_hierarchy* pHierarchy, const int heirarchyIndex, G3D* pParent)
+		static GIFReg::GSPrim ExtractPrim(const Gif_Tag& gifTag)
 		{
-			assert(pHierarchy);
+			const uint64_t primReg = gifTag.tag.PRIM;
+			return *reinterpret_cast<const GIFReg::GSPrim*>(&primReg);
+		}
 
-			G3D::Hierarchy& hierarchy = hierarchies.emplace_back();
-			hierarchy.pHierarchy = pHierarchy;
-			hierarchy.pParent = pParent; // Probably should have the cluster as its parent.
+		static uint64_t GetPrimKey(const GIFReg::GSPrim& prim)
+		{
+			uint64_t primKey = 0;
+			memcpy(&primKey, &prim, std::min(sizeof(prim), sizeof(primKey)));
+			return primKey;
+		}
 
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessHierarchy Processing hierarchy: {}", pHierarchy->hash.ToString());
+		using MeshVertexBuffer = std::remove_reference_t<decltype(std::declval<SimpleMesh&>().GetVertexBufferData())>;
+		using MeshVertex = std::remove_pointer_t<decltype(std::declval<MeshVertexBuffer&>().vertex.buff)>;
+		using MeshIndex = std::remove_pointer_t<decltype(std::declval<MeshVertexBuffer&>().index.buff)>;
 
-			for (int i = 0; i < pHierarchy->lodCount; i++) {
-				MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessHierarchy Processing lod: {}", i);
+		// Fills a vertex buffer with already processed data, for the paths that don't go through AssembleSection.
+		static void FillVertexBuffer(MeshVertexBuffer& buffer, const void* pVertices, size_t vertexCount, const void* pIndices, size_t indexCount)
+		{
+			buffer.Init(static_cast<int>(vertexCount), static_cast<int>(indexCount));
 
-				ed3DLod* pLod = pHierarchy->aLods + i;
+			// Strips that drop every vertex come through with empty, possibly null, sources.
+			if (vertexCount > 0) {
+				memcpy(buffer.vertex.buff, pVertices, vertexCount * sizeof(MeshVertex));
+			}
 
-				hierarchy.ProcessLod(pLod, heirarchyIndex, i);
+			if (indexCount > 0) {
+				memcpy(buffer.index.buff, pIndices, indexCount * sizeof(MeshIndex));
 			}
+
+			buffer.vertex.tail = vertexCount;
+			buffer.index.tail = indexCount;
 		}
 
-		enum class DrawMode {
-			v12,
-			v32
+		// Reallocates a buffer down to its tails when reservedVertexCount left room above the vertex tail. A few spare
+		// vertices aren't worth the second allocation and the copies, only a quarter or more of the reservation is.
+		static void ShrinkVertexBuffer(MeshVertexBuffer& buffer, size_t reservedVertexCount)
+		{
+			const size_t vertexCount = buffer.GetVertexTail();
+			if (vertexCount >= reservedVertexCount || (reservedVertexCount - vertexCount) * 4 < reservedVertexCount) {
+				return;
+			}
+
+			thread_local std::vector<MeshVertex> vertices;
+			thread_local std::vector<MeshIndex> indices;
+			vertices.assign(buffer.vertex.buff, buffer.vertex.buff + vertexCount);
+			indices.assign(buffer.index.buff, buffer.index.buff + buffer.GetIndexTail());
+
+			FillVertexBuffer(buffer, vertices.data(), vertices.size(), indices.data(), indices.size());
+		}
+
+		// CompactMesh works on its own copy of the vertex layout so it doesn't depend on the renderer.
+		static_assert(sizeof(CompactMesh::ExpandedVertex) == sizeof(MeshVertex));
+		static_assert(offsetof(CompactMesh::ExpandedVertex, rgba) == offsetof(MeshVertex, RGBA));
+		static_assert(offsetof(CompactMesh::ExpandedVertex, xyz) == offsetof(MeshVertex, XYZFlags));
+		static_assert(offsetof(CompactMesh::ExpandedVertex, normal) == offsetof(MeshVertex, normal));
+
+		// Heap meshes carry the bytes counted for them while they are registered for sharing. A shared mesh is counted in
+		// the decoded bytes once for as long as it lives, rather than by whichever strip decoded it.
+		struct SharedMeshDeleter
+		{
+			uint64_t hash = 0;
+			size_t sharedBytes = 0;
+
+			void operator()(SimpleMesh* pMesh) const
+			{
+				gDecodedBytes -= sharedBytes;
+				delete pMesh;
+			}
 		};
 
-		static DrawMode GetDrawMode(ed_3d_strip* pStrip)
+		static G3D::SimpleMeshPtr MakeSimpleMesh(MeshArena* pArena, std::string name, const GIFReg::GSPrim& prim)
 		{
-			if ((pStrip->flags & 0x400) != 0) {
-				return DrawMode::v12;
+			if (pArena) {
+				return G3D::SimpleMeshPtr(pArena->New<SimpleMesh>(std::move(name), prim), ArenaDeleter<SimpleMesh>{ true }, ArenaAllocator<SimpleMesh>(*pArena));
 			}
 
-			return DrawMode::v32;
+			return G3D::SimpleMeshPtr(new SimpleMesh(std::move(name), prim), SharedMeshDeleter{});
 		}
-	}
-}
 
-constexpr const char* gDebugMeshName = "SECT1.g3d_17_0_0";
+		// bFirstAcquire is false when the strip layer has held a mesh before, getting it back after an eviction is no saving.
+		static G3D::SimpleMeshPtr FindSharedMesh(uint64_t hash, bool bFirstAcquire)
+		{
+			std::lock_guard<std::mutex> lock(gSharedMeshMutex);
 
-void Renderer::Kya::G3D::Strip::PreProcessVertices(int textureLayerIndex, SimpleMesh* pMesh) const
-{
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Object::Strip::PreProcessVertices Processing strip name: {}", pMesh->GetName());
+			auto it = gSharedMeshes.find(hash);
+			if (it == gSharedMeshes.end()) {
+				return nullptr;
+			}
 
-	if (pMesh->GetName() == gDebugMeshName) {
-		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Object::Strip::PreProcessVertices Processing strip name: {}", pMesh->GetName());
-	}
+			G3D::SimpleMeshPtr pShared = it->second.lock();
+			if (!pShared) {
+				gSharedMeshes.erase(it);
+				return nullptr;
+			}
+
+			if (bFirstAcquire) {
+				gDedupStats.sharedMeshes++;
+				gDedupStats.bytesSaved += GetSimpleMeshBytes(pShared.get());
+			}
 
-	const Gif_Tag firstGifTag = ExtractGifTagFromVifList(pStrip);
+			return pShared;
+		}
 
-	const DrawMode drawMode = GetDrawMode(pStrip);
+		// Returns whether pMesh is now the registered mesh for hash, meshBytes are then counted on it instead of the strip.
+		static bool RegisterSharedMesh(uint64_t hash, const G3D::SimpleMeshPtr& pMesh, size_t meshBytes)
+		{
+			// Only heap meshes have this deleter. An arena mesh is freed with its G3D whatever still points at it, so it
+			// can't outlive it in the registry.
+			SharedMeshDeleter* pDeleter = std::get_deleter<SharedMeshDeleter>(pMesh);
+			if (!pDeleter) {
+				return false;
+			}
 
-	auto& vertexBufferData = pMesh->GetVertexBufferData();
+			std::lock_guard<std::mutex> lock(gSharedMeshMutex);
 
-	// Assume that the first gif tag has the largest vtx count.
-	int totalVtxCount = 0;
+			// Two strips with the same content may have decoded at once, the first one registered wins.
+			std::weak_ptr<SimpleMesh>& entry = gSharedMeshes[hash];
+			if (!entry.expired()) {
+				return false;
+			}
 
-	for (int j = 0; j < pStrip->meshCount; j++) {
-		Gif_Tag gifTag = ExtractGifTagFromVifList(pStrip, j);
-		totalVtxCount += gifTag.nLoop;
-	}
+			entry = pMesh;
+			gDedupStats.uniqueMeshes++;
 
-	assert(totalVtxCount > 0);
+			pDeleter->hash = hash;
+			pDeleter->sharedBytes = meshBytes;
+			gDecodedBytes += meshBytes;
+			return true;
+		}
 
-	vertexBufferData.Init(totalVtxCount * 2, totalVtxCount * 4);
+		// Called with a strip's last reference to pMesh about to be retired. If no other strip holds it the registry lets
+		// go of it and its bytes come off now, rather than once the epoch frees it, so the decoded budget sees them go.
+		static void ReleaseSharedMesh(const G3D::SimpleMeshPtr& pMesh)
+		{
+			SharedMeshDeleter* pDeleter = pMesh ? std::get_deleter<SharedMeshDeleter>(pMesh) : nullptr;
+			if (!pDeleter) {
+				return;
+			}
 
-	union VertexColor {
-		uint32_t rgba;
+			// Other strips only get a reference through the registry, so under its lock the count can't go up.
+			std::lock_guard<std::mutex> lock(gSharedMeshMutex);
 
-		struct {
-			uint8_t r;
-			uint8_t g;
-			uint8_t b;
-			uint8_t a;
-		};
-	};
+			if (pDeleter->sharedBytes == 0 || pMesh.use_count() != 1) {
+				return;
+			}
 
-	static_assert(sizeof(VertexColor) == 4);
+			auto it = gSharedMeshes.find(pDeleter->hash);
+			if (it != gSharedMeshes.end() && !it->second.owner_before(pMesh) && !pMesh.owner_before(it->second)) {
+				gSharedMeshes.erase(it);
+			}
 
-	union TextureData {
-		uint32_t st;
+			gDecodedBytes -= pDeleter->sharedBytes;
+			pDeleter->sharedBytes = 0;
+		}
 
-		struct {
-			int16_t s;
-			int16_t t;
-		};
-	};
+		// Welds and reorders a decoded mesh in place, returns false for meshes it leaves alone.
+		static bool OptimizeSimpleMesh(SimpleMesh* pMesh, MeshOptimizer::Stats& stats)
+		{
+			// Triangles, strips and fans all come out of AssembleSection as indexed triangle lists.
+			const GIFReg::GSPrim prim = pMesh->GetPrim();
+			if (prim.PRIM < 3 || prim.PRIM > 5) {
+				return false;
+			}
 
-	static_assert(sizeof(TextureData) == 4);
+			auto& vertexBufferData = pMesh->GetVertexBufferData();
+			const size_t vertexCount = vertexBufferData.GetVertexTail();
+			const size_t indexCount = vertexBufferData.GetIndexTail();
 
-	VertexColor* pRgba = LOAD_POINTER_CAST(VertexColor*, pStrip->pColorBuf);
-	TextureData* pStq = LOAD_POINTER_CAST(TextureData*, pStrip->pSTBuf);
-	pStq += 4;
+			if (indexCount < 6 || (indexCount % 3) != 0) {
+				return false;
+			}
 
-	TextureData* pLayerStq = pStq;
-	if (textureLayerIndex > 0) {
-		int* pSTHeader = LOAD_POINTER_CAST(int*, pStrip->pSTBuf);
-		const int stLayerStride = pSTHeader[1] * 4;
-		pLayerStq = reinterpret_cast<TextureData*>(pSTHeader + textureLayerIndex * stLayerStride + 4);
-	}
+			thread_local std::vector<uint32_t> indices;
+			indices.assign(vertexBufferData.index.buff, vertexBufferData.index.buff + indexCount);
 
-	// This increases by 2 every loop because we start the next vtx at the end of the previous vtx.
-	int vtxOffset = 0;
+			stats.vertexCountBefore = static_cast<uint32_t>(vertexCount);
+			stats.triangleCount = static_cast<uint32_t>(indexCount / 3);
+			stats.acmrBefore = MeshOptimizer::ComputeAcmr(indices.data(), indexCount);
 
-	int meshOffset = 0;
+			const uint32_t weldedCount = MeshOptimizer::WeldVertices(vertexBufferData.vertex.buff, sizeof(MeshVertex), stats.vertexCountBefore, indices.data(), indexCount);
+			MeshOptimizer::OptimizeVertexCache(indices.data(), indexCount, weldedCount);
+			MeshOptimizer::OptimizeVertexFetch(vertexBufferData.vertex.buff, sizeof(MeshVertex), weldedCount, indices.data(), indexCount);
 
-	for (int j = 0; j < pStrip->meshCount; j++) {
-		MESH_LOG_TRACE(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Starting section: {}", j);
-		Gif_Tag gifTag = ExtractGifTagFromVifList(pStrip, j);
+			stats.vertexCountAfter = weldedCount;
+			stats.acmrAfter = MeshOptimizer::ComputeAcmr(indices.data(), indexCount);
+			stats.narrowestIndexSize = MeshOptimizer::GetNarrowestIndexSize(weldedCount);
+
+			for (size_t i = 0; i < indexCount; i++) {
+				vertexBufferData.index.buff[i] = static_cast<MeshIndex>(indices[i]);
+			}
 
-		for (int i = 0; i < gifTag.nLoop; i++) {
-			const int index = i + meshOffset;
-			const int adjustedIndex = index - vtxOffset;
+			vertexBufferData.vertex.tail = weldedCount;
+			ShrinkVertexBuffer(vertexBufferData, vertexCount);
+			return true;
+		}
 
-			Renderer::GSVertexUnprocessedNormal vtx;
-			vtx.RGBA[0] = pRgba[index].r;
-			vtx.RGBA[1] = pRgba[index].g;
-			vtx.RGBA[2] = pRgba[index].b;
-			vtx.RGBA[3] = pRgba[index].a;
+		static size_t GetSimpleMeshBytes(SimpleMesh* pMesh)
+		{
+			auto& vertexBufferData = pMesh->GetVertexBufferData();
+			return (vertexBufferData.GetVertexTail() * sizeof(MeshVertex)) + (vertexBufferData.GetIndexTail() * sizeof(MeshIndex));
+		}
 
-			const int stIndex = textureLayerIndex == 0 ? index : i + j * 0x14;
-			vtx.STQ.ST[0] = pLayerStq[stIndex].s;
-			vtx.STQ.ST[1] = pLayerStq[stIndex].t;
-			vtx.STQ.Q = 1.0f;
+		// What PreProcessVertices used to reserve for each float mesh before it sized the buffers exactly.
+		static size_t GetBlanketReservationBytes(const G3D::Strip& strip)
+		{
+			return (strip.totalVtxCount * 2 * sizeof(MeshVertex)) + (strip.totalVtxCount * 4 * sizeof(MeshIndex));
+		}
 
-			if (pStrip->pNormalBuf) {
-				edVertexNormal* pNormal = LOAD_POINTER_CAST(edVertexNormal*, pStrip->pNormalBuf);
+		static void AccumulateStripStats(const G3D::Strip& strip, MeshLibrary::MeshStats& stats)
+		{
+			stats.stripCount++;
 
-				vtx.normal.fNormal[0] = int15_to_float(pNormal[adjustedIndex].x);
-				vtx.normal.fNormal[1] = int15_to_float(pNormal[adjustedIndex].y);
-				vtx.normal.fNormal[2] = int15_to_float(pNormal[adjustedIndex].z);
-				vtx.normal.fNormal[3] = int15_to_float(pNormal[adjustedIndex].pad);
+			// A reader may be building a layer or expanding a compact mesh, the strip's pointers and byte counts are only
+			// safe to read while holding it. Strips that aren't decoded hold nothing.
+			while (!strip.TryClaim(G3D::Strip::DecodeState::Ready)) {
+				if (strip.decodeState.value.load(std::memory_order_acquire) == G3D::Strip::DecodeState::Pending) {
+					return;
+				}
 
-				MESH_LOG_TRACE(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Processing vertex: {}, normal: ({}, {}, {})", i, vtx.normal.fNormal[0], vtx.normal.fNormal[1], vtx.normal.fNormal[2]);
+				std::this_thread::yield();
 			}
-			else {
-				memset(&vtx.normal, 0, sizeof(vtx.normal));
+
+			stats.decodedStripCount++;
+			stats.residentBytes += strip.residentBytes;
+
+			if (strip.pSimpleMesh) {
+				auto& vertexBufferData = strip.pSimpleMesh->GetVertexBufferData();
+				stats.vertexCount += vertexBufferData.GetVertexTail();
+				stats.indexCount += vertexBufferData.GetIndexTail();
+				stats.baseMeshBytes += GetSimpleMeshBytes(strip.pSimpleMesh.get());
+			}
+
+			for (const G3D::SimpleMeshPtr& pLayerMesh : strip.layerSimpleMeshes) {
+				if (pLayerMesh) {
+					stats.layerMeshBytes += GetSimpleMeshBytes(pLayerMesh.get());
+				}
+			}
+
+			stats.reclaimedBytes += strip.reclaimedBytes;
+
+			for (const CompactMesh& compact : strip.compactMeshes) {
+				stats.compactBytes += compact.GetBytes();
+			}
+
+			strip.Unclaim(G3D::Strip::DecodeState::Ready);
+		}
+
+		static void AccumulateHierarchyStats(const G3D& mesh, MeshLibrary::MeshStats& stats)
+		{
+			for (const G3D::Hierarchy& hierarchy : mesh.GetHierarchies()) {
+				for (G3D::Index lodIndex = 0; lodIndex < hierarchy.lods.count; lodIndex++) {
+					const G3D::Range stripRange = mesh.GetLods()[hierarchy.lods.first + lodIndex].strips;
+
+					if (stats.stripsPerLod.size() <= lodIndex) {
+						stats.stripsPerLod.resize(lodIndex + 1);
+					}
+
+					stats.stripsPerLod[lodIndex] += stripRange.count;
+
+					for (G3D::Index stripIndex = stripRange.first; stripIndex < stripRange.GetEnd(); stripIndex++) {
+						AccumulateStripStats(mesh.GetStrips()[stripIndex], stats);
+					}
+				}
+			}
+		}
+
+		enum class DrawMode {
+			v12,
+			v32
+		};
+
+		static DrawMode GetDrawMode(ed_3d_strip* pStrip)
+		{
+			if ((pStrip->flags & 0x400) != 0) {
+				return DrawMode::v12;
 			}
 
-			// Covert xyz 16
-			if (drawMode == DrawMode::v12) {
-				struct Vertex12 {
-					int16_t x;
-					int16_t y;
-					int16_t z;
-					int16_t flags;
-				};
+			return DrawMode::v32;
+		}
+
+		union VertexColor {
+			uint32_t rgba;
+
+			struct {
+				uint8_t r;
+				uint8_t g;
+				uint8_t b;
+				uint8_t a;
+			};
+		};
+
+		static_assert(sizeof(VertexColor) == 4);
+
+		union TextureData {
+			uint32_t st;
+
+			struct {
+				int16_t s;
+				int16_t t;
+			};
+		};
+
+		static_assert(sizeof(TextureData) == 4);
+
+		struct Vertex12 {
+			int16_t x;
+			int16_t y;
+			int16_t z;
+			int16_t flags;
+		};
+
+		static_assert(sizeof(Vertex12) == 8);
+		static_assert(sizeof(edVertexNormal) == 8);
+
+		static const TextureData* GetLayerStq(ed_3d_strip* pStrip, int textureLayerIndex)
+		{
+			if (textureLayerIndex > 0) {
+				int* pSTHeader = LOAD_POINTER_CAST(int*, pStrip->pSTBuf);
+				const int stLayerStride = pSTHeader[1] * 4;
+				return reinterpret_cast<TextureData*>(pSTHeader + textureLayerIndex * stLayerStride + 4);
+			}
+
+			TextureData* pStq = LOAD_POINTER_CAST(TextureData*, pStrip->pSTBuf);
+			return pStq + 4;
+		}
+
+		// Sections overlap by two vertices in the position and normal streams.
+		static size_t GetSourceVertexCount(const G3D::Strip& strip)
+		{
+			return strip.totalVtxCount - ((strip.sections.size() - 1) * 2);
+		}
+
+		static size_t GetSourceVertexStride(const G3D::Strip& strip)
+		{
+			return GetDrawMode(strip.pStrip) == DrawMode::v12 ? sizeof(Vertex12) : sizeof(GSVertexUnprocessed::Vertex);
+		}
+
+		// Entries of the ST stream one layer reads.
+		static size_t GetLayerStCount(const G3D::Strip& strip, int textureLayerIndex)
+		{
+			return textureLayerIndex != 0 ? ((strip.sections.size() - 1) * 0x14) + strip.sections.back().vtxCount : strip.totalVtxCount;
+		}
+
+		// Folds the source streams one layer decodes from, and the section sizes, into hash.
+		static uint64_t HashSourceStreams(const G3D::Strip& strip, int textureLayerIndex, uint64_t hash)
+		{
+			ed_3d_strip* pStrip = strip.pStrip;
+			const size_t sourceVtxCount = GetSourceVertexCount(strip);
+
+			hash = HashBytes(LOAD_POINTER_CAST(void*, pStrip->pVertexBuf), sourceVtxCount * GetSourceVertexStride(strip), hash);
+
+			if (pStrip->pNormalBuf) {
+				hash = HashBytes(LOAD_POINTER_CAST(void*, pStrip->pNormalBuf), sourceVtxCount * sizeof(edVertexNormal), hash);
+			}
+
+			hash = HashBytes(LOAD_POINTER_CAST(void*, pStrip->pColorBuf), strip.totalVtxCount * sizeof(VertexColor), hash);
+			hash = HashBytes(GetLayerStq(pStrip, textureLayerIndex), GetLayerStCount(strip, textureLayerIndex) * sizeof(TextureData), hash);
+
+			for (const G3D::Strip::Section& section : strip.sections) {
+				hash = HashBytes(&section.vtxCount, sizeof(section.vtxCount), hash);
+			}
+
+			return hash;
+		}
+
+		// Source streams of a strip, resolved once before decoding its sections.
+		struct StripStreams {
+			const VertexColor* pRgba = nullptr;
+			const TextureData* pLayerStq = nullptr;
+			const edVertexNormal* pNormal = nullptr;
+			const void* pVertex = nullptr;
+		};
+
+		struct SectionRange {
+			int sectionIndex = 0;
+			int meshOffset = 0;
+			int vtxOffset = 0;
+			int vtxCount = 0;
+		};
+
+		// Layer ST streams restart every section with a fixed stride, the base stream runs through the strip.
+		static int GetStqIndex(const bool bIsLayer, const SectionRange& range, const int i)
+		{
+			return bIsLayer ? i + range.sectionIndex * 0x14 : i + range.meshOffset;
+		}
+
+		// int12_to_float and int15_to_float divide by a power of two, so scaling by the exact reciprocal gives identical results.
+		constexpr float gInt12Scale = 1.0f / 4096.0f;
+		constexpr float gInt15Scale = 1.0f / 32768.0f;
+
+		// Converts a run of int16 values (v12 positions, normals or ST pairs) into floats.
+		static void ConvertInt16ToFloat(const int16_t* pIn, const int count, const float scale, float* pOut)
+		{
+			int i = 0;
+
+#ifdef MESH_SIMD_AVX2
+			const __m256 scale8 = _mm256_set1_ps(scale);
+
+			for (; i + 8 <= count; i += 8) {
+				const __m256i values = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + i)));
+				_mm256_storeu_ps(pOut + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale8));
+			}
+#endif
+
+#ifdef MESH_SIMD_SSE2
+			const __m128 scale4 = _mm_set1_ps(scale);
+
+			for (; i + 4 <= count; i += 4) {
+				__m128i values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pIn + i));
+				values = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+				_mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(values), scale4));
+			}
+#endif
+
+			for (; i < count; i++) {
+				pOut[i] = static_cast<float>(pIn[i]) * scale;
+			}
+		}
+
+		// Widens a run of colours to one 32 bit value per channel, the layout of the vertex RGBA.
+		static void ConvertColorsToUint32(const VertexColor* pIn, const int count, uint32_t* pOut)
+		{
+			int i = 0;
+
+#ifdef MESH_SIMD_SSE2
+			const __m128i zero = _mm_setzero_si128();
+
+			for (; i + 4 <= count; i += 4) {
+				const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + i));
+				const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+				const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+
+				__m128i* pOut4 = reinterpret_cast<__m128i*>(pOut + (i * 4));
+				_mm_storeu_si128(pOut4 + 0, _mm_unpacklo_epi16(low, zero));
+				_mm_storeu_si128(pOut4 + 1, _mm_unpackhi_epi16(low, zero));
+				_mm_storeu_si128(pOut4 + 2, _mm_unpacklo_epi16(high, zero));
+				_mm_storeu_si128(pOut4 + 3, _mm_unpackhi_epi16(high, zero));
+			}
+#endif
+
+			for (; i < count; i++) {
+				pOut[(i * 4) + 0] = pIn[i].r;
+				pOut[(i * 4) + 1] = pIn[i].g;
+				pOut[(i * 4) + 2] = pIn[i].b;
+				pOut[(i * 4) + 3] = pIn[i].a;
+			}
+		}
+
+		static_assert(sizeof(MeshVertex::RGBA) == sizeof(uint32_t) * 4 && std::is_integral_v<std::remove_extent_t<decltype(MeshVertex::RGBA)>>);
+
+		// Decodes one GIF section into pOut. Specialised per strip format so the per vertex loop has no format branches,
+		// every stream is converted as a run first and the loop only interleaves them.
+		template<DrawMode drawMode, bool bHasNormals, bool bIsLayer>
+		static void DecodeSection(const StripStreams& streams, const SectionRange& range, Renderer::GSVertexUnprocessedNormal* pOut)
+		{
+			thread_local std::vector<float> positions;
+			thread_local std::vector<float> normals;
+			thread_local std::vector<uint32_t> colors;
+			thread_local std::vector<float> st;
+
+			const int firstAdjustedIndex = range.meshOffset - range.vtxOffset;
+
+			colors.resize(range.vtxCount * 4);
+			ConvertColorsToUint32(streams.pRgba + range.meshOffset, range.vtxCount, colors.data());
+
+			// Both ST layouts are a contiguous run within a section.
+			st.resize(range.vtxCount * 2);
+			ConvertInt16ToFloat(&streams.pLayerStq[GetStqIndex(bIsLayer, range, 0)].s, range.vtxCount * 2, 1.0f, st.data());
+
+			if constexpr (drawMode == DrawMode::v12) {
+				positions.resize(range.vtxCount * 4);
+				const Vertex12* pVertex = reinterpret_cast<const Vertex12*>(streams.pVertex) + firstAdjustedIndex;
+				ConvertInt16ToFloat(&pVertex->x, range.vtxCount * 4, gInt12Scale, positions.data());
+			}
+
+			if constexpr (bHasNormals) {
+				normals.resize(range.vtxCount * 4);
+				ConvertInt16ToFloat(&streams.pNormal[firstAdjustedIndex].x, range.vtxCount * 4, gInt15Scale, normals.data());
+			}
+
+			for (int i = 0; i < range.vtxCount; i++) {
+				Renderer::GSVertexUnprocessedNormal& vtx = pOut[i];
+
+				memcpy(vtx.RGBA, colors.data() + (i * 4), sizeof(vtx.RGBA));
+
+				vtx.STQ.ST[0] = st[(i * 2) + 0];
+				vtx.STQ.ST[1] = st[(i * 2) + 1];
+				vtx.STQ.Q = 1.0f;
+
+				if constexpr (bHasNormals) {
+					const float* pNormal = normals.data() + (i * 4);
+					vtx.normal.fNormal[0] = pNormal[0];
+					vtx.normal.fNormal[1] = pNormal[1];
+					vtx.normal.fNormal[2] = pNormal[2];
+					vtx.normal.fNormal[3] = pNormal[3];
+				}
+				else {
+					memset(&vtx.normal, 0, sizeof(vtx.normal));
+				}
+
+				if constexpr (drawMode == DrawMode::v12) {
+					const float* pPosition = positions.data() + (i * 4);
+					vtx.XYZFlags.fXYZ[0] = pPosition[0];
+					vtx.XYZFlags.fXYZ[1] = pPosition[1];
+					vtx.XYZFlags.fXYZ[2] = pPosition[2];
+					vtx.XYZFlags.flags = reinterpret_cast<const Vertex12*>(streams.pVertex)[firstAdjustedIndex + i].flags;
+				}
+				else {
+					vtx.XYZFlags = reinterpret_cast<const GSVertexUnprocessed::Vertex*>(streams.pVertex)[firstAdjustedIndex + i];
+				}
+			}
+		}
+
+		using DecodeSectionFunc = void(*)(const StripStreams&, const SectionRange&, Renderer::GSVertexUnprocessedNormal*);
+
+		static DecodeSectionFunc GetDecodeSectionFunc(const DrawMode drawMode, const bool bHasNormals, const bool bIsLayer)
+		{
+			static constexpr DecodeSectionFunc kernels[2][2][2] = {
+				{
+					{ DecodeSection<DrawMode::v12, false, false>, DecodeSection<DrawMode::v12, false, true> },
+					{ DecodeSection<DrawMode::v12, true, false>, DecodeSection<DrawMode::v12, true, true> },
+				},
+				{
+					{ DecodeSection<DrawMode::v32, false, false>, DecodeSection<DrawMode::v32, false, true> },
+					{ DecodeSection<DrawMode::v32, true, false>, DecodeSection<DrawMode::v32, true, true> },
+				},
+			};
+
+			return kernels[static_cast<int>(drawMode)][bHasNormals][bIsLayer];
+		}
+
+		// GS primitive types, the PRIM field of the GIF tag.
+		enum class PrimType : uint32_t {
+			Point,
+			Line,
+			LineStrip,
+			Triangle,
+			TriangleStrip,
+			TriangleFan,
+			Sprite,
+			Invalid
+		};
+
+		constexpr uint32_t gSkipFlag = 0x8000;
+
+		// Bit i set when vertex i only feeds the queue and closes no primitive (the ADC bit). Read from the source
+		// stream, so the buffers can be sized before anything is decoded.
+		static void AppendSkipMask(const StripStreams& streams, const DrawMode drawMode, const SectionRange& range, std::vector<uint64_t>& skipMask)
+		{
+			const size_t first = skipMask.size();
+			skipMask.resize(first + ((range.vtxCount + 63) / 64));
+
+			const int firstAdjustedIndex = range.meshOffset - range.vtxOffset;
+
+			for (int i = 0; i < range.vtxCount; i++) {
+				const uint32_t flags = drawMode == DrawMode::v12 ? static_cast<uint16_t>(reinterpret_cast<const Vertex12*>(streams.pVertex)[firstAdjustedIndex + i].flags)
+					: reinterpret_cast<const GSVertexUnprocessed::Vertex*>(streams.pVertex)[firstAdjustedIndex + i].flags;
+
+				skipMask[first + (i >> 6)] |= static_cast<uint64_t>((flags & gSkipFlag) != 0) << (i & 63);
+			}
+		}
+
+		// The GS vertex queue KickVertex kept in the buffer between calls.
+		struct VertexQueue {
+			size_t head = 0;
+			size_t tail = 0;
+			size_t next = 0;
+			size_t indexTail = 0;
+
+			// Highest the tail got, vertices are written there before a skip or a strip compaction can drop them.
+			size_t maxTail = 0;
+		};
+
+		// Runs a section through the queue: every vertex goes in at the tail, and once the queue holds a whole primitive
+		// an unskipped vertex emits its indices. Skipped list vertices are dropped, skipped strip vertices only advance
+		// the head. Strips that skipped past their last kept vertex move the live ones back down so dead vertices don't
+		// pile up. With bCountOnly nothing is written, which sizes the buffers for the real run.
+		template<PrimType prim, bool bCountOnly>
+		static void RunVertexQueue(const Renderer::GSVertexUnprocessedNormal* pVertices, const int vertexCount, const uint64_t* pSkipMask, VertexQueue& queue,
+			MeshVertex* pOut, MeshIndex* pIndexOut)
+		{
+			constexpr size_t primVertexCount = prim == PrimType::Point ? 1 : prim == PrimType::Line || prim == PrimType::LineStrip || prim == PrimType::Sprite ? 2 : 3;
+			constexpr bool bIsStrip = prim == PrimType::LineStrip || prim == PrimType::TriangleStrip;
+
+			size_t head = queue.head;
+			size_t tail = queue.tail;
+			size_t next = queue.next;
+			size_t indexTail = queue.indexTail;
+			size_t maxTail = queue.maxTail;
+
+			for (int i = 0; i < vertexCount; i++) {
+				if constexpr (!bCountOnly) {
+					pOut[tail] = pVertices[i];
+				}
+
+				tail++;
+				maxTail = std::max(maxTail, tail);
+
+				if constexpr (prim == PrimType::Invalid) {
+					tail = head;
+					continue;
+				}
+
+				if (tail - head < primVertexCount) {
+					continue;
+				}
+
+				if ((pSkipMask[i >> 6] >> (i & 63)) & 1) {
+					if constexpr (bIsStrip) {
+						head++;
+					}
+					else if constexpr (prim != PrimType::TriangleFan) {
+						tail = head;
+					}
+
+					continue;
+				}
+
+				if constexpr (bIsStrip) {
+					if (next < head) {
+						if constexpr (!bCountOnly) {
+							for (size_t j = 0; j < primVertexCount; j++) {
+								pOut[next + j] = pOut[head + j];
+							}
+						}
+
+						head = next;
+						tail = next + primVertexCount;
+					}
+				}
+
+				if constexpr (prim == PrimType::TriangleFan) {
+					if constexpr (!bCountOnly) {
+						pIndexOut[indexTail + 0] = static_cast<MeshIndex>(head);
+						pIndexOut[indexTail + 1] = static_cast<MeshIndex>(tail - 2);
+						pIndexOut[indexTail + 2] = static_cast<MeshIndex>(tail - 1);
+					}
+
+					next = tail;
+				}
+				else {
+					if constexpr (!bCountOnly) {
+						for (size_t j = 0; j < primVertexCount; j++) {
+							pIndexOut[indexTail + j] = static_cast<MeshIndex>(head + j);
+						}
+					}
+
+					// Strips keep all but the first vertex of the primitive for the next one.
+					next = head + primVertexCount;
+					head += bIsStrip ? 1 : primVertexCount;
+				}
+
+				indexTail += primVertexCount;
+			}
+
+			queue.head = head;
+			queue.tail = tail;
+			queue.next = next;
+			queue.indexTail = indexTail;
+			queue.maxTail = maxTail;
+		}
+
+		// Queues a decoded section into the buffer, what KickVertex did one call per vertex.
+		template<PrimType prim>
+		static void AssembleSection(const Renderer::GSVertexUnprocessedNormal* pVertices, const int vertexCount, const uint64_t* pSkipMask, MeshVertexBuffer& buffer)
+		{
+			VertexQueue queue;
+			queue.head = buffer.vertex.head;
+			queue.tail = buffer.vertex.tail;
+			queue.next = buffer.vertex.next;
+			queue.indexTail = buffer.index.tail;
+
+			RunVertexQueue<prim, false>(pVertices, vertexCount, pSkipMask, queue, buffer.vertex.buff, buffer.index.buff);
+
+			buffer.vertex.head = queue.head;
+			buffer.vertex.tail = queue.tail;
+			buffer.vertex.next = queue.next;
+			buffer.index.tail = queue.indexTail;
+		}
+
+		template<PrimType prim>
+		static void CountSection(const int vertexCount, const uint64_t* pSkipMask, VertexQueue& queue)
+		{
+			RunVertexQueue<prim, true>(nullptr, vertexCount, pSkipMask, queue, nullptr, nullptr);
+		}
+
+		using AssembleSectionFunc = void(*)(const Renderer::GSVertexUnprocessedNormal*, int, const uint64_t*, MeshVertexBuffer&);
+		using CountSectionFunc = void(*)(int, const uint64_t*, VertexQueue&);
+
+		struct SectionKernels {
+			AssembleSectionFunc assemble;
+			CountSectionFunc count;
+		};
+
+		static SectionKernels GetSectionKernels(const GIFReg::GSPrim& prim)
+		{
+			static constexpr SectionKernels kernels[] = {
+				{ AssembleSection<PrimType::Point>, CountSection<PrimType::Point> },
+				{ AssembleSection<PrimType::Line>, CountSection<PrimType::Line> },
+				{ AssembleSection<PrimType::LineStrip>, CountSection<PrimType::LineStrip> },
+				{ AssembleSection<PrimType::Triangle>, CountSection<PrimType::Triangle> },
+				{ AssembleSection<PrimType::TriangleStrip>, CountSection<PrimType::TriangleStrip> },
+				{ AssembleSection<PrimType::TriangleFan>, CountSection<PrimType::TriangleFan> },
+				{ AssembleSection<PrimType::Sprite>, CountSection<PrimType::Sprite> },
+				{ AssembleSection<PrimType::Invalid>, CountSection<PrimType::Invalid> },
+			};
+
+			return kernels[prim.PRIM & 7];
+		}
+
+		// Original per vertex scalar decode, kept as the reference the specialised kernels must match bit for bit. v32
+		// positions are read field by field from the raw stream rather than with the struct copy the kernel uses.
+		static void DecodeVertexReference(const StripStreams& streams, const DrawMode drawMode, const bool bIsLayer, const SectionRange& range, const int i, Renderer::GSVertexUnprocessedNormal& vtx)
+		{
+			const int index = i + range.meshOffset;
+			const int adjustedIndex = index - range.vtxOffset;
+
+			vtx.RGBA[0] = streams.pRgba[index].r;
+			vtx.RGBA[1] = streams.pRgba[index].g;
+			vtx.RGBA[2] = streams.pRgba[index].b;
+			vtx.RGBA[3] = streams.pRgba[index].a;
+
+			const int stIndex = GetStqIndex(bIsLayer, range, i);
+			vtx.STQ.ST[0] = streams.pLayerStq[stIndex].s;
+			vtx.STQ.ST[1] = streams.pLayerStq[stIndex].t;
+			vtx.STQ.Q = 1.0f;
+
+			if (streams.pNormal) {
+				vtx.normal.fNormal[0] = int15_to_float(streams.pNormal[adjustedIndex].x);
+				vtx.normal.fNormal[1] = int15_to_float(streams.pNormal[adjustedIndex].y);
+				vtx.normal.fNormal[2] = int15_to_float(streams.pNormal[adjustedIndex].z);
+				vtx.normal.fNormal[3] = int15_to_float(streams.pNormal[adjustedIndex].pad);
+			}
+			else {
+				memset(&vtx.normal, 0, sizeof(vtx.normal));
+			}
+
+			if (drawMode == DrawMode::v12) {
+				const Vertex12* pVertex = reinterpret_cast<const Vertex12*>(streams.pVertex);
+				vtx.XYZFlags.fXYZ[0] = int12_to_float(pVertex[adjustedIndex].x);
+				vtx.XYZFlags.fXYZ[1] = int12_to_float(pVertex[adjustedIndex].y);
+				vtx.XYZFlags.fXYZ[2] = int12_to_float(pVertex[adjustedIndex].z);
+				vtx.XYZFlags.flags = pVertex[adjustedIndex].flags;
+			}
+			else {
+				// x, y and z floats then the flags word, 16 bytes a vertex.
+				const uint8_t* pVertex = static_cast<const uint8_t*>(streams.pVertex) + (adjustedIndex * 16);
+				memcpy(&vtx.XYZFlags.fXYZ[0], pVertex + 0, sizeof(float));
+				memcpy(&vtx.XYZFlags.fXYZ[1], pVertex + 4, sizeof(float));
+				memcpy(&vtx.XYZFlags.fXYZ[2], pVertex + 8, sizeof(float));
+				memcpy(&vtx.XYZFlags.flags, pVertex + 12, sizeof(uint32_t));
+			}
+		}
+
+		// Returns how many vertices of the section differ from the reference, logging the first.
+		static int ValidateDecodedSection(const StripStreams& streams, const DrawMode drawMode, const bool bIsLayer, const SectionRange& range, const Renderer::GSVertexUnprocessedNormal* pDecoded)
+		{
+			int mismatchCount = 0;
+
+			for (int i = 0; i < range.vtxCount; i++) {
+				Renderer::GSVertexUnprocessedNormal expected;
+				DecodeVertexReference(streams, drawMode, bIsLayer, range, i, expected);
+
+				const Renderer::GSVertexUnprocessedNormal& actual = pDecoded[i];
+				const bool bMatches = memcmp(&expected.RGBA, &actual.RGBA, sizeof(expected.RGBA)) == 0
+					&& memcmp(&expected.STQ, &actual.STQ, sizeof(expected.STQ)) == 0
+					&& memcmp(&expected.normal, &actual.normal, sizeof(expected.normal)) == 0
+					&& memcmp(&expected.XYZFlags, &actual.XYZFlags, sizeof(expected.XYZFlags)) == 0;
+
+				if (!bMatches) {
+					if (mismatchCount == 0) {
+						MESH_LOG(LogLevel::Error, "Renderer::Kya::ValidateDecodedSection section {} vertex {} differs from the reference decode (mode: {} layer: {})",
+							range.sectionIndex, i, static_cast<int>(drawMode), bIsLayer);
+					}
+
+					mismatchCount++;
+				}
+			}
+
+			return mismatchCount;
+		}
+
+		// Whether the assembled buffer holds exactly what Renderer::KickVertex built from the same vertices.
+		static bool MatchesReferenceAssembly(const MeshVertexBuffer& assembled, const MeshVertexBuffer& reference)
+		{
+			return assembled.vertex.head == reference.vertex.head && assembled.vertex.next == reference.vertex.next
+				&& assembled.GetVertexTail() == reference.GetVertexTail() && assembled.GetIndexTail() == reference.GetIndexTail()
+				&& memcmp(assembled.vertex.buff, reference.vertex.buff, assembled.GetVertexTail() * sizeof(MeshVertex)) == 0
+				&& memcmp(assembled.index.buff, reference.index.buff, assembled.GetIndexTail() * sizeof(MeshIndex)) == 0;
+		}
+	}
+}
+
+constexpr const char* gDebugMeshName = "SECT1.g3d_17_0_0";
+
+void Renderer::Kya::G3D::Strip::IndexSections()
+{
+	assert(pStrip);
+	assert(pStrip->meshCount > 0);
+
+	sections.clear();
+	sections.reserve(pStrip->meshCount);
+	totalVtxCount = 0;
+
+	edpkt_data* const pVifList = reinterpret_cast<edpkt_data*>(reinterpret_cast<char*>(pStrip) + pStrip->vifListOffset);
+	edpkt_data* pPkt = pVifList;
+
+	for (int j = 0; j < pStrip->meshCount; j++) {
+		// Each section after the first starts on the packet following the previous end code.
+		if (j > 0) {
+			while (pPkt->asU32[0] != gVifEndCode) {
+				pPkt++;
+			}
+
+			pPkt++;
+		}
+
+		Section& section = sections.emplace_back();
+		section.pGifPkt = GetSectionGifPacket(pVifList, pPkt);
+		section.vtxCount = ExtractGifTag(section.pGifPkt).nLoop;
+
+		totalVtxCount += section.vtxCount;
+	}
+}
+
+void Renderer::Kya::G3D::Strip::ComputeBounds()
+{
+	bounds = BoundingBox();
+
+	// Sections overlap by two vertices in the position stream, the overlap adds nothing to the box.
+	const size_t sourceVtxCount = totalVtxCount - ((sections.size() - 1) * 2);
+	const void* pVertex = LOAD_POINTER_CAST(void*, pStrip->pVertexBuf);
+
+	if (GetDrawMode(pStrip) == DrawMode::v12) {
+		const Vertex12* pVertex12 = reinterpret_cast<const Vertex12*>(pVertex);
+
+		for (size_t i = 0; i < sourceVtxCount; i++) {
+			const float point[3] = { pVertex12[i].x * gInt12Scale, pVertex12[i].y * gInt12Scale, pVertex12[i].z * gInt12Scale };
+			bounds.Extend(point);
+		}
+	}
+	else {
+		const GSVertexUnprocessed::Vertex* pVertex32 = reinterpret_cast<const GSVertexUnprocessed::Vertex*>(pVertex);
+
+		for (size_t i = 0; i < sourceVtxCount; i++) {
+			bounds.Extend(pVertex32[i].fXYZ);
+		}
+	}
+}
+
+uint64_t Renderer::Kya::G3D::Strip::ComputeContentHash(int textureLayerIndex) const
+{
+	// Bump when the decoded output changes for the same source data.
+	constexpr uint64_t decodeVersion = 3;
+
+	const DrawMode drawMode = GetDrawMode(pStrip);
+	const bool bIsLayer = textureLayerIndex != 0;
+
+	const uint64_t primReg = ExtractGifTag(sections.front().pGifPkt).tag.PRIM;
+	const uint64_t header[] = { decodeVersion, primReg, static_cast<uint64_t>(drawMode), bIsLayer, sections.size(), static_cast<uint64_t>(totalVtxCount), gbOptimizeMeshes };
+
+	return HashSourceStreams(*this, textureLayerIndex, HashBytes(header, sizeof(header), 0));
+}
+
+uint64_t Renderer::Kya::G3D::Strip::GetContentHash(int textureLayerIndex) const
+{
+	if (textureLayerIndex != 0) {
+		return ComputeContentHash(textureLayerIndex);
+	}
+
+	// A hash of 0 is taken as not worked out yet, the worst that does is hash again.
+	if (contentHash == 0) {
+		contentHash = ComputeContentHash(0);
+	}
+
+	return contentHash;
+}
+
+uint64_t Renderer::Kya::G3D::Strip::ComputeSourceHash() const
+{
+	const uint64_t primReg = ExtractGifTag(sections.front().pGifPkt).tag.PRIM;
+	const uint64_t header[] = { primReg, static_cast<uint64_t>(GetDrawMode(pStrip)), sections.size(), static_cast<uint64_t>(totalVtxCount) };
+
+	return HashSourceStreams(*this, 0, HashBytes(header, sizeof(header), 0));
+}
+
+Renderer::Kya::G3D::Strip::SourceStreams Renderer::Kya::G3D::Strip::GetSourceStreams(int textureLayerCount) const
+{
+	SourceStreams streams;
+
+	const size_t sourceVtxCount = GetSourceVertexCount(*this);
+
+	streams.pVertices = LOAD_POINTER_CAST(void*, pStrip->pVertexBuf);
+	streams.vertexBytes = sourceVtxCount * GetSourceVertexStride(*this);
+
+	if (pStrip->pNormalBuf) {
+		streams.pNormals = LOAD_POINTER_CAST(void*, pStrip->pNormalBuf);
+		streams.normalBytes = sourceVtxCount * sizeof(edVertexNormal);
+	}
+
+	streams.pColors = LOAD_POINTER_CAST(void*, pStrip->pColorBuf);
+	streams.colorBytes = totalVtxCount * sizeof(VertexColor);
+
+	// Layers sit one after the other, the stream ends with the base stream or the last layer, whichever is further.
+	const TextureData* pStEnd = GetLayerStq(pStrip, 0) + GetLayerStCount(*this, 0);
+
+	if (textureLayerCount > 1) {
+		const TextureData* pLastLayerEnd = GetLayerStq(pStrip, textureLayerCount - 1) + GetLayerStCount(*this, textureLayerCount - 1);
+		pStEnd = std::max(pStEnd, pLastLayerEnd);
+	}
+
+	streams.pST = LOAD_POINTER_CAST(void*, pStrip->pSTBuf);
+	streams.stBytes = reinterpret_cast<const uint8_t*>(pStEnd) - static_cast<const uint8_t*>(streams.pST);
+
+	return streams;
+}
+
+void Renderer::Kya::G3D::Strip::OptimizeDecodedMesh(int textureLayerIndex, SimpleMesh* pMesh) const
+{
+	if (!gbOptimizeMeshes) {
+		return;
+	}
+
+	MeshOptimizer::Stats stats;
+	if (OptimizeSimpleMesh(pMesh, stats)) {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::OptimizeDecodedMesh {} vertices: {} -> {} ACMR: {} -> {} narrowest index: {} bytes",
+			pMesh->GetName(), stats.vertexCountBefore, stats.vertexCountAfter, stats.acmrBefore, stats.acmrAfter, stats.narrowestIndexSize);
+
+		if (textureLayerIndex == 0) {
+			optimizeStats = stats;
+		}
+	}
+}
+
+void Renderer::Kya::G3D::Strip::BuildSimpleMeshes(const LayerTarget* pTargets, int targetCount) const
+{
+	assert(targetCount > 0);
+
+	if (bDisplayList) {
+		PreProcessVertices(pTargets, targetCount);
+		return;
+	}
+
+	std::array<bool, gMaxTextureLayers> bakedHits = {};
+	assert(targetCount <= gMaxTextureLayers);
+
+	if (!gBakedStripCache.IsOpen()) {
+		PreProcessVertices(pTargets, targetCount);
+
+		for (int i = 0; i < targetCount; i++) {
+			OptimizeDecodedMesh(pTargets[i].textureLayerIndex, pTargets[i].pMesh);
+		}
+	}
+	else {
+		thread_local std::vector<LayerTarget> misses;
+		misses.clear();
+		bakedHits.fill(false);
+
+		for (int i = 0; i < targetCount; i++) {
+			// The hash is only there already when deduplication wanted it.
+			LayerTarget target = pTargets[i];
+			if (!target.bDeduplicate) {
+				target.contentHash = GetContentHash(target.textureLayerIndex);
+			}
+
+			StripCacheFile::Entry entry;
+			if (gBakedStripCache.Find(target.contentHash, entry)) {
+				MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::BuildSimpleMeshes Baked cache hit: {} (0x{:x})", target.pMesh->GetName(), target.contentHash);
+				FillVertexBuffer(target.pMesh->GetVertexBufferData(), entry.pVertices, entry.vertexCount, entry.pIndices, entry.indexCount);
+				bakedHits[i] = true;
+			}
+			else {
+				misses.push_back(target);
+			}
+		}
+
+		if (!misses.empty()) {
+			PreProcessVertices(misses.data(), static_cast<int>(misses.size()));
+
+			for (const LayerTarget& target : misses) {
+				OptimizeDecodedMesh(target.textureLayerIndex, target.pMesh);
+
+				auto& vertexBufferData = target.pMesh->GetVertexBufferData();
+				gBakedStripCache.Add(target.contentHash, vertexBufferData.vertex.buff, static_cast<uint32_t>(vertexBufferData.GetVertexTail()),
+					vertexBufferData.index.buff, static_cast<uint32_t>(vertexBufferData.GetIndexTail()));
+			}
+		}
+	}
+
+	for (int i = 0; i < targetCount; i++) {
+		const LayerTarget& target = pTargets[i];
+
+		if (gbCompactStorage && CompactSimpleMesh(target)) {
+			continue;
+		}
+
+		const size_t meshBytes = GetSimpleMeshBytes(target.pMesh);
+
+		// A registered mesh is counted on itself, see SharedMeshDeleter.
+		if (!target.bDeduplicate || !RegisterSharedMesh(target.contentHash, GetLayerMeshSlot(target.textureLayerIndex), meshBytes)) {
+			residentBytes += meshBytes;
+			gDecodedBytes += meshBytes;
+		}
+
+		// Baked meshes were always filled at their exact size, there was no reservation to reclaim.
+		if (!bakedHits[i]) {
+			reclaimedBytes += GetBlanketReservationBytes(*this) - meshBytes;
+		}
+	}
+}
+
+void Renderer::Kya::G3D::Strip::PreProcessVertices(const LayerTarget* pTargets, int targetCount) const
+{
+	assert(targetCount > 0);
+
+	SimpleMesh* pMesh = pTargets[0].pMesh;
+
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Processing strip name: {} layers: {}", pMesh->GetName(), targetCount);
+
+	if (pMesh->GetName() == gDebugMeshName) {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Processing strip name: {}", pMesh->GetName());
+	}
+
+	assert(sections.size() == static_cast<size_t>(pStrip->meshCount));
+
+	// Every section of a strip draws with the PRIM of the first.
+	const GIFReg::GSPrim prim = ExtractPrim(ExtractGifTag(sections.front().pGifPkt));
+	const SectionKernels kernels = GetSectionKernels(prim);
+
+	const DrawMode drawMode = GetDrawMode(pStrip);
+
+	assert(totalVtxCount > 0);
+
+	StripStreams streams;
+	streams.pRgba = LOAD_POINTER_CAST(VertexColor*, pStrip->pColorBuf);
+	streams.pNormal = pStrip->pNormalBuf ? LOAD_POINTER_CAST(edVertexNormal*, pStrip->pNormalBuf) : nullptr;
+	streams.pVertex = LOAD_POINTER_CAST(void*, pStrip->pVertexBuf);
+
+	// Skip flags come from the geometry, which every target shares. Reading them up front lets the queue be run once
+	// without writing anything, which gives the exact buffer sizes instead of guessing at twice and four times the
+	// vertex count.
+	thread_local std::vector<uint64_t> skipMask;
+	thread_local std::vector<size_t> skipMaskOffsets;
+	skipMask.clear();
+	skipMaskOffsets.resize(pStrip->meshCount);
+
+	VertexQueue counted;
+	SectionRange range;
+
+	for (int j = 0; j < pStrip->meshCount; j++) {
+		range.vtxCount = sections[j].vtxCount;
+
+		skipMaskOffsets[j] = skipMask.size();
+		AppendSkipMask(streams, drawMode, range, skipMask);
+		kernels.count(range.vtxCount, skipMask.data() + skipMaskOffsets[j], counted);
+
+		range.meshOffset += range.vtxCount;
+		range.vtxOffset += 2;
+	}
+
+	for (int k = 0; k < targetCount; k++) {
+		pTargets[k].pMesh->GetVertexBufferData().Init(static_cast<int>(counted.maxTail), static_cast<int>(counted.indexTail));
+	}
+
+	// Geometry is decoded with the first target's layer, the others only swap in their own ST stream.
+	streams.pLayerStq = GetLayerStq(pStrip, pTargets[0].textureLayerIndex);
+
+	const bool bIsLayer = pTargets[0].textureLayerIndex != 0;
+	const DecodeSectionFunc decodeSection = GetDecodeSectionFunc(drawMode, streams.pNormal != nullptr, bIsLayer);
+
+	thread_local std::vector<Renderer::GSVertexUnprocessedNormal> decoded;
+
+	// When validating, the first target is also built the old way, one Renderer::KickVertex per vertex, to check the
+	// section kernels against.
+	G3D::SimpleMeshPtr pReference;
+	if (gbValidateDecode) {
+		pReference = MakeSimpleMesh(nullptr, pMesh->GetName() + "_reference", prim);
+		pReference->GetVertexBufferData().Init(totalVtxCount * 2, totalVtxCount * 4);
+	}
+
+	range = SectionRange();
+
+	for (int j = 0; j < pStrip->meshCount; j++) {
+		MESH_LOG_TRACE(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Starting section: {}", j);
+		const Section& section = sections[j];
+
+		range.sectionIndex = j;
+		range.vtxCount = section.vtxCount;
+
+		decoded.resize(section.vtxCount);
+		decodeSection(streams, range, decoded.data());
+
+		if (gbValidateDecode) {
+			CountEvent(&LibraryCounters::decodeMismatches, ValidateDecodedSection(streams, drawMode, bIsLayer, range, decoded.data()));
+		}
+
+		if (pReference) {
+			for (int i = 0; i < section.vtxCount; i++) {
+				Renderer::GSVertexUnprocessedNormal vtx = decoded[i];
+				Renderer::KickVertex(vtx, prim, vtx.XYZFlags.flags & gSkipFlag, pReference->GetVertexBufferData());
+			}
+		}
+
+		for (int k = 0; k < targetCount; k++) {
+			const LayerTarget& target = pTargets[k];
+			auto& vertexBufferData = target.pMesh->GetVertexBufferData();
+
+			// Targets after the first overwrite the decoded ST in place, the earlier ones have already been assembled.
+			if (k > 0) {
+				const bool bTargetIsLayer = target.textureLayerIndex != 0;
+				const TextureData* pTargetStq = GetLayerStq(pStrip, target.textureLayerIndex);
+
+				for (int i = 0; i < section.vtxCount; i++) {
+					const int stIndex = GetStqIndex(bTargetIsLayer, range, i);
+					decoded[i].STQ.ST[0] = pTargetStq[stIndex].s;
+					decoded[i].STQ.ST[1] = pTargetStq[stIndex].t;
+				}
+			}
+
+			kernels.assemble(decoded.data(), section.vtxCount, skipMask.data() + skipMaskOffsets[j], vertexBufferData);
+
+			MESH_LOG_TRACE(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Assembled section: {} layer: {} vtx tail: 0x{:x} index tail: 0x{:x}",
+				j, target.textureLayerIndex, vertexBufferData.GetVertexTail(), vertexBufferData.GetIndexTail());
+		}
+
+		// The next section starts on the last two vertices of this one.
+		range.meshOffset += section.vtxCount;
+		range.vtxOffset += 2;
+	}
+
+	if (pReference && !MatchesReferenceAssembly(pMesh->GetVertexBufferData(), pReference->GetVertexBufferData())) {
+		MESH_LOG(LogLevel::Error, "Renderer::Kya::G3D::Strip::PreProcessVertices strip {} assembled differently from KickVertex (prim: {})", pMesh->GetName(), static_cast<int>(prim.PRIM));
+		CountEvent(&LibraryCounters::assemblyMismatches);
+	}
+
+	// Skipped list vertices and compacted strips leave dead vertices above the final tail. The count pass ran the same
+	// queue, so when its final tail is the peak, as for most strips, the buffers are already exact.
+	for (int k = 0; k < targetCount; k++) {
+		auto& vertexBufferData = pTargets[k].pMesh->GetVertexBufferData();
+		assert(vertexBufferData.GetVertexTail() == counted.tail && vertexBufferData.GetIndexTail() == counted.indexTail);
+
+		if (counted.tail < counted.maxTail) {
+			ShrinkVertexBuffer(vertexBufferData, counted.maxTail);
+		}
+	}
+
+	//assert(internalVertexBuffer.GetIndexTail() > 0);
+}
+
+Renderer::SimpleMesh* Renderer::Kya::G3D::Strip::GetSimpleMesh(int textureLayerIndex) const
+{
+	textureLayerIndex = std::max(textureLayerIndex, 0);
+
+	if (textureLayerIndex >= gMaxTextureLayers) {
+		MESH_LOG(LogLevel::Error, "Renderer::Kya::G3D::Strip::GetSimpleMesh layer {} is past the {} a strip can hold", textureLayerIndex, gMaxTextureLayers);
+		assert(false);
+		return nullptr;
+	}
+
+	const std::atomic<SimpleMesh*>& published = publishedMeshes[textureLayerIndex].value;
+
+	while (true) {
+		EnsureDecoded();
+
+		if (SimpleMesh* pMesh = published.load(std::memory_order_acquire)) {
+			return pMesh;
+		}
+
+		// Either the layer was never built or it was evicted since EnsureDecoded returned. Both are fixed by holding
+		// the strip, so go round again if another thread got it first.
+		if (TryClaim(DecodeState::Ready)) {
+			break;
+		}
+
+		std::this_thread::yield();
+	}
+
+	if (!GetLayerMeshSlot(textureLayerIndex)) {
+		const size_t layerIndex = static_cast<size_t>(textureLayerIndex);
+
+		if (layerIndex < compactMeshes.size() && !compactMeshes[layerIndex].IsEmpty()) {
+			CountEvent(&LibraryCounters::compactExpansions);
+			ExpandCompactMesh(textureLayerIndex);
+		}
+		else if (textureLayerIndex > 0) {
+			// Layers are normally built with the base mesh, this only catches layers past the reported layer count.
+			LayerTarget target;
+			if (AcquireLayerMesh(textureLayerIndex, gbDeduplicateMeshes, target)) {
+				CountEvent(&LibraryCounters::lazyLayerBuilds);
+				BuildSimpleMeshes(&target, 1);
+			}
+		}
+	}
+
+	PublishLayerMeshes();
+	Unclaim(DecodeState::Ready);
+
+	return published.load(std::memory_order_relaxed);
+}
+
+const Renderer::Kya::CompactMesh* Renderer::Kya::G3D::Strip::GetCompactMesh(int textureLayerIndex) const
+{
+	// A lazy layer build may be compacting into the vector, so it is only read while holding the strip.
+	while (true) {
+		EnsureDecoded();
+
+		if (TryClaim(DecodeState::Ready)) {
+			break;
+		}
+
+		std::this_thread::yield();
+	}
+
+	const CompactMesh* pCompact = nullptr;
+
+	const size_t layerIndex = static_cast<size_t>(textureLayerIndex);
+	if (layerIndex < compactMeshes.size() && !compactMeshes[layerIndex].IsEmpty()) {
+		pCompact = &compactMeshes[layerIndex];
+	}
+
+	Unclaim(DecodeState::Ready);
+	return pCompact;
+}
+
+bool Renderer::Kya::G3D::Strip::CompactSimpleMesh(const LayerTarget& target) const
+{
+	auto& vertexBufferData = target.pMesh->GetVertexBufferData();
+
+	CompactMesh compact;
+	if (!compact.Build(reinterpret_cast<const CompactMesh::ExpandedVertex*>(vertexBufferData.vertex.buff), vertexBufferData.GetVertexTail(),
+		vertexBufferData.index.buff, sizeof(MeshIndex), vertexBufferData.GetIndexTail())) {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::CompactSimpleMesh {} doesn't fit the compact layout, keeping floats", target.pMesh->GetName());
+		return false;
+	}
+
+	// Reserved in full so a layer compacted later never moves the ones GetCompactMesh has handed out.
+	const size_t layerIndex = static_cast<size_t>(target.textureLayerIndex);
+	if (compactMeshes.size() <= layerIndex) {
+		compactMeshes.reserve(gMaxTextureLayers);
+		compactMeshes.resize(layerIndex + 1);
+	}
+
+	const size_t compactBytes = compact.GetBytes();
+	compactMeshes[layerIndex] = std::move(compact);
+
+	SimpleMeshPtr& pSlot = GetLayerMeshSlot(target.textureLayerIndex);
+	if (target.textureLayerIndex == 0) {
+		deferredName = pSlot->GetName();
+	}
+
+	pSlot.reset();
+
+	residentBytes += compactBytes;
+	gDecodedBytes += compactBytes;
+	return true;
+}
+
+void Renderer::Kya::G3D::Strip::ExpandCompactMesh(int textureLayerIndex) const
+{
+	const CompactMesh& compact = compactMeshes[textureLayerIndex];
+
+	SimpleMeshPtr& pSlot = GetLayerMeshSlot(textureLayerIndex);
+	assert(!pSlot);
+
+	if (textureLayerIndex == 0) {
+		CreateSimpleMesh(nullptr);
+	}
+	else {
+		pSlot = MakeSimpleMesh(nullptr, GetLayerMeshName(textureLayerIndex), ExtractPrim(ExtractGifTag(sections.front().pGifPkt)));
+	}
+
+	auto& vertexBufferData = pSlot->GetVertexBufferData();
+	vertexBufferData.Init(static_cast<int>(compact.GetVertexCount()), static_cast<int>(compact.GetIndexCount()));
+
+	compact.ExpandVertices(reinterpret_cast<CompactMesh::ExpandedVertex*>(vertexBufferData.vertex.buff));
+	compact.ExpandIndices(vertexBufferData.index.buff, sizeof(MeshIndex));
+
+	vertexBufferData.vertex.tail = compact.GetVertexCount();
+	vertexBufferData.index.tail = compact.GetIndexCount();
+
+	const size_t meshBytes = GetSimpleMeshBytes(pSlot.get());
+	expandedBytes += meshBytes;
+	residentBytes += meshBytes;
+	gDecodedBytes += meshBytes;
+}
+
+std::string Renderer::Kya::G3D::Strip::GetLayerMeshName(int textureLayerIndex) const
+{
+	std::string meshName = pSimpleMesh ? pSimpleMesh->GetName() : deferredName;
+
+	if (textureLayerIndex > 0) {
+		meshName += "_layer_";
+		meshName += std::to_string(textureLayerIndex);
+	}
+
+	return meshName;
+}
+
+Renderer::Kya::G3D::SimpleMeshPtr& Renderer::Kya::G3D::Strip::GetLayerMeshSlot(int textureLayerIndex) const
+{
+	assert(textureLayerIndex < gMaxTextureLayers);
+
+	if (textureLayerIndex == 0) {
+		return pSimpleMesh;
+	}
+
+	const size_t layerIndex = static_cast<size_t>(textureLayerIndex);
+	if (layerSimpleMeshes.size() <= layerIndex) {
+		layerSimpleMeshes.resize(layerIndex + 1);
+	}
+
+	return layerSimpleMeshes[layerIndex];
+}
+
+bool Renderer::Kya::G3D::Strip::AcquireLayerMesh(int textureLayerIndex, bool bDeduplicate, LayerTarget& target) const
+{
+	target.textureLayerIndex = textureLayerIndex;
+	target.bDeduplicate = bDeduplicate && !bDisplayList;
+
+	// Hashing reads every source stream, so it is left to the users of the hash: deduplication here and the baked cache
+	// in BuildSimpleMeshes. Neither sees display list strips.
+	if (target.bDeduplicate) {
+		target.contentHash = GetContentHash(textureLayerIndex);
+	}
+
+	SimpleMeshPtr& pSlot = GetLayerMeshSlot(textureLayerIndex);
+
+	if (target.bDeduplicate) {
+		const uint32_t layerBit = 1u << textureLayerIndex;
+		const bool bFirstAcquire = (acquiredLayers & layerBit) == 0;
+		acquiredLayers |= layerBit;
+
+		if (SimpleMeshPtr pShared = FindSharedMesh(target.contentHash, bFirstAcquire)) {
+			// The mesh carries its own bytes, this strip only holds a reference.
+			if (textureLayerIndex == 0) {
+				deferredName.clear();
+			}
+
+			pSlot = std::move(pShared);
+			return false;
+		}
+	}
+
+	if (!pSlot) {
+		if (textureLayerIndex == 0) {
+			CreateSimpleMesh(nullptr);
+		}
+		else {
+			pSlot = MakeSimpleMesh(nullptr, GetLayerMeshName(textureLayerIndex), ExtractPrim(ExtractGifTag(sections.front().pGifPkt)));
+		}
+	}
+
+	target.pMesh = pSlot.get();
+	return true;
+}
+
+Renderer::SimpleMesh* Renderer::Kya::G3D::Strip::CreateSimpleMesh(MeshArena* pArena) const
+{
+	assert(!pSimpleMesh);
+
+	pSimpleMesh = MakeSimpleMesh(pArena, std::move(deferredName), ExtractPrim(ExtractGifTag(sections.front().pGifPkt)));
+	deferredName.clear();
+	return pSimpleMesh.get();
+}
+
+void Renderer::Kya::G3D::Strip::EnsureDecoded() const
+{
+	EnsureDecoded(gbDeduplicateMeshes);
+}
+
+void Renderer::Kya::G3D::Strip::EnsureDecoded(bool bDeduplicate) const
+{
+	uint8_t expected = DecodeState::Pending;
+
+	if (decodeState.value.compare_exchange_strong(expected, DecodeState::Decoding, std::memory_order_acquire)) {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::EnsureDecoded Decoding strip: {}", pSimpleMesh ? pSimpleMesh->GetName() : deferredName);
+
+		CountEvent(&LibraryCounters::stripDecodes);
+		ScopedTimer timer(&LibraryCounters::stripDecodeNs);
+
+		const int layerCount = gTextureLayerCountFunc ? std::clamp(gTextureLayerCountFunc(pStrip), 1, gMaxTextureLayers) : 1;
+
+		thread_local std::vector<LayerTarget> targets;
+		targets.clear();
+
+		// Every layer the material uses is built in the same pass as the base mesh, so RenderNode never decodes.
+		for (int layer = 0; layer < layerCount; layer++) {
+			LayerTarget target;
+			if (AcquireLayerMesh(layer, bDeduplicate, target)) {
+				targets.push_back(target);
+			}
+		}
+
+		if (!targets.empty()) {
+			BuildSimpleMeshes(targets.data(), static_cast<int>(targets.size()));
+		}
+
+		PublishLayerMeshes();
+		Unclaim(DecodeState::Ready);
+		return;
+	}
+
+	// Another thread, likely a prefetch, got here first.
+	while (decodeState.value.load(std::memory_order_acquire) == DecodeState::Decoding) {
+		std::this_thread::yield();
+	}
+}
+
+bool Renderer::Kya::G3D::Strip::TryClaim(uint8_t state) const
+{
+	return decodeState.value.compare_exchange_strong(state, DecodeState::Decoding, std::memory_order_acquire);
+}
+
+uint8_t Renderer::Kya::G3D::Strip::Claim() const
+{
+	while (true) {
+		uint8_t state = decodeState.value.load(std::memory_order_relaxed);
+
+		if (state != DecodeState::Decoding && decodeState.value.compare_exchange_weak(state, DecodeState::Decoding, std::memory_order_acquire)) {
+			return state;
+		}
+
+		std::this_thread::yield();
+	}
+}
+
+void Renderer::Kya::G3D::Strip::Unclaim(uint8_t state) const
+{
+	decodeState.value.store(state, std::memory_order_release);
+}
+
+void Renderer::Kya::G3D::Strip::PublishLayerMeshes() const
+{
+	publishedMeshes[0].value.store(pSimpleMesh.get(), std::memory_order_release);
+
+	for (size_t layerIndex = 1; layerIndex < publishedMeshes.size(); layerIndex++) {
+		SimpleMesh* pLayerMesh = layerIndex < layerSimpleMeshes.size() ? layerSimpleMeshes[layerIndex].get() : nullptr;
+		publishedMeshes[layerIndex].value.store(pLayerMesh, std::memory_order_release);
+	}
+}
+
+void Renderer::Kya::G3D::Strip::EvictSimpleMeshes() const
+{
+	if (!TryClaim(DecodeState::Ready)) {
+		return;
+	}
+
+	// Readers that already looked a mesh up keep drawing it, the retired meshes are freed once they are done.
+	std::vector<SimpleMeshPtr> retiredMeshes;
+
+	if (expandedBytes > 0) {
+		// The compact copies stay, expanding them again is far cheaper than decoding.
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::EvictSimpleMeshes Evicting expanded strip: {} ({} bytes)", GetLayerMeshName(0), expandedBytes);
+
+		for (size_t layerIndex = 0; layerIndex < compactMeshes.size(); layerIndex++) {
+			SimpleMeshPtr& pSlot = GetLayerMeshSlot(static_cast<int>(layerIndex));
+			if (compactMeshes[layerIndex].IsEmpty() || !pSlot) {
+				continue;
+			}
+
+			if (layerIndex == 0) {
+				deferredName = pSlot->GetName();
+			}
+
+			publishedMeshes[layerIndex].value.store(nullptr, std::memory_order_release);
+			retiredMeshes.push_back(std::move(pSlot));
+		}
+
+		RetireObject(std::move(retiredMeshes));
+
+		gDecodedBytes -= expandedBytes;
+		residentBytes -= expandedBytes;
+		expandedBytes = 0;
+
+		Unclaim(DecodeState::Ready);
+		return;
+	}
+
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::EvictSimpleMeshes Evicting strip: {} ({} bytes)", GetLayerMeshName(0), residentBytes);
+
+	deferredName = GetLayerMeshName(0);
+
+	for (auto& published : publishedMeshes) {
+		published.value.store(nullptr, std::memory_order_release);
+	}
+
+	retiredMeshes.push_back(std::move(pSimpleMesh));
+	retiredMeshes.insert(retiredMeshes.end(), std::make_move_iterator(layerSimpleMeshes.begin()), std::make_move_iterator(layerSimpleMeshes.end()));
+	layerSimpleMeshes.clear();
+
+	// Shared meshes are paid for by themselves, they go once the last strip holding them is evicted.
+	for (const SimpleMeshPtr& pRetired : retiredMeshes) {
+		ReleaseSharedMesh(pRetired);
+	}
+
+	RetireObject(std::move(retiredMeshes));
+	RetireObject(std::move(compactMeshes));
+	compactMeshes.clear();
+
+	gDecodedBytes -= residentBytes;
+	residentBytes = 0;
+	reclaimedBytes = 0;
+
+	Unclaim(DecodeState::Pending);
+}
+
+static void BuildStripBounds(const std::vector<Renderer::Kya::G3D::Strip>& strips, Renderer::Kya::G3D::Range range, Renderer::Kya::BoundingVolumeHierarchy& stripBounds)
+{
+	std::vector<Renderer::Kya::BoundingBox> itemBounds;
+	itemBounds.reserve(range.count);
+
+	for (Renderer::Kya::G3D::Index i = range.first; i < range.GetEnd(); i++) {
+		itemBounds.push_back(strips[i].bounds);
+	}
+
+	stripBounds.Build(itemBounds);
+}
+
+template<typename Volume>
+static void QueryStripBounds(const Renderer::Kya::BoundingVolumeHierarchy& stripBounds, const std::vector<Renderer::Kya::G3D::Strip>& strips, Renderer::Kya::G3D::Range range, const Volume& volume, std::vector<const Renderer::Kya::G3D::Strip*>& outStrips)
+{
+	thread_local std::vector<uint32_t> stripIndices;
+	stripIndices.clear();
+
+	if constexpr (std::is_same_v<Volume, Renderer::Kya::Frustum>) {
+		stripBounds.QueryFrustum(volume, stripIndices);
+	}
+	else {
+		stripBounds.QuerySphere(volume, stripIndices);
+	}
+
+	for (uint32_t stripIndex : stripIndices) {
+		outStrips.push_back(&strips[range.first + stripIndex]);
+	}
+}
+
+template<typename Volume>
+static void QueryLodStrips(const Renderer::Kya::G3D& mesh, const Volume& volume, Renderer::Kya::G3D::Index hierarchyIndex, int lodIndex, std::vector<const Renderer::Kya::G3D::Strip*>& outStrips)
+{
+	const Renderer::Kya::G3D::Range lodRange = mesh.GetHierarchies()[hierarchyIndex].lods;
+
+	if (lodIndex >= 0 && static_cast<Renderer::Kya::G3D::Index>(lodIndex) < lodRange.count) {
+		const Renderer::Kya::G3D::Lod& lod = mesh.GetLods()[lodRange.first + lodIndex];
+		QueryStripBounds(lod.stripBounds, mesh.GetStrips(), lod.strips, volume, outStrips);
+	}
+}
+
+void Renderer::Kya::G3D::Strip::Process(ed_3d_strip* pSourceStrip, std::string meshName)
+{
+	assert(pSourceStrip);
+	assert(pSourceStrip->meshCount > 0);
+
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::Process Processing strip flags: 0x{:x}", pSourceStrip->flags);
+
+	pStrip = pSourceStrip;
+	IndexSections();
+	ComputeBounds();
+
+	[[maybe_unused]] const Gif_Tag gifTag = ExtractGifTag(sections.front().pGifPkt);
+
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Strip::Process Processing strip gifTag: NLOOP 0x{:x} NREG 0x{:x} PRIM 0x{:x}", (uint)gifTag.tag.NLOOP, (uint)gifTag.tag.NREG, (uint)gifTag.tag.PRIM);
+
+	// The mesh itself is created when the strip is decoded.
+	deferredName = std::move(meshName);
+}
+
+void Renderer::Kya::G3D::QueryHierarchyStrips(const Frustum& frustum, Index hierarchyIndex, int lodIndex, std::vector<const Strip*>& outStrips) const
+{
+	QueryLodStrips(*this, frustum, hierarchyIndex, lodIndex, outStrips);
+}
+
+void Renderer::Kya::G3D::QueryHierarchyStrips(const BoundingSphere& sphere, Index hierarchyIndex, int lodIndex, std::vector<const Strip*>& outStrips) const
+{
+	QueryLodStrips(*this, sphere, hierarchyIndex, lodIndex, outStrips);
+}
+
+void Renderer::Kya::G3D::QueryClusterStrips(const Frustum& frustum, std::vector<const Strip*>& outStrips) const
+{
+	QueryStripBounds(cluster.stripBounds, strips, cluster.strips, frustum, outStrips);
+}
+
+void Renderer::Kya::G3D::QueryClusterStrips(const BoundingSphere& sphere, std::vector<const Strip*>& outStrips) const
+{
+	QueryStripBounds(cluster.stripBounds, strips, cluster.strips, sphere, outStrips);
+}
+
+int Renderer::Kya::G3D::SelectLod(Index hierarchyIndex, const LodViewParams& view, int previousLod) const
+{
+	const Hierarchy& hierarchy = hierarchies[hierarchyIndex];
+
+	if (hierarchy.lods.count == 0) {
+		return -1;
+	}
+
+	// Distance to the closest point of the bounds, 0 from inside them.
+	float distanceSquared = 0.0f;
+
+	if (!hierarchy.bounds.IsEmpty()) {
+		for (int axis = 0; axis < 3; axis++) {
+			const float outside = std::max(std::max(hierarchy.bounds.min[axis] - view.cameraPosition[axis], view.cameraPosition[axis] - hierarchy.bounds.max[axis]), 0.0f);
+			distanceSquared += outside * outside;
+		}
+	}
+
+	const float distance = std::max(std::sqrt(distanceSquared), gMinLodDistance);
+
+	// The finest LOD has no error, so it is always acceptable and the fallback.
+	int selected = 0;
+
+	for (int lodIndex = 1; lodIndex < static_cast<int>(hierarchy.lods.count); lodIndex++) {
+		const LodMetrics& metrics = lods[hierarchy.lods.first + lodIndex].metrics;
+
+		const float threshold = view.maxScreenError * (lodIndex == previousLod ? 1.0f + view.hysteresis : 1.0f - view.hysteresis);
+		const float screenError = metrics.geometricError * view.projectionScale / distance;
+
+		if (screenError <= threshold && metrics.triangleCount < lods[hierarchy.lods.first + selected].metrics.triangleCount) {
+			selected = lodIndex;
+		}
+	}
+
+	lods[hierarchy.lods.first + selected].lastSelectedFrame.value.store(gFrameIndex.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	return selected;
+}
+
+std::string Renderer::Kya::G3D::GetShortName() const
+{
+	// strip everything before the last forward slash
+	return name.substr(name.find_last_of('\\') + 1);
+}
+
+void Renderer::Kya::G3D::ProcessObject(ed_g3d_object* pObject, Index lodRecord, const int heirarchyIndex, const int lodIndex)
+{
+	lods[lodRecord].pObject = pObject;
+
+	if (pObject->p3DData) {
+		ed_3d_strip* pStrip = LOAD_POINTER_CAST(ed_3d_strip*, pObject->p3DData);
+		int stripIndex = 0;
+
+		while (stripIndex < pObject->stripCount) {
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessObject Processing strip: {}", stripIndex);
+
+			std::string meshName = GetShortName();
+			meshName += "_";
+			meshName += std::to_string(heirarchyIndex);
+			meshName += "_";
+			meshName += std::to_string(lodIndex);
+			meshName += "_";
+			meshName += std::to_string(stripIndex);
+
+			Strip& strip = strips.emplace_back();
+			strip.lodIndex = lodRecord;
+			strip.Process(pStrip, std::move(meshName));
+
+			pStrip = LOAD_POINTER_CAST(ed_3d_strip*, pStrip->pNext);
+			stripIndex++;
+		}
+	}
+
+	Lod& lod = lods[lodRecord];
+	lod.strips.count = static_cast<Index>(strips.size()) - lod.strips.first;
+	BuildStripBounds(strips, lod.strips, lod.stripBounds);
+
+	for (Index stripIndex = lod.strips.first; stripIndex < lod.strips.GetEnd(); stripIndex++) {
+		const Strip& strip = strips[stripIndex];
+		lod.bounds.Extend(strip.bounds);
+		lod.metrics.vertexCount += strip.totalVtxCount;
+
+		for (const Strip::Section& section : strip.sections) {
+			lod.metrics.triangleCount += section.vtxCount > 2 ? section.vtxCount - 2 : 0;
+		}
+	}
+}
+
+void Renderer::Kya::G3D::ComputeLodMetrics(Index hierarchyRecord)
+{
+	Hierarchy& hierarchy = hierarchies[hierarchyRecord];
+
+	if (hierarchy.lods.count == 0) {
+		return;
+	}
+
+	auto getEdgeLength = [](const Lod& lod) {
+		if (lod.bounds.IsEmpty()) {
+			return 0.0f;
+		}
+
+		float diagonalSquared = 0.0f;
+		for (int axis = 0; axis < 3; axis++) {
+			const float extent = lod.bounds.max[axis] - lod.bounds.min[axis];
+			diagonalSquared += extent * extent;
+		}
+
+		return std::sqrt(diagonalSquared) / std::sqrt(static_cast<float>(std::max<uint32_t>(lod.metrics.triangleCount, 1)));
+	};
+
+	const float finestEdgeLength = getEdgeLength(lods[hierarchy.lods.first]);
+
+	for (Index lodIndex = hierarchy.lods.first; lodIndex < hierarchy.lods.GetEnd(); lodIndex++) {
+		Lod& lod = lods[lodIndex];
+		hierarchy.bounds.Extend(lod.bounds);
+		lod.metrics.geometricError = std::max(getEdgeLength(lod) - finestEdgeLength, 0.0f);
+	}
+}
+
+void Renderer::Kya::G3D::ProcessLod(ed3DLod* pLod, Index hierarchyRecord, const int heirarchyIndex, const int lodIndex)
+{
+	assert(pLod);
+
+	if (pLod->pObj) {
+		const Index lodRecord = static_cast<Index>(lods.size());
+
+		Lod& lod = lods.emplace_back();
+		lod.pLod = pLod;
+		lod.hierarchyIndex = hierarchyRecord;
+		lod.strips.first = static_cast<Index>(strips.size());
+
+		hierarchies[hierarchyRecord].lods.count++;
+
+		ed_hash_code* pHash = LOAD_POINTER_CAST(ed_hash_code*, pLod->pObj);
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessLod Processing lod: {}", pHash->hash.ToString());
+
+		ed_Chunck* pOBJ = LOAD_POINTER_CAST(ed_Chunck*, pHash->pData);
+
+		if (pOBJ) {
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessLod Object chunk header: {}", pOBJ->GetHeaderString());
+
+			ed_g3d_object* pObject = reinterpret_cast<ed_g3d_object*>(pOBJ + 1);
+			ProcessObject(pObject, lodRecord, heirarchyIndex, lodIndex);
+		}
+	}
+	else {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessLod No lod data");
+	}
+}
+
+Renderer::Kya::G3D::G3D(ed_g3d_manager* pManager, std::string name, ThreadPool* pDecodePool, bool bLazyDecode)
+	: pManager(pManager)
+	, name(name)
+{
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::G3D Beginning processing of mesh: {}", name.c_str());
+
+	if (pManager->HALL) {
+		ScopedTimer timer(loadTimings.hallMs);
+		ProcessHALL();
+	}
+
+	if (pManager->CSTA) {
+		ScopedTimer timer(loadTimings.cstaMs);
+		ProcessCSTA();
+	}
+
+	if (!bLazyDecode) {
+		ScopedTimer timer(loadTimings.stripDecodeMs);
+		DecodeStrips(pDecodePool);
+	}
+}
+
+void Renderer::Kya::G3D::CacheStrips()
+{
+	for (auto& strip : strips) {
+		gStripCache.Set(strip.pStrip, &strip);
+	}
+}
+
+void Renderer::Kya::G3D::DecodeStrips(ThreadPool* pDecodePool)
+{
+	// The tree is complete at this point, so the strip addresses are stable and each decode only touches its own mesh.
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::DecodeStrips Decoding {} strips", strips.size());
+
+	// Read once, so every strip of the build agrees with how its meshes were created.
+	const bool bDeduplicate = gbDeduplicateMeshes;
+
+	// The arena isn't thread safe, so the meshes are all created up front. Deduplicated meshes may be
+	// shared with other G3Ds, so they are left to EnsureDecoded to create from the heap on a miss.
+	if (!bDeduplicate) {
+		for (Strip& strip : strips) {
+			strip.CreateSimpleMesh(&arena);
+		}
+	}
+
+	auto decodeStrip = [this, bDeduplicate](int index) {
+		strips[index].EnsureDecoded(bDeduplicate);
+	};
+
+	if (pDecodePool) {
+		pDecodePool->ParallelFor(static_cast<int>(strips.size()), decodeStrip);
+	}
+	else {
+		for (int i = 0; i < static_cast<int>(strips.size()); i++) {
+			decodeStrip(i);
+		}
+	}
+}
+
+void Renderer::Kya::G3D::ProcessHierarchy(ed_g3d_hierarchy* pHierarchy, const int heirarchyIndex)
+{
+	assert(pHierarchy);
+
+	const Index hierarchyRecord = static_cast<Index>(hierarchies.size());
+
+	Hierarchy& hierarchy = hierarchies.emplace_back();
+	hierarchy.pHierarchy = pHierarchy;
+	hierarchy.lods.first = static_cast<Index>(lods.size());
+
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessHierarchy Processing hierarchy: {}", pHierarchy->hash.ToString());
+
+	for (int i = 0; i < pHierarchy->lodCount; i++) {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessHierarchy Processing lod: {}", i);
+
+		ed3DLod* pLod = pHierarchy->aLods + i;
+
+		ProcessLod(pLod, hierarchyRecord, heirarchyIndex, i);
+	}
+
+	ComputeLodMetrics(hierarchyRecord);
+}
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Walks a hierarchy the way ProcessHierarchy will, adding up the lod and strip records it is going to emplace.
+		static void CountHierarchyRecords(ed_g3d_hierarchy* pHierarchy, size_t& lodCount, size_t& stripCount)
+		{
+			for (int i = 0; i < pHierarchy->lodCount; i++) {
+				ed3DLod* pLod = pHierarchy->aLods + i;
+
+				if (!pLod->pObj) {
+					continue;
+				}
+
+				lodCount++;
+
+				ed_hash_code* pHash = LOAD_POINTER_CAST(ed_hash_code*, pLod->pObj);
+				ed_Chunck* pOBJ = LOAD_POINTER_CAST(ed_Chunck*, pHash->pData);
+
+				if (pOBJ) {
+					ed_g3d_object* pObject = reinterpret_cast<ed_g3d_object*>(pOBJ + 1);
+					stripCount += pObject->p3DData ? pObject->stripCount : 0;
+				}
+			}
+		}
+	}
+}
+
+void Renderer::Kya::G3D::ProcessHALL()
+{
+	assert(pManager->HALL);
+
+	ed_Chunck* pHASH = pManager->HALL + 1;
+	ed_hash_code* pHashCode = reinterpret_cast<ed_hash_code*>(pHASH + 1);
+	const int chunkNb = edChunckGetNb(pHASH, reinterpret_cast<char*>(pManager->HALL) + pManager->HALL->size);
+
+	hierarchies.reserve(chunkNb);
+
+	// Sized up front, growing the flat tables one hierarchy at a time would copy every record emplaced so far.
+	size_t lodCount = 0;
+	size_t stripCount = 0;
+
+	for (int curIndex = 0; curIndex < chunkNb - 1; curIndex = curIndex + 1) {
+		if (ed_g3d_hierarchy* pHierarchy = ed3DG3DHierarchyGetFromIndex(pManager, curIndex)) {
+			CountHierarchyRecords(pHierarchy, lodCount, stripCount);
+		}
+	}
+
+	lods.reserve(lods.size() + lodCount);
+	strips.reserve(strips.size() + stripCount);
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::G3D Nb Chunks: {}", chunkNb);
+
+	for (int curIndex = 0; curIndex < chunkNb - 1; curIndex = curIndex + 1) {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::G3D Processing hierarchy {}/{} hash: {}", curIndex, chunkNb, pHashCode->hash.ToString());
+
+		ed_g3d_hierarchy* pHierarchy = ed3DG3DHierarchyGetFromIndex(pManager, curIndex);
+
+		if (pHierarchy) {
+			ProcessHierarchy(pHierarchy, curIndex);
+		}
+
+		pHashCode++;
+	}
+
+	hallHierarchies.count = static_cast<Index>(hierarchies.size());
+}
+
+void Renderer::Kya::G3D::ProcessCluster(ed_g3d_cluster* pCluster)
+{
+	assert(pCluster);
+
+	cluster.pData = pCluster;
+	cluster.strips.first = static_cast<Index>(strips.size());
+
+	const uint stripCountArrayEntryIndex = 4;
+
+	const uint stripCount = pCluster->aClusterStripCounts[stripCountArrayEntryIndex];
+
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCluster Processing CDQU chunk stripCount: {}", stripCount);
+
+	uint clusterHierCount = pCluster->clusterDetails.clusterHierCount;
+
+	// The cluster's own strips and those of its hierarchies, reserved together.
+	size_t lodCount = 0;
+	size_t totalStripCount = stripCount;
+
+	if (clusterHierCount != 0) {
+		ed_hash_code* pHashCode = reinterpret_cast<ed_hash_code*>(reinterpret_cast<ed_Chunck*>(pCluster + 1) + 1);
+
+		for (uint i = 0; i < clusterHierCount; i++, pHashCode++) {
+			ed_Chunck* pHIER = LOAD_POINTER_CAST(ed_Chunck*, pHashCode->pData);
+			CountHierarchyRecords(reinterpret_cast<ed_g3d_hierarchy*>(pHIER + 1), lodCount, totalStripCount);
+		}
+	}
+
+	lods.reserve(lods.size() + lodCount);
+	strips.reserve(strips.size() + totalStripCount);
+
+	bool bProcessedStrip = false;
+
+	if ((stripCount != 0) && (bProcessedStrip = true, stripCount != 0)) {
+		ed_Chunck* pMBNK = LOAD_POINTER_CAST(ed_Chunck*, pCluster->pMBNK);
+		ed_3d_strip* p3DStrip = LOAD_POINTER_CAST(ed_3d_strip*, pCluster->p3DStrip);
+
+		uint stripIndex = 0;
+
+		while (stripIndex < stripCount) {
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCluster Processing strip: {}", stripIndex);
+
+			std::string meshName = GetShortName();
+			meshName += "_";
+			meshName += std::to_string(stripIndex);
+
+			Strip& strip = strips.emplace_back();
+			strip.Process(p3DStrip, std::move(meshName));
+
+			p3DStrip = LOAD_POINTER_CAST(ed_3d_strip*, p3DStrip->pNext);
+			stripIndex++;
+		}
+
+		cluster.strips.count = static_cast<Index>(strips.size()) - cluster.strips.first;
+		BuildStripBounds(strips, cluster.strips, cluster.stripBounds);
+
+		bProcessedStrip = true;
+	}
+
+	uint spriteCount = pCluster->clusterDetails.spriteCount;
+
+	if (spriteCount != 0) {
+
+	}
+
+	if (clusterHierCount != 0) {
+		ed_Chunck* pHASH = reinterpret_cast<ed_Chunck*>(pCluster + 1);
+		ed_hash_code* pHashCode = reinterpret_cast<ed_hash_code*>(pHASH + 1);
+
+		cluster.hierarchies.first = static_cast<Index>(hierarchies.size());
+		hierarchies.reserve(hierarchies.size() + clusterHierCount);
+
+		for (int i = 0; i < clusterHierCount; i++) {
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCluster Processing cluster hierarchy: {}", pHashCode->hash.ToString());
+
+			ed_Chunck* pHIER = LOAD_POINTER_CAST(ed_Chunck*, pHashCode->pData);
+			assert(pHIER->hash == HASH_CODE_HIER);
+
+			ed_g3d_hierarchy* pHierarchy = reinterpret_cast<ed_g3d_hierarchy*>(pHIER + 1);
+
+			if (pHierarchy) {
+				ProcessHierarchy(pHierarchy, i);
+			}
+
+			pHashCode++;
+		}
+
+		cluster.hierarchies.count = static_cast<Index>(hierarchies.size()) - cluster.hierarchies.first;
+	}
+}
+
+void Renderer::Kya::G3D::ProcessCSTA()
+{
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA CSTA chunk header: {}", pManager->CSTA->GetHeaderString());
+
+	ed_Chunck* pClusterTypeChunk = pManager->CSTA + 1;
+
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA Cluster chunk header: {}", pClusterTypeChunk->GetHeaderString());
+
+	if (pClusterTypeChunk->hash == HASH_CODE_CDOA) {
+		assert(false);
+		MeshData_CSTA* pCSTA = reinterpret_cast<MeshData_CSTA*>(pClusterTypeChunk + 1);
+
+
+	}
+	else {
+		if (pClusterTypeChunk->hash == HASH_CODE_CDQA) {
+			MeshData_CSTA* pCSTA = reinterpret_cast<MeshData_CSTA*>(pClusterTypeChunk + 1);
+
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA Processing CDQA chunk");
+
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA field_0x20: {}", pCSTA->field_0x20.ToString());
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA worldLocation: {}", pCSTA->worldLocation.ToString());
+
+			ed_Chunck* pCDQU = edChunckGetFirst(pCSTA + 1, reinterpret_cast<char*>(pClusterTypeChunk) + pClusterTypeChunk->size);
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA CDQA chunk header: {}", pCDQU->GetHeaderString());
+
+			if (pCDQU) {
+				ed_g3d_cluster* pCDQUData = reinterpret_cast<ed_g3d_cluster*>(pCDQU + 1);
+				ProcessCluster(pCDQUData);
+			}
+		}
+	}
+}
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		static int GetTextureLayerCount(const ed_3d_strip* pStrip)
+		{
+			return gTextureLayerCountFunc ? std::clamp(gTextureLayerCountFunc(pStrip), 1, G3D::Strip::gMaxTextureLayers) : 1;
+		}
+
+		// Display list strips are gone by the time a trace is played back, so their source data goes into it.
+		static void TraceDlistStrip(MeshTraceWriter& writer, const G3D::Strip& strip)
+		{
+			const int layerCount = GetTextureLayerCount(strip.pStrip);
+			const G3D::Strip::SourceStreams streams = strip.GetSourceStreams(layerCount);
+
+			uint64_t contentHash = HashBytes(streams.pST, streams.stBytes, strip.ComputeSourceHash());
+			contentHash = HashBytes(&layerCount, sizeof(layerCount), contentHash);
+
+			writer.CacheDlistStrip(strip.pStrip, contentHash, [&](MeshTraceStripData& data) {
+				auto copy = [](std::vector<uint8_t>& out, const void* pData, size_t size) {
+					const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+					out.assign(pBytes, pBytes + size);
+				};
+
+				copy(data.strip, strip.pStrip, sizeof(ed_3d_strip));
+
+				for (const G3D::Strip::Section& section : strip.sections) {
+					data.gifTags.insert(data.gifTags.end(), section.pGifPkt, section.pGifPkt + sizeof(edpkt_data));
+				}
+
+				copy(data.vertices, streams.pVertices, streams.vertexBytes);
+				copy(data.normals, streams.pNormals, streams.normalBytes);
+				copy(data.colors, streams.pColors, streams.colorBytes);
+				copy(data.st, streams.pST, streams.stBytes);
+				data.textureLayerCount = layerCount;
+			});
+		}
+	}
+}
+
+void Renderer::Kya::MeshLibrary::Init()
+{
+	ed3DGetMeshLoadedDelegate() += Renderer::Kya::MeshLibrary::AddMesh;
+}
+
+void Renderer::Kya::MeshLibrary::SetParallelConstruction(bool bEnabled)
+{
+	if (bEnabled && !gDecodePool) {
+		gDecodePool = std::make_unique<ThreadPool>();
+	}
+
+	gbParallelConstruction = bEnabled;
+}
+
+bool Renderer::Kya::MeshLibrary::OpenBakedStripCache(const std::string& path)
+{
+	return gBakedStripCache.Open(path, sizeof(MeshVertex), sizeof(MeshIndex));
+}
+
+bool Renderer::Kya::MeshLibrary::SaveBakedStripCache()
+{
+	return gBakedStripCache.Save();
+}
+
+bool Renderer::Kya::MeshLibrary::StartTrace(const std::string& path)
+{
+	StopTrace();
+
+	auto pWriter = std::make_unique<MeshTraceWriter>();
+
+	// Straight from the cache, so tracing doesn't show up in the FindStrip counters.
+	const bool bOpened = pWriter->Open(path, [](const ed_3d_strip* pStrip, uint64_t& sourceHash) {
+		const G3D::Strip* pFound = gStripCache.Find(pStrip);
+		if (!pFound || pFound->sections.empty()) {
+			return false;
+		}
+
+		sourceHash = pFound->ComputeSourceHash();
+		return true;
+	});
+
+	if (!bOpened) {
+		MESH_LOG(LogLevel::Error, "Renderer::Kya::MeshLibrary::StartTrace Failed to open trace: {}", path);
+		return false;
+	}
+
+	gTraceWriter.store(pWriter.release(), std::memory_order_release);
+	return true;
+}
+
+void Renderer::Kya::MeshLibrary::StopTrace()
+{
+	MeshTraceWriter* pWriter = gTraceWriter.exchange(nullptr, std::memory_order_acq_rel);
+	if (!pWriter) {
+		return;
+	}
+
+	// Render threads that loaded it may still be writing, Close waits for them and the rest is dropped.
+	pWriter->Close();
+	gEpoch.Retire([pWriter]() { delete pWriter; });
+}
 
-				Vertex12* pVertex = LOAD_POINTER_CAST(Vertex12*, pStrip->pVertexBuf);
+void Renderer::Kya::MeshLibrary::SetAsyncIngestion(bool bEnabled)
+{
+	gbAsyncIngestion = bEnabled;
+}
 
-				vtx.XYZFlags.fXYZ[0] = int12_to_float(pVertex[adjustedIndex].x);
-				vtx.XYZFlags.fXYZ[1] = int12_to_float(pVertex[adjustedIndex].y);
-				vtx.XYZFlags.fXYZ[2] = int12_to_float(pVertex[adjustedIndex].z);
-				vtx.XYZFlags.flags = pVertex[adjustedIndex].flags;
-			}
-			else {
-				GSVertexUnprocessed::Vertex* pVertex = LOAD_POINTER_CAST(GSVertexUnprocessed::Vertex*, pStrip->pVertexBuf);
-				vtx.XYZFlags = pVertex[adjustedIndex];
-			}
+void Renderer::Kya::MeshLibrary::Update()
+{
+	if (MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire)) {
+		pWriter->EndFrame();
+	}
 
-			const uint64_t primReg = firstGifTag.tag.PRIM;
-			const GIFReg::GSPrim primPacked = *reinterpret_cast<const GIFReg::GSPrim*>(&primReg);
+	for (G3D& mesh : gIngestQueue.TakeBuilt()) {
+		PublishMesh(std::move(mesh));
+	}
 
-			const uint skip = vtx.XYZFlags.flags & 0x8000;
+	EnforceDecodedBudget();
+	gFrameIndex++;
 
-			MESH_LOG_TRACE(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Processing vertex: {}, drawMode: {}, primPacked: 0x{:x}, nloop: 0x{:x}, skip: 0x{:x}", i, (int)drawMode, primReg, gifTag.nLoop, skip);
+	gEpoch.Reclaim();
+}
 
-			MESH_LOG_TRACE(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Processing vertex: {}, (S: {} T: {} Q: {}) (R: {} G: {} B: {} A: {}) (X: {} Y: {} Z: {} Skip: {})\n",
-				i, vtx.STQ.ST[0], vtx.STQ.ST[1], vtx.STQ.Q, vtx.RGBA[0], vtx.RGBA[1], vtx.RGBA[2], vtx.RGBA[3], vtx.XYZFlags.fXYZ[0], vtx.XYZFlags.fXYZ[1], vtx.XYZFlags.fXYZ[2], vtx.XYZFlags.flags);
+void Renderer::Kya::MeshLibrary::Clear()
+{
+	gIngestQueue.CancelPrefetches(nullptr);
 
-			Renderer::KickVertex(vtx, primPacked, skip, vertexBufferData);
+	MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire);
 
-			MESH_LOG_TRACE(LogLevel::Info, "Renderer::Kya::G3D::Strip::PreProcessVertices Kick complete vtx tail: 0x{:x} index tail: 0x{:x}",
-				vertexBufferData.GetVertexTail(), vertexBufferData.GetIndexTail());
+	while (!gMeshes.empty()) {
+		if (pWriter) {
+			pWriter->RemoveMesh(gMeshes.back().GetManager());
 		}
 
-		meshOffset += gifTag.nLoop;
-		vtxOffset += 2;
+		ReleaseStrips(gMeshes.back());
+		EraseMesh(static_cast<uint32_t>(gMeshes.size() - 1));
 	}
 
-	//assert(internalVertexBuffer.GetIndexTail() > 0);
+	ReleaseDlistStrips();
+	gEpoch.Reclaim();
 }
 
-Renderer::SimpleMesh* Renderer::Kya::G3D::Strip::GetSimpleMesh(int textureLayerIndex) const
+void Renderer::Kya::MeshLibrary::RemoveMesh(ed_g3d_manager* pManager)
 {
-	if (textureLayerIndex <= 0) {
-		return pSimpleMesh.get();
+	if (MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire)) {
+		pWriter->RemoveMesh(pManager);
 	}
 
-	const size_t layerIndex = static_cast<size_t>(textureLayerIndex);
-	if (layerSimpleMeshes.size() <= layerIndex) {
-		layerSimpleMeshes.resize(layerIndex + 1);
+	gIngestQueue.Cancel(pManager);
+
+	std::vector<G3D>& meshes = gMeshLibrary.gMeshes;
+
+	for (uint32_t meshIndex = 0; meshIndex < meshes.size();) {
+		if (meshes[meshIndex].GetManager() == pManager) {
+			MESH_LOG(LogLevel::Info, "Renderer::Kya::MeshLibrary::RemoveMesh Removing mesh: {}", meshes[meshIndex].GetName());
+			ReleaseStrips(meshes[meshIndex]);
+
+			// The last mesh takes its place, so the same index is checked again.
+			gMeshLibrary.EraseMesh(meshIndex);
+		}
+		else {
+			meshIndex++;
+		}
 	}
 
-	if (!layerSimpleMeshes[layerIndex]) {
-		std::string meshName = pSimpleMesh->GetName();
-		meshName += "_layer_";
-		meshName += std::to_string(textureLayerIndex);
+	gEpoch.Reclaim();
+}
+
+bool Renderer::Kya::MeshLibrary::WasLodSelected(const G3D::Lod& lod, uint32_t frameWindow)
+{
+	const uint32_t lastSelectedFrame = lod.lastSelectedFrame.value.load(std::memory_order_relaxed);
+	return lastSelectedFrame != 0 && gFrameIndex.load(std::memory_order_relaxed) - lastSelectedFrame <= frameWindow;
+}
+
+void Renderer::Kya::MeshLibrary::EvictUnselectedLods(uint32_t frameWindow)
+{
+	for (const G3D& mesh : gMeshes) {
+		for (const G3D::Lod& lod : mesh.GetLods()) {
+			if (WasLodSelected(lod, frameWindow)) {
+				continue;
+			}
 
-		layerSimpleMeshes[layerIndex] = std::make_unique<SimpleMesh>(meshName, pSimpleMesh->GetPrim());
-		PreProcessVertices(textureLayerIndex, layerSimpleMeshes[layerIndex].get());
+			for (G3D::Index stripIndex = lod.strips.first; stripIndex < lod.strips.GetEnd(); stripIndex++) {
+				mesh.GetStrips()[stripIndex].EvictSimpleMeshes();
+			}
+		}
 	}
+}
 
-	return layerSimpleMeshes[layerIndex].get();
+void Renderer::Kya::MeshLibrary::SetDecodedBudget(size_t budgetBytes)
+{
+	gDecodedBudget = budgetBytes;
 }
 
-void Renderer::Kya::G3D::Cluster::ProcessStrip(ed_3d_strip* pStrip, const int stripIndex)
+size_t Renderer::Kya::MeshLibrary::GetDecodedBytes()
 {
-	assert(pStrip);
+	return gDecodedBytes;
+}
 
-	assert(pStrip->meshCount > 0);
+void Renderer::Kya::MeshLibrary::SetMeshOptimization(bool bEnabled)
+{
+	gbOptimizeMeshes = bEnabled;
+}
+
+void Renderer::Kya::MeshLibrary::SetDeduplication(bool bEnabled)
+{
+	gbDeduplicateMeshes = bEnabled;
+}
 
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Cluster::ProcessStrip Processing strip flags: 0x{:x}", pStrip->flags);
+Renderer::Kya::MeshLibrary::DedupStats Renderer::Kya::MeshLibrary::GetDedupStats()
+{
+	std::lock_guard<std::mutex> lock(gSharedMeshMutex);
+	return gDedupStats;
+}
 
-	Strip& strip = strips.emplace_back();
-	strip.pStrip = pStrip;
-	strip.pParent = this;
+std::vector<Renderer::Kya::MeshLibrary::MeshStats> Renderer::Kya::MeshLibrary::GetMeshStats() const
+{
+	std::vector<MeshStats> meshStats;
+	meshStats.reserve(gMeshes.size());
 
-	const Gif_Tag gifTag = ExtractGifTagFromVifList(pStrip);
+	for (const G3D& mesh : gMeshes) {
+		MeshStats& stats = meshStats.emplace_back();
+		stats.name = mesh.GetName();
+		stats.timings = mesh.GetLoadTimings();
 
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Cluster::ProcessStrip Processing strip gifTag: NLOOP 0x{:x} NREG 0x{:x} PRIM 0x{:x}", (uint)gifTag.tag.NLOOP, (uint)gifTag.tag.NREG, (uint)gifTag.tag.PRIM);
-	const uint64_t primReg = gifTag.tag.PRIM;
-	const GIFReg::GSPrim prim = *reinterpret_cast<const GIFReg::GSPrim*>(&primReg);
+		AccumulateHierarchyStats(mesh, stats);
 
-	// strip everything before the last forward slash
-	std::string meshName = this->pParent->GetName().substr(this->pParent->GetName().find_last_of('\\') + 1);
-	meshName += "_";
-	meshName += std::to_string(stripIndex);
+		const G3D::Range clusterStrips = mesh.GetCluster().strips;
+		for (G3D::Index stripIndex = clusterStrips.first; stripIndex < clusterStrips.GetEnd(); stripIndex++) {
+			stats.clusterStripCount++;
+			AccumulateStripStats(mesh.GetStrips()[stripIndex], stats);
+		}
+	}
 
-	strip.pSimpleMesh = std::make_unique<SimpleMesh>(meshName, prim);
+	return meshStats;
+}
 
-	strip.PreProcessVertices(0, strip.pSimpleMesh.get());
+Renderer::Kya::MeshLibrary::Counters Renderer::Kya::MeshLibrary::GetCounters()
+{
+	Counters counters;
+	counters.findStripHits = SumCounter(&LibraryCounters::findStripHits);
+	counters.findStripMisses = SumCounter(&LibraryCounters::findStripMisses);
+	counters.stripDecodes = SumCounter(&LibraryCounters::stripDecodes);
+	counters.stripDecodeMs = static_cast<double>(SumCounter(&LibraryCounters::stripDecodeNs)) / 1000000.0;
+	counters.lazyLayerBuilds = SumCounter(&LibraryCounters::lazyLayerBuilds);
+	counters.compactExpansions = SumCounter(&LibraryCounters::compactExpansions);
+	counters.dlistRecaches = SumCounter(&LibraryCounters::dlistRecaches);
+	counters.dlistUnchanged = SumCounter(&LibraryCounters::dlistUnchanged);
+	counters.decodeMismatches = SumCounter(&LibraryCounters::decodeMismatches);
+	counters.assemblyMismatches = SumCounter(&LibraryCounters::assemblyMismatches);
+	return counters;
 }
 
-void Renderer::Kya::G3D::Cluster::CacheStrips()
+void Renderer::Kya::MeshLibrary::ResetCounters()
 {
-	for (auto& strip : strips) {
-		gStripCache[strip.pStrip] = &strip;
+	for (LibraryCounters& shard : gCounterShards) {
+		shard.findStripHits = 0;
+		shard.findStripMisses = 0;
+		shard.stripDecodes = 0;
+		shard.stripDecodeNs = 0;
+		shard.lazyLayerBuilds = 0;
+		shard.compactExpansions = 0;
+		shard.dlistRecaches = 0;
+		shard.dlistUnchanged = 0;
+		shard.decodeMismatches = 0;
+		shard.assemblyMismatches = 0;
 	}
 }
 
-void Renderer::Kya::G3D::Cluster::ProcessHierarchy(ed_g3d_hierarchy* pHierarchy, const int heirarchyIndex)
+void Renderer::Kya::MeshLibrary::SetDecodeValidation(bool bEnabled)
 {
-	EmplaceHierarchy(hierarchies, pHierarchy, heirarchyIndex, pParent);
+	gbValidateDecode = bEnabled;
 }
 
-void Renderer::Kya::G3D::Object::ProcessStrip(ed_3d_strip* pStrip, const int heirarchyIndex, const int lodIndex, const int stripIndex)
+void Renderer::Kya::MeshLibrary::SetCompactStorage(bool bEnabled)
 {
-	assert(pStrip);
+	gbCompactStorage = bEnabled;
+}
 
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Object::ProcessStrip Processing strip flags: 0x{:x}", pStrip->flags);
+void Renderer::Kya::MeshLibrary::SetTextureLayerCountFunc(TextureLayerCountFunc func)
+{
+	gTextureLayerCountFunc = std::move(func);
+}
+
+void Renderer::Kya::MeshLibrary::SetLazyDecoding(bool bEnabled)
+{
+	gbLazyDecoding = bEnabled;
+}
 
-	Strip& strip = strips.emplace_back();
-	strip.pStrip = pStrip;
-	strip.pParent = this;
+void Renderer::Kya::MeshLibrary::Prefetch(const G3D& mesh, uint32_t lodMask)
+{
+	std::vector<const G3D::Strip*> strips;
 
-	Gif_Tag gifTag = ExtractGifTagFromVifList(pStrip);
+	auto gatherPending = [&strips, &mesh](G3D::Range stripRange) {
+		for (G3D::Index stripIndex = stripRange.first; stripIndex < stripRange.GetEnd(); stripIndex++) {
+			const G3D::Strip& strip = mesh.GetStrips()[stripIndex];
 
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Object::ProcessStrip Processing strip gifTag: NLOOP 0x{:x} NREG 0x{:x} PRIM 0x{:x}", (uint)gifTag.tag.NLOOP, (uint)gifTag.tag.NREG, (uint)gifTag.tag.PRIM);
-	const uint64_t primReg = gifTag.tag.PRIM;
-	const GIFReg::GSPrim prim = *reinterpret_cast<const GIFReg::GSPrim*>(&primReg);
+			if (strip.decodeState.value.load(std::memory_order_relaxed) == G3D::Strip::DecodeState::Pending) {
+				strips.push_back(&strip);
+			}
+		}
+	};
 
-	// strip everything before the last forward slash
-	std::string meshName = this->pParent ? this->pParent->pParent->pParent->GetName().substr(this->pParent->pParent->pParent->GetName().find_last_of('\\') + 1) :
-		"None";
-	meshName += "_";
-	meshName += std::to_string(heirarchyIndex);
-	meshName += "_";
-	meshName += std::to_string(lodIndex);
-	meshName += "_";
-	meshName += std::to_string(stripIndex);
+	for (const G3D::Hierarchy& hierarchy : mesh.GetHierarchies()) {
+		for (G3D::Index lodIndex = 0; lodIndex < hierarchy.lods.count && lodIndex < 32; lodIndex++) {
+			if ((lodMask & (1u << lodIndex)) != 0) {
+				gatherPending(mesh.GetLods()[hierarchy.lods.first + lodIndex].strips);
+			}
+		}
+	}
 
-	strip.pSimpleMesh = std::make_unique<SimpleMesh>(meshName, prim);
+	if ((lodMask & 1) != 0) {
+		gatherPending(mesh.GetCluster().strips);
+	}
 
-	strip.PreProcessVertices(0, strip.pSimpleMesh.get());
+	if (!strips.empty()) {
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::MeshLibrary::Prefetch Queued {} strips of mesh: {}", strips.size(), mesh.GetName());
+		gIngestQueue.EnqueuePrefetch(mesh.GetManager(), std::move(strips));
+	}
 }
 
-void Renderer::Kya::G3D::Hierarchy::Lod::Object::CacheStrips()
+void Renderer::Kya::MeshLibrary::EnforceDecodedBudget()
 {
-	for (auto& strip : strips) {
-		gStripCache[strip.pStrip] = &strip;
+	if (gDecodedBudget == 0 || gDecodedBytes <= gDecodedBudget) {
+		return;
 	}
-}
 
-void Renderer::Kya::G3D::Lod::ProcessObject(ed_g3d_object* pObject, const int heirarchyIndex, const int lodIndex)
-{
-	object.pObject = pObject;
-	object.pParent = this;
+	std::vector<const G3D::Strip*> candidates;
 
-	if (pObject->p3DData) {
-		ed_3d_strip* pStrip = LOAD_POINTER_CAST(ed_3d_strip*, pObject->p3DData);
-		int stripIndex = 0;
+	for (G3D& mesh : gMeshes) {
+		for (const G3D::Strip& strip : mesh.GetStrips()) {
+			// Anything drawn this frame stays, evicting it would only decode it again straight away. Whether it holds any
+			// bytes is checked by EvictSimpleMeshes, which is the only place it is safe to read with readers running.
+			const bool bReady = strip.decodeState.value.load(std::memory_order_acquire) == G3D::Strip::DecodeState::Ready;
+			if (bReady && strip.lastUsedFrame.value.load(std::memory_order_relaxed) != gFrameIndex) {
+				candidates.push_back(&strip);
+			}
+		}
+	}
 
-		while (stripIndex < pObject->stripCount) {
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Hierarchy::Lod::ProcessObject Processing strip: {}", stripIndex);
+	std::sort(candidates.begin(), candidates.end(), [](const G3D::Strip* pA, const G3D::Strip* pB) {
+		return pA->lastUsedFrame.value.load(std::memory_order_relaxed) < pB->lastUsedFrame.value.load(std::memory_order_relaxed);
+	});
 
-			object.ProcessStrip(pStrip, heirarchyIndex, lodIndex, stripIndex);
-			pStrip = LOAD_POINTER_CAST(ed_3d_strip*, pStrip->pNext);
-			stripIndex++;
+	for (const G3D::Strip* pStrip : candidates) {
+		if (gDecodedBytes <= gDecodedBudget) {
+			break;
 		}
 
-		object.CacheStrips();
+		pStrip->EvictSimpleMeshes();
 	}
 }
 
-void Renderer::Kya::G3D::Hierarchy::ProcessLod(ed3DLod* pLod, const int heirarchyIndex, const int lodIndex)
+Renderer::Kya::MeshLibrary::LoadState Renderer::Kya::MeshLibrary::GetLoadState(const ed_g3d_manager* pManager) const
 {
-	assert(pLod);
-
-	if (pLod->pObj) {
-		Lod& lod = lods.emplace_back();
-		lod.pLod = pLod;
-		lod.pParent = this;
-
-		ed_hash_code* pHash = LOAD_POINTER_CAST(ed_hash_code*, pLod->pObj);
-		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Hierarchy::ProcessLod Processing lod: {}", pHash->hash.ToString());
+	return gIngestQueue.GetLoadState(pManager);
+}
 
-		ed_Chunck* pOBJ = LOAD_POINTER_CAST(ed_Chunck*, pHash->pData);
+Renderer::Kya::MeshLibrary::MeshHandle Renderer::Kya::MeshLibrary::PublishMesh(G3D&& mesh)
+{
+	ed_g3d_manager* pManager = mesh.GetManager();
 
-		if (pOBJ) {
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Hierarchy::ProcessLod Object chunk header: {}", pOBJ->GetHeaderString());
+	uint32_t slotIndex = static_cast<uint32_t>(meshSlots.size());
 
-			ed_g3d_object* pObject = reinterpret_cast<ed_g3d_object*>(pOBJ + 1);
-			lod.ProcessObject(pObject, heirarchyIndex, lodIndex);
-		}
+	if (freeMeshSlots.empty()) {
+		assert(slotIndex <= gMeshSlotMask);
+		meshSlots.emplace_back();
 	}
 	else {
-		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Hierarchy::ProcessLod No lod data");
+		slotIndex = freeMeshSlots.back();
+		freeMeshSlots.pop_back();
 	}
+
+	MeshSlot& slot = meshSlots[slotIndex];
+	slot.meshIndex = static_cast<uint32_t>(gMeshes.size());
+
+	G3D& published = gMeshes.emplace_back(std::move(mesh));
+	meshSlotIndices.push_back(slotIndex);
+	published.CacheStrips();
+
+	gIngestQueue.SetLoadState(pManager, LoadState::Ready);
+
+	return (slot.generation << gMeshSlotBits) | slotIndex;
 }
 
-Renderer::Kya::G3D::G3D(ed_g3d_manager* pManager, std::string name)
-	: pManager(pManager)
-	, name(name)
+void Renderer::Kya::MeshLibrary::EraseMesh(uint32_t meshIndex)
 {
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::G3D Beginning processing of mesh: {}", name.c_str());
+	// Moving keeps the strips where they are, readers that found one before it left the cache can finish with it.
+	RetireObject(std::move(gMeshes[meshIndex]));
 
-	if (pManager->HALL) {
-		ProcessHALL();
+	const uint32_t slotIndex = meshSlotIndices[meshIndex];
+	MeshSlot& slot = meshSlots[slotIndex];
+
+	// Generation 0 is skipped so no handle is ever gInvalidMeshHandle.
+	slot.generation = (slot.generation + 1) & (UINT32_MAX >> gMeshSlotBits);
+	if (slot.generation == 0) {
+		slot.generation = 1;
 	}
 
-	if (pManager->CSTA) {
-		ProcessCSTA();
+	freeMeshSlots.push_back(slotIndex);
+
+	const uint32_t lastIndex = static_cast<uint32_t>(gMeshes.size() - 1);
+	if (meshIndex != lastIndex) {
+		gMeshes[meshIndex] = std::move(gMeshes[lastIndex]);
+		meshSlotIndices[meshIndex] = meshSlotIndices[lastIndex];
+		meshSlots[meshSlotIndices[meshIndex]].meshIndex = meshIndex;
 	}
+
+	gMeshes.pop_back();
+	meshSlotIndices.pop_back();
 }
 
-void Renderer::Kya::G3D::ProcessHierarchy(ed_g3d_hierarchy* pHierarchy, const int heirarchyIndex)
+Renderer::Kya::MeshLibrary::MeshHandle Renderer::Kya::MeshLibrary::FindMesh(const ed_g3d_manager* pManager) const
 {
-	EmplaceHierarchy(hierarchies, pHierarchy, heirarchyIndex, this);
+	for (uint32_t meshIndex = 0; meshIndex < gMeshes.size(); meshIndex++) {
+		if (gMeshes[meshIndex].GetManager() == pManager) {
+			const uint32_t slotIndex = meshSlotIndices[meshIndex];
+			return (meshSlots[slotIndex].generation << gMeshSlotBits) | slotIndex;
+		}
+	}
+
+	return gInvalidMeshHandle;
 }
 
-void Renderer::Kya::G3D::ProcessHALL()
+const Renderer::Kya::G3D* Renderer::Kya::MeshLibrary::GetMesh(MeshHandle handle) const
 {
-	assert(pManager->HALL);
+	const uint32_t slotIndex = handle & gMeshSlotMask;
 
-	ed_Chunck* pHASH = pManager->HALL + 1;
-	ed_hash_code* pHashCode = reinterpret_cast<ed_hash_code*>(pHASH + 1);
-	const int chunkNb = edChunckGetNb(pHASH, reinterpret_cast<char*>(pManager->HALL) + pManager->HALL->size);
+	if (slotIndex >= meshSlots.size() || meshSlots[slotIndex].generation != (handle >> gMeshSlotBits)) {
+		return nullptr;
+	}
 
-	hierarchies.reserve(chunkNb);
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::G3D Nb Chunks: {}", chunkNb);
+	// A free slot keeps a stale meshIndex, only a live one is listed back against it.
+	const uint32_t meshIndex = meshSlots[slotIndex].meshIndex;
+	if (meshIndex >= gMeshes.size() || meshSlotIndices[meshIndex] != slotIndex) {
+		return nullptr;
+	}
 
-	for (int curIndex = 0; curIndex < chunkNb - 1; curIndex = curIndex + 1) {
-		MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::G3D Processing hierarchy {}/{} hash: {}", curIndex, chunkNb, pHashCode->hash.ToString());
+	return &gMeshes[meshIndex];
+}
 
-		ed_g3d_hierarchy* pHierarchy = ed3DG3DHierarchyGetFromIndex(pManager, curIndex);
+const Renderer::Kya::G3D::Strip* Renderer::Kya::MeshLibrary::FindStrip(const ed_3d_strip* pStrip) const
+{
+	// Strips of meshes still being built asynchronously are not in the cache yet.
+	const G3D::Strip* pFound = gStripCache.Find(pStrip);
+	CountEvent(pFound ? &LibraryCounters::findStripHits : &LibraryCounters::findStripMisses);
+	return pFound;
+}
 
-		if (pHierarchy) {
-			ProcessHierarchy(pHierarchy, curIndex);
-		}
+Renderer::SimpleMesh* Renderer::Kya::MeshLibrary::ResolveNode(const edNODE* pNode, int textureLayerIndex) const
+{
+	ed_3d_strip* pStrip = reinterpret_cast<ed_3d_strip*>(pNode->pData);
 
-		pHashCode++;
+	const G3D::Strip* pRendererStrip = FindStrip(pStrip);
+
+	if (!pRendererStrip) {
+		// Either the owning mesh is still queued for async ingestion or it was never added, skip the draw.
+		MESH_LOG(LogLevel::Info, "Renderer::Kya::MeshLibrary::ResolveNode Strip not found");
+		return nullptr;
+	}
+
+	pRendererStrip->lastUsedFrame.value.store(gFrameIndex.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+	Renderer::SimpleMesh* pSimpleMesh = pRendererStrip->GetSimpleMesh(textureLayerIndex);
+	if (!pSimpleMesh) {
+		MESH_LOG(LogLevel::Error, "Renderer::Kya::MeshLibrary::ResolveNode no simple mesh available for rendering layer {}", textureLayerIndex);
 	}
+
+	return pSimpleMesh;
 }
 
-void Renderer::Kya::G3D::ProcessCluster(ed_g3d_cluster* pCluster)
+void Renderer::Kya::MeshLibrary::RenderNode(const edNODE* pNode, int textureLayerIndex) const
 {
-	assert(pCluster);
+	ReadScope readScope;
 
-	cluster.pData = pCluster;
-	cluster.pParent = this;
+	if (MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire)) {
+		pWriter->RenderNode(pNode, textureLayerIndex);
+	}
 
-	const uint stripCountArrayEntryIndex = 4;
+	Renderer::SimpleMesh* pSimpleMesh = ResolveNode(pNode, textureLayerIndex);
 
-	const uint stripCount = pCluster->aClusterStripCounts[stripCountArrayEntryIndex];
+	if (pSimpleMesh) {
+		Renderer::RenderMesh(pSimpleMesh, pNode->header.typeField.flags);
+	}
+}
 
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCluster Processing CDQU chunk stripCount: {}", stripCount);
+void Renderer::Kya::MeshLibrary::RenderNodes(const edNODE* const* ppNodes, size_t nodeCount, int textureLayerIndex) const
+{
+	struct Draw {
+		uint64_t primKey;
+		uint32_t flags;
+		Renderer::SimpleMesh* pMesh;
+	};
 
-	bool bProcessedStrip = false;
+	// Held until the last draw is submitted, the meshes resolved up front must outlive the sort.
+	ReadScope readScope;
 
-	if ((stripCount != 0) && (bProcessedStrip = true, stripCount != 0)) {
-		ed_Chunck* pMBNK = LOAD_POINTER_CAST(ed_Chunck*, pCluster->pMBNK);
-		ed_3d_strip* p3DStrip = LOAD_POINTER_CAST(ed_3d_strip*, pCluster->p3DStrip);
+	if (MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire)) {
+		pWriter->RenderNodes(ppNodes, nodeCount, textureLayerIndex);
+	}
 
-		uint stripIndex = 0;
+	thread_local std::vector<Draw> draws;
+	draws.clear();
+	draws.reserve(nodeCount);
 
-		while (stripIndex < stripCount) {
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::Hierarchy::Lod::ProcessObject Processing strip: {}", stripIndex);
+	for (size_t i = 0; i < nodeCount; i++) {
+		const edNODE* pNode = ppNodes[i];
+		Renderer::SimpleMesh* pSimpleMesh = ResolveNode(pNode, textureLayerIndex);
 
-			cluster.ProcessStrip(p3DStrip, stripIndex);
-			p3DStrip = LOAD_POINTER_CAST(ed_3d_strip*, p3DStrip->pNext);
-			stripIndex++;
+		if (pSimpleMesh) {
+			draws.push_back({ GetPrimKey(pSimpleMesh->GetPrim()), static_cast<uint32_t>(pNode->header.typeField.flags), pSimpleMesh });
 		}
+	}
 
-		cluster.CacheStrips();
+	// Stable so draws that compare equal keep the order the caller gave them.
+	std::stable_sort(draws.begin(), draws.end(), [](const Draw& a, const Draw& b) {
+		if (a.primKey != b.primKey) {
+			return a.primKey < b.primKey;
+		}
 
-		bProcessedStrip = true;
-	}
+		if (a.flags != b.flags) {
+			return a.flags < b.flags;
+		}
 
-	uint spriteCount = pCluster->clusterDetails.spriteCount;
+		return a.pMesh < b.pMesh;
+	});
 
-	if (spriteCount != 0) {
+	MESH_LOG(LogLevel::Info, "Renderer::Kya::MeshLibrary::RenderNodes Submitting {} draws from {} nodes", draws.size(), nodeCount);
 
+	// Runs of the same mesh and flags are submitted back to back. The renderer has no instanced submission
+	// for SimpleMesh, so each draw in the run is still its own RenderMesh call.
+	for (const Draw& draw : draws) {
+		Renderer::RenderMesh(draw.pMesh, draw.flags);
 	}
+}
 
-	uint clusterHierCount = pCluster->clusterDetails.clusterHierCount;
+void Renderer::Kya::MeshLibrary::CacheDlistStrip(ed_3d_strip* pStrip)
+{
+	G3D::Strip* pDlistStrip = gDlistStripCache.Find(pStrip);
+	const bool bCached = pDlistStrip != nullptr;
 
-	if (clusterHierCount != 0) {
-		ed_Chunck* pHASH = reinterpret_cast<ed_Chunck*>(pCluster + 1);
-		ed_hash_code* pHashCode = reinterpret_cast<ed_hash_code*>(pHASH + 1);
+	MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire);
 
-		for (int i = 0; i < clusterHierCount; i++) {
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCluster Processing cluster hierarchy: {}", pHashCode->hash.ToString());
+	if (pDlistStrip) {
+		G3D::Strip& strip = *pDlistStrip;
 
-			ed_Chunck* pHIER = LOAD_POINTER_CAST(ed_Chunck*, pHashCode->pData);
-			assert(pHIER->hash == HASH_CODE_HIER);
+		// A reader may be part way through building one of its layers.
+		const uint8_t state = strip.Claim();
 
-			ed_g3d_hierarchy* pHierarchy = reinterpret_cast<ed_g3d_hierarchy*>(pHIER + 1);
+		// Hashing the source is far cheaper than decoding, most dlist strips don't change between calls.
+		strip.IndexSections();
+		const uint64_t hash = strip.ComputeContentHash(0);
+		if (hash == strip.contentHash) {
+			strip.Unclaim(state);
+			CountEvent(&LibraryCounters::dlistUnchanged);
 
-			if (pHierarchy) {
-				cluster.ProcessHierarchy(pHierarchy, i);
+			if (pWriter) {
+				TraceDlistStrip(*pWriter, strip);
 			}
 
-			pHashCode++;
+			return;
 		}
-	}
-}
-
-void Renderer::Kya::G3D::ProcessCSTA()
-{
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA CSTA chunk header: {}", pManager->CSTA->GetHeaderString());
 
-	ed_Chunck* pClusterTypeChunk = pManager->CSTA + 1;
+		strip.contentHash = hash;
+		strip.ComputeBounds();
 
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA Cluster chunk header: {}", pClusterTypeChunk->GetHeaderString());
+		// Readers can still be drawing the old meshes, so the new contents go into a spare instead of over them. The old
+		// base mesh becomes a spare itself once they are done.
+		for (auto& published : strip.publishedMeshes) {
+			published.value.store(nullptr, std::memory_order_release);
+		}
 
-	if (pClusterTypeChunk->hash == HASH_CODE_CDOA) {
-		assert(false);
-		MeshData_CSTA* pCSTA = reinterpret_cast<MeshData_CSTA*>(pClusterTypeChunk + 1);
+		if (strip.pSimpleMesh) {
+			strip.deferredName = strip.pSimpleMesh->GetName();
 
+			gEpoch.Retire([pMesh = std::move(strip.pSimpleMesh)]() mutable {
+				if (gDlistStripPool.spareMeshes.size() < DlistStripPool::gMaxSpareMeshes) {
+					gDlistStripPool.spareMeshes.push_back(std::move(pMesh));
+				}
+			});
+		}
 
+		RetireObject(std::move(strip.layerSimpleMeshes));
+		strip.layerSimpleMeshes.clear();
 	}
 	else {
-		if (pClusterTypeChunk->hash == HASH_CODE_CDQA) {
-			MeshData_CSTA* pCSTA = reinterpret_cast<MeshData_CSTA*>(pClusterTypeChunk + 1);
+		// Strips only come back to the pool once no reader can reach them, so this one is free to rebuild.
+		pDlistStrip = gDlistStripPool.Acquire();
+		gDlistStripCache.Set(pStrip, pDlistStrip);
 
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA Processing CDQA chunk");
+		G3D::SimpleMeshPtr pPreviousMesh = std::move(pDlistStrip->pSimpleMesh);
 
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA field_0x20: {}", pCSTA->field_0x20.ToString());
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA worldLocation: {}", pCSTA->worldLocation.ToString());
+		// Nothing a dlist strip holds is counted in the decoded bytes, so the old state can simply be dropped.
+		assert(pDlistStrip->residentBytes == 0);
 
-			ed_Chunck* pCDQU = edChunckGetFirst(pCSTA + 1, reinterpret_cast<char*>(pClusterTypeChunk) + pClusterTypeChunk->size);
-			MESH_LOG(LogLevel::Info, "Renderer::Kya::G3D::ProcessCSTA CDQA chunk header: {}", pCDQU->GetHeaderString());
+		*pDlistStrip = G3D::Strip();
+		pDlistStrip->bDisplayList = true;
+		pDlistStrip->Process(pStrip, "None_0_0_0");
+		pDlistStrip->contentHash = pDlistStrip->ComputeContentHash(0);
 
-			if (pCDQU) {
-				ed_g3d_cluster* pCDQUData = reinterpret_cast<ed_g3d_cluster*>(pCDQU + 1);
-				ProcessCluster(pCDQUData);
-			}
-		}
+		pDlistStrip->pSimpleMesh = std::move(pPreviousMesh);
 	}
-}
 
-void Renderer::Kya::MeshLibrary::Init()
-{
-	ed3DGetMeshLoadedDelegate() += Renderer::Kya::MeshLibrary::AddMesh;
-}
+	G3D::Strip& strip = *pDlistStrip;
 
-const Renderer::Kya::G3D::Strip* Renderer::Kya::MeshLibrary::FindStrip(const ed_3d_strip* pStrip) const
-{
-	constexpr bool bUseStripCache = true;
-
-	if (bUseStripCache) {
-		assert(gStripCache.find(pStrip) != gStripCache.end());
-		return gStripCache[pStrip];
+	// A reused mesh is decoded over in place as long as its PRIM still matches.
+	const GIFReg::GSPrim prim = ExtractPrim(ExtractGifTag(strip.sections.front().pGifPkt));
+	if (strip.pSimpleMesh && GetPrimKey(strip.pSimpleMesh->GetPrim()) != GetPrimKey(prim)) {
+		strip.deferredName = strip.pSimpleMesh->GetName();
+		strip.pSimpleMesh.reset();
 	}
 
-	int hierarchyIndex = 0;
-	int lodIndex = 0;
-	int stripIndex = 0;
-
-	for (const auto& mesh : gMeshes) {
-		for (const auto& hierarchy : mesh.GetHierarchies()) {
-			for (const auto& lod : hierarchy.lods) {
-				for (const auto& strip : lod.object.strips) {
-					if (strip.pStrip == pStrip) {
-						MESH_LOG(LogLevel::Info, "Renderer::Kya::MeshLibrary::FindStrip Found hierarchy: {}, lod: {}, strip: {}", hierarchyIndex, lodIndex, stripIndex);
-						return &strip;
-					}
+	if (!strip.pSimpleMesh) {
+		std::vector<G3D::SimpleMeshPtr>& spareMeshes = gDlistStripPool.spareMeshes;
 
-					stripIndex++;
-				}
-			}
+		auto spare = std::find_if(spareMeshes.begin(), spareMeshes.end(), [&prim](const G3D::SimpleMeshPtr& pMesh) {
+			return GetPrimKey(pMesh->GetPrim()) == GetPrimKey(prim);
+		});
 
-			lodIndex++;
+		if (spare != spareMeshes.end()) {
+			strip.pSimpleMesh = std::move(*spare);
+			spareMeshes.erase(spare);
 		}
+	}
 
-		hierarchyIndex++;
+	CountEvent(&LibraryCounters::dlistRecaches);
+
+	// Layers are built on first use by GetSimpleMesh, through the same plain decode, see G3D::Strip::bDisplayList.
+	G3D::Strip::LayerTarget target;
+	target.pMesh = strip.pSimpleMesh ? strip.pSimpleMesh.get() : strip.CreateSimpleMesh(nullptr);
+	strip.PreProcessVertices(&target, 1);
+
+	strip.PublishLayerMeshes();
+	strip.Unclaim(G3D::Strip::DecodeState::Ready);
+
+	// Cached last so readers never find a strip that is still being decoded.
+	if (!bCached) {
+		gStripCache.Set(pStrip, pDlistStrip);
 	}
 
-	MESH_LOG(LogLevel::Info, "Renderer::Kya::MeshLibrary::FindStrip Strip not found");
-	return nullptr;
+	if (pWriter) {
+		TraceDlistStrip(*pWriter, strip);
+	}
 }
 
-void Renderer::Kya::MeshLibrary::RenderNode(const edNODE* pNode, int textureLayerIndex) const
+void Renderer::Kya::MeshLibrary::ReleaseDlistStrip(ed_3d_strip* pStrip)
 {
-	ed_3d_strip* pStrip = reinterpret_cast<ed_3d_strip*>(pNode->pData);
+	G3D::Strip* pDlistStrip = gDlistStripCache.Find(pStrip);
+	if (!pDlistStrip) {
+		return;
+	}
 
-	const G3D::Strip* pRendererStrip = FindStrip(pStrip);
-	assert(pRendererStrip);
+	if (MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire)) {
+		pWriter->ReleaseDlistStrip(pStrip);
+	}
 
-	if (pRendererStrip) {
-		Renderer::SimpleMesh* pSimpleMesh = pRendererStrip->GetSimpleMesh(textureLayerIndex);
-		if (pSimpleMesh) {
-			Renderer::RenderMesh(pSimpleMesh, pNode->header.typeField.flags);
-		}
-		else {
-			MESH_LOG(LogLevel::Error, "Renderer::Kya::MeshLibrary::RenderNode no simple mesh available for rendering layer {}", textureLayerIndex);
-		}
+	gDlistStripCache.Erase(pStrip);
+
+	if (gStripCache.Find(pStrip) == pDlistStrip) {
+		gStripCache.Erase(pStrip);
 	}
-	else {
-		MESH_LOG(LogLevel::Error, "Renderer::Kya::MeshLibrary::RenderNode Strip not found");
+
+	// Readers that found the strip before it left the cache may still be drawing it.
+	gEpoch.Retire([pDlistStrip]() { gDlistStripPool.Release(pDlistStrip); });
+}
+
+void Renderer::Kya::MeshLibrary::ReleaseDlistStrips()
+{
+	for (const std::unique_ptr<G3D::Strip>& pDlistStrip : gDlistStripPool.strips) {
+		if (pDlistStrip->pStrip && gDlistStripCache.Find(pDlistStrip->pStrip) == pDlistStrip.get()) {
+			ReleaseDlistStrip(pDlistStrip->pStrip);
+		}
 	}
 }
 
-void Renderer::Kya::MeshLibrary::CacheDlistStrip(ed_3d_strip* pStrip)
+void Renderer::Kya::MeshLibrary::AddMesh(ed_g3d_manager* pManager, std::string name)
 {
-	if (gObjectCache.find(pStrip) == gObjectCache.end()) {
-		gObjectCache[pStrip] = new Renderer::Kya::G3D::Object();
+	if (MeshTraceWriter* pWriter = gTraceWriter.load(std::memory_order_acquire)) {
+		pWriter->AddMesh(pManager, name);
+	}
+
+	if (gbAsyncIngestion) {
+		gIngestQueue.Enqueue(pManager, std::move(name));
+		return;
 	}
 
-	auto* pObj = gObjectCache[pStrip];
-	pObj->strips.clear();
-	pObj->ProcessStrip(pStrip, 0, 0, 0);
-	pObj->CacheStrips();
+	gMeshLibrary.PublishMesh(G3D(pManager, name, GetDecodePool(), gbLazyDecoding));
 }
 
-void Renderer::Kya::MeshLibrary::AddMesh(ed_g3d_manager* pManager, std::string name)
+Renderer::Kya::MeshLibrary::ReadScope::ReadScope()
+{
+	gEpoch.Enter();
+}
+
+Renderer::Kya::MeshLibrary::ReadScope::~ReadScope()
 {
-	gMeshLibrary.gMeshes.emplace_back(pManager, name);
+	gEpoch.Exit();
 }
 
 const Renderer::Kya::MeshLibrary& Renderer::Kya::GetMeshLibrary()
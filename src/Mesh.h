@@ -1,8 +1,11 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <string>
 #include <functional>
+#include <cstdint>
+#include <atomic>
 
 struct ed_g3d_manager;
 struct ed_g3d_hierarchy;
@@ -14,86 +17,358 @@ struct edNODE;
 
 #include <memory>
 
+#include "CompactMesh.h"
+#include "MeshArena.h"
+#include "MeshBounds.h"
+#include "MeshOptimizer.h"
+
 namespace Renderer
 {
 	struct SimpleMesh;
 
 	namespace Kya 
 	{
+		class ThreadPool;
+
+		// An atomic that can live in a vector element. Copies snapshot the value, which only happens while the tree is
+		// built, never with readers on it.
+		template<typename T>
+		struct CopyableAtomic {
+			CopyableAtomic() = default;
+			CopyableAtomic(T initial) : value(initial) {}
+			CopyableAtomic(const CopyableAtomic& other) : value(other.value.load()) {}
+			CopyableAtomic& operator=(const CopyableAtomic& other) { value = other.value.load(); return *this; }
+
+			std::atomic<T> value = T();
+		};
+
 		class G3D
 		{
 		public:
+			// Shared so identical strips across G3D files can point at one decoded mesh, see MeshLibrary::SetDeduplication.
+			using SimpleMeshPtr = std::shared_ptr<SimpleMesh>;
+
+			// Position of a record in one of the tables below. The tables are filled while the G3D is built and never
+			// reordered after, so an index stays valid for the life of the G3D and, unlike a pointer, survives it moving.
+			using Index = uint32_t;
+			static constexpr Index gInvalidIndex = UINT32_MAX;
+
+			// A run of consecutive records in a table.
+			struct Range {
+				inline Index GetEnd() const { return first + count; }
+
+				Index first = 0;
+				Index count = 0;
+			};
 
 			struct Strip
 			{
-				void PreProcessVertices(int textureLayerIndex, SimpleMesh* pMesh) const;
+				// One entry per GIF section of the strip, gathered in a single walk of the VIF list.
+				struct Section {
+					uint8_t* pGifPkt = nullptr;
+					int vtxCount = 0;
+				};
+
+				// Texture layers a strip can have meshes for, the slots readers look them up in are fixed up front. Layer
+				// counts from the texture layer count function are clamped to it, and GetSimpleMesh asserts and returns
+				// nullptr for any layer past it rather than building it. Raise it if a material ever needs more.
+				static constexpr int gMaxTextureLayers = 8;
+
+				// A mesh to fill from one texture layer of the strip.
+				struct LayerTarget {
+					int textureLayerIndex = 0;
+					SimpleMesh* pMesh = nullptr;
+					uint64_t contentHash = 0;
+
+					// Looked up and registered for sharing. Decided once per decode, so a SetDeduplication call part way
+					// through can't register a mesh that was never meant to be shared.
+					bool bDeduplicate = false;
+				};
+
+				// Reads the sections, hash and bounds of pSourceStrip. The mesh is created later, under meshName, when the
+				// strip is decoded.
+				void Process(ed_3d_strip* pSourceStrip, std::string meshName);
+
+				void IndexSections();
+				uint64_t ComputeContentHash(int textureLayerIndex) const;
+
+				// ComputeContentHash, keeping the base layer's in contentHash the first time it is asked for. Strips are only
+				// hashed when deduplication or the baked strip cache needs it. Called by the claim holder.
+				uint64_t GetContentHash(int textureLayerIndex) const;
+
+				// Hash of the base layer source data alone, the same whatever the decode settings, so it names the strip
+				// from one run to the next. Traces identify strips by it.
+				uint64_t ComputeSourceHash() const;
+
+				// The source streams the decoder reads for every layer below textureLayerCount.
+				struct SourceStreams {
+					const void* pVertices = nullptr;
+					size_t vertexBytes = 0;
+					const void* pNormals = nullptr;
+					size_t normalBytes = 0;
+					const void* pColors = nullptr;
+					size_t colorBytes = 0;
+
+					// From the 16 byte header on.
+					const void* pST = nullptr;
+					size_t stBytes = 0;
+				};
+
+				SourceStreams GetSourceStreams(int textureLayerCount) const;
+
+				// Decodes the strip geometry once and kicks it into every target, each with the ST stream of its own layer.
+				void PreProcessVertices(const LayerTarget* pTargets, int targetCount) const;
+
+				// Runs the optional weld and vertex cache stage on a freshly decoded mesh.
+				void OptimizeDecodedMesh(int textureLayerIndex, SimpleMesh* pMesh) const;
+
+				// Fills the targets the baked strip cache holds, decodes the rest in one pass and bakes the result.
+				void BuildSimpleMeshes(const LayerTarget* pTargets, int targetCount) const;
+
+				// Safe from any number of threads. Layers missing from publishedMeshes are built by whichever reader gets
+				// to them first while the others wait, the mesh stays valid for as long as the caller is in a ReadScope.
+				// Returns nullptr for layers from gMaxTextureLayers up.
 				SimpleMesh* GetSimpleMesh(int textureLayerIndex) const;
 
-				ed_3d_strip* pStrip = nullptr;
-				void* pParent = nullptr;
-				std::unique_ptr<SimpleMesh> pSimpleMesh;
-				mutable std::vector<std::unique_ptr<SimpleMesh>> layerSimpleMeshes;
-			};
+				// Points the layer at a shared mesh when one matches, otherwise fills target with an empty mesh to build.
+				bool AcquireLayerMesh(int textureLayerIndex, bool bDeduplicate, LayerTarget& target) const;
+				SimpleMeshPtr& GetLayerMeshSlot(int textureLayerIndex) const;
+				std::string GetLayerMeshName(int textureLayerIndex) const;
 
-			struct Hierarchy {
-				struct Lod {
-					struct Object {
-						void ProcessStrip(ed_3d_strip* pStrip, const int heirarchyIndex, const int lodIndex, const int stripIndex);
-						void CacheStrips();
-
-						ed_g3d_object* pObject = nullptr;
-						Lod* pParent = nullptr;
-						std::vector<Strip> strips;
+				// Quantized copy of a layer, only kept with MeshLibrary::SetCompactStorage enabled. Null when the layer
+				// isn't stored compact, CompactMesh::GetVertex expands single vertices for callers that want floats. Valid
+				// for as long as the caller is in a ReadScope.
+				const CompactMesh* GetCompactMesh(int textureLayerIndex) const;
+
+				// Swaps a freshly built mesh for its compact copy, returns false if it can't be stored compact.
+				bool CompactSimpleMesh(const LayerTarget& target) const;
+
+				// Rebuilds the float mesh of a compact layer for rendering.
+				void ExpandCompactMesh(int textureLayerIndex) const;
+
+				// Lifecycle of the decoded base mesh. Strips live in vectors, so the atomic is wrapped to stay copyable.
+				struct DecodeState {
+					enum : uint8_t {
+						Pending,
+						Decoding,
+						Ready
 					};
 
-					void ProcessObject(ed_g3d_object* pObject, const int heirarchyIndex, const int lodIndex);
+					DecodeState() = default;
+					DecodeState(const DecodeState& other) : value(other.value.load()) {}
+					DecodeState& operator=(const DecodeState& other) { value = other.value.load(); return *this; }
 
-					ed3DLod* pLod = nullptr;
-					Hierarchy* pParent = nullptr;
-					Object object;
+					std::atomic<uint8_t> value = Pending;
 				};
 
-				void ProcessLod(ed3DLod* pLod, const int heirarchyIndex, const int lodIndex);
+				// Creates the empty base mesh named deferredName, from pArena if given.
+				SimpleMesh* CreateSimpleMesh(MeshArena* pArena) const;
+
+				// Decodes the base mesh unless it already is, waiting if another thread is part way through it. bDeduplicate
+				// stands in for MeshLibrary::SetDeduplication, G3D construction reads it once for all its strips.
+				void EnsureDecoded() const;
+				void EnsureDecoded(bool bDeduplicate) const;
+
+				// Holding the strip in the Decoding state gives a thread sole use of its owning pointers, readers that need
+				// a mesh built wait on it. TryClaim only takes it from the given state, Claim waits out whoever holds it
+				// and returns the state to hand back to Unclaim.
+				bool TryClaim(uint8_t state) const;
+				uint8_t Claim() const;
+				void Unclaim(uint8_t state) const;
 
+				// Copies the owning pointers into publishedMeshes, called by the claim holder before it lets go.
+				void PublishLayerMeshes() const;
+
+				// Unpublishes the decoded base and layer meshes and retires them, GetSimpleMesh decodes them again on next
+				// use. Skips strips a reader is building.
+				void EvictSimpleMeshes() const;
+
+				// Fills bounds from the source positions, so strips can be culled before they are ever decoded.
+				void ComputeBounds();
+
+				ed_3d_strip* pStrip = nullptr;
+				std::vector<Section> sections;
+				int totalVtxCount = 0;
+
+				// Base layer hash, 0 until GetContentHash works it out. Display list strips set it on every recache to spot
+				// unchanged data.
+				mutable uint64_t contentHash = 0;
+
+				// Lod the strip belongs to, gInvalidIndex for cluster and display list strips.
+				Index lodIndex = gInvalidIndex;
+
+				// Display list strips are rebuilt from per frame data. Their meshes, layers included, are plain decodes that
+				// stay out of the baked cache, compact storage, deduplication and the decoded budget.
+				bool bDisplayList = false;
+
+				// In the space of the strip's vertices, which is local to its hierarchy for hierarchy strips.
+				BoundingBox bounds;
+				mutable SimpleMeshPtr pSimpleMesh;
+				mutable std::vector<SimpleMeshPtr> layerSimpleMeshes;
+				mutable std::vector<CompactMesh> compactMeshes;
+
+				// What readers see of the meshes above, only set once a mesh is complete and cleared before it is retired.
+				mutable std::array<CopyableAtomic<SimpleMesh*>, gMaxTextureLayers> publishedMeshes;
+
+				mutable DecodeState decodeState;
+
+				// Name for the base mesh while it is not built, either not decoded yet or evicted.
+				mutable std::string deferredName;
+
+				// Filled when the base mesh goes through the optimisation stage, see MeshLibrary::SetMeshOptimization.
+				mutable MeshOptimizer::Stats optimizeStats;
+
+				// Eviction bookkeeping, see MeshLibrary::SetDecodedBudget.
+				mutable CopyableAtomic<uint32_t> lastUsedFrame;
+				mutable size_t residentBytes = 0;
+
+				// Part of residentBytes held by float meshes expanded from compactMeshes, the first thing eviction drops.
+				mutable size_t expandedBytes = 0;
+
+				// Left unreserved on the float meshes this strip decoded itself, see MeshLibrary::MeshStats::reclaimedBytes.
+				mutable size_t reclaimedBytes = 0;
+
+				// Bit n set once layer n has had a mesh, a shared one found after an eviction isn't a new saving.
+				mutable uint32_t acquiredLayers = 0;
+				static_assert(gMaxTextureLayers <= 32);
+			};
+
+			// Cost and error of a LOD, computed at load for SelectLod.
+			struct LodMetrics {
+				uint32_t vertexCount = 0;
+
+				// Counted as triangle strips, two fewer than the vertices of each section.
+				uint32_t triangleCount = 0;
+
+				// How much longer the LOD's edges are than those of its hierarchy's first LOD, each estimated as the size
+				// of the bounds over the square root of the triangle count. 0 for the first LOD.
+				float geometricError = 0.0f;
+			};
+
+			struct Lod {
+				ed3DLod* pLod = nullptr;
+				ed_g3d_object* pObject = nullptr;
+				Index hierarchyIndex = gInvalidIndex;
+				Range strips;
+
+				// Over the bounds of strips, in the hierarchy's local space.
+				BoundingVolumeHierarchy stripBounds;
+				BoundingBox bounds;
+				LodMetrics metrics;
+
+				// gFrameIndex of the last SelectLod that picked this LOD, 0 if none has.
+				mutable CopyableAtomic<uint32_t> lastSelectedFrame;
+			};
+
+			struct Hierarchy {
 				ed_g3d_hierarchy* pHierarchy = nullptr;
-				G3D* pParent = nullptr;
-				std::vector<Lod> lods;
+
+				// The hierarchy's LODs that have an object, in order, finest first.
+				Range lods;
+
+				// Over every LOD, what SelectLod measures the distance to.
+				BoundingBox bounds;
 			};
 
-			struct Cluster {
-				void ProcessStrip(ed_3d_strip* pStrip, const int stripIndex);
-				void CacheStrips();
+			// Where a hierarchy is seen from, for SelectLod.
+			struct LodViewParams {
+				// In the hierarchy's local space, like its bounds.
+				float cameraPosition[3] = { 0.0f, 0.0f, 0.0f };
+
+				// Pixels per unit at a distance of 1, viewport height / (2 * tan(fovY / 2)) for a perspective projection.
+				float projectionScale = 1.0f;
 
-				void ProcessHierarchy(ed_g3d_hierarchy* pHierarchy, const int heirarchyIndex);
+				// Largest projected geometric error accepted, in pixels.
+				float maxScreenError = 1.0f;
 
+				// Fraction the threshold is loosened by for the previously selected LOD and tightened by for the others,
+				// so a hierarchy sitting near a threshold doesn't flip between two LODs every frame.
+				float hysteresis = 0.1f;
+			};
+
+			struct Cluster {
 				ed_g3d_cluster* pData = nullptr;
-				G3D* pParent = nullptr;
-				std::vector<Strip> strips;
-				std::vector<Hierarchy> hierarchies;
+				Range strips;
+				Range hierarchies;
+
+				// Over the bounds of strips.
+				BoundingVolumeHierarchy stripBounds;
 			};
 
-			using Lod = G3D::Hierarchy::Lod;
-			using Object = G3D::Hierarchy::Lod::Object;
+			// Wall time of each construction phase. stripDecodeMs stays 0 for lazily decoded meshes.
+			struct LoadTimings {
+				double hallMs = 0.0;
+				double cstaMs = 0.0;
+				double stripDecodeMs = 0.0;
+			};
 
-			G3D(ed_g3d_manager* pManager, std::string name);
+			// Builds the strip tree serially, then decodes the strips. If a pool is given the decode is spread across it.
+			// With bLazyDecode only the tree is built and each strip decodes the first time its mesh is requested.
+			G3D(ed_g3d_manager* pManager, std::string name, ThreadPool* pDecodePool = nullptr, bool bLazyDecode = false);
 
 			inline const std::string& GetName() const { return name; }
 			inline ed_g3d_manager* GetManager() const { return pManager; }
+			inline MeshArena& GetArena() { return arena; }
+			inline const MeshArena& GetArena() const { return arena; }
 
+			// Every hierarchy, LOD and strip of the mesh in one flat table each, linked by index. Hierarchies from HALL
+			// come first, then the cluster's. Strips are grouped by LOD in the same order, the cluster strips sit
+			// between the two groups.
 			inline const std::vector<Hierarchy>& GetHierarchies() const { return hierarchies; }
+			inline const std::vector<Lod>& GetLods() const { return lods; }
+			inline const std::vector<Strip>& GetStrips() const { return strips; }
+			inline std::vector<Strip>& GetStrips() { return strips; }
+
+			inline Range GetHallHierarchies() const { return hallHierarchies; }
+			inline const Cluster& GetCluster() const { return cluster; }
+			inline const LoadTimings& GetLoadTimings() const { return loadTimings; }
+
+			// Appends the strips whose bounds reach into the volume. Hierarchy strips are in the hierarchy's local space,
+			// so the volume has to be moved into it. lodIndex counts the hierarchy's LODs, out of range ones find nothing.
+			void QueryHierarchyStrips(const Frustum& frustum, Index hierarchyIndex, int lodIndex, std::vector<const Strip*>& outStrips) const;
+			void QueryHierarchyStrips(const BoundingSphere& sphere, Index hierarchyIndex, int lodIndex, std::vector<const Strip*>& outStrips) const;
+			void QueryClusterStrips(const Frustum& frustum, std::vector<const Strip*>& outStrips) const;
+			void QueryClusterStrips(const BoundingSphere& sphere, std::vector<const Strip*>& outStrips) const;
+
+			// Picks the LOD of a hierarchy with the fewest triangles whose projected error stays within the view's limit,
+			// the finest LOD if none does. Pass the last result back as previousLod for the hysteresis. Returns an index
+			// into the hierarchy's LODs, -1 if it has none. Safe from any number of threads.
+			int SelectLod(Index hierarchyIndex, const LodViewParams& view, int previousLod = -1) const;
+
+			// Registers every strip of this mesh in the strip cache. Done on publish rather than during construction
+			// so meshes can be built away from the thread that renders them.
+			void CacheStrips();
 
 		private:
 			void ProcessHierarchy(ed_g3d_hierarchy* pHierarchy, const int heirarchyIndex);
+			void ProcessLod(ed3DLod* pLod, Index hierarchyRecord, const int heirarchyIndex, const int lodIndex);
+			void ProcessObject(ed_g3d_object* pObject, Index lodRecord, const int heirarchyIndex, const int lodIndex);
+			void ComputeLodMetrics(Index hierarchyRecord);
 			void ProcessHALL();
 
 			void ProcessCluster(ed_g3d_cluster* pCDQUData);
 			void ProcessCSTA();
 
+			// The file name without its path, which strip mesh names start with.
+			std::string GetShortName() const;
+
+			void DecodeStrips(ThreadPool* pDecodePool);
+
 			std::string name;
 			ed_g3d_manager* pManager = nullptr;
 
+			// Base meshes of eager, non-deduplicated builds, see MeshArena for what stays on the heap. Declared ahead of
+			// the tree so everything allocated from it is destroyed first.
+			MeshArena arena;
+
 			std::vector<Hierarchy> hierarchies;
+			std::vector<Lod> lods;
+			std::vector<Strip> strips;
+
+			Range hallHierarchies;
 			Cluster cluster;
+
+			LoadTimings loadTimings;
 		};
 
 		class MeshLibrary
@@ -101,10 +376,124 @@ namespace Renderer
 		public:
 			using ForEachMesh = std::function<void(const G3D&)>;
 
+			// Refers to a published mesh for as long as it stays in the library. A handle to a removed mesh resolves to
+			// nothing, even once its slot holds another mesh.
+			using MeshHandle = uint32_t;
+			static constexpr MeshHandle gInvalidMeshHandle = 0;
+
+			struct DedupStats {
+				uint32_t uniqueMeshes = 0;
+				uint32_t sharedMeshes = 0;
+				uint64_t bytesSaved = 0;
+			};
+
+			struct MeshStats {
+				std::string name;
+				G3D::LoadTimings timings;
+
+				uint32_t stripCount = 0;
+				uint32_t decodedStripCount = 0;
+				uint32_t clusterStripCount = 0;
+
+				// Strips in each LOD, summed over the hierarchies and cluster hierarchies.
+				std::vector<uint32_t> stripsPerLod;
+
+				// Base meshes only, layers share their geometry.
+				uint64_t vertexCount = 0;
+				uint64_t indexCount = 0;
+
+				// Bytes of the meshes the strips point at, shared meshes included. residentBytes only counts what the
+				// strips own, meshes registered for sharing are counted once in MeshLibrary::GetDecodedBytes instead.
+				size_t baseMeshBytes = 0;
+				size_t layerMeshBytes = 0;
+				size_t compactBytes = 0;
+				size_t residentBytes = 0;
+
+				// Left unreserved by sizing the float meshes exactly, against twice and four times the strip's vertex
+				// count for vertices and indices. Only meshes a strip decoded and kept as floats count, shared, baked and
+				// compact expanded meshes never had the reservation.
+				size_t reclaimedBytes = 0;
+			};
+
+			// Library wide, since the last ResetCounters.
+			struct Counters {
+				uint64_t findStripHits = 0;
+				uint64_t findStripMisses = 0;
+				uint64_t stripDecodes = 0;
+				double stripDecodeMs = 0.0;
+				uint64_t lazyLayerBuilds = 0;
+				uint64_t compactExpansions = 0;
+				uint64_t dlistRecaches = 0;
+				uint64_t dlistUnchanged = 0;
+
+				// Decoded vertices that differ from the scalar reference, only counted with SetDecodeValidation.
+				uint64_t decodeMismatches = 0;
+
+				// Strips whose assembled buffers differ from Renderer::KickVertex, only counted with SetDecodeValidation.
+				uint64_t assemblyMismatches = 0;
+			};
+
+			// Pins the calling thread for the lifetime of the scope, see the concurrent reads note below.
+			class ReadScope
+			{
+			public:
+				ReadScope();
+				~ReadScope();
+
+				ReadScope(const ReadScope&) = delete;
+				ReadScope& operator=(const ReadScope&) = delete;
+			};
+
+			enum class LoadState {
+				Unknown,
+				Queued,
+				Building,
+				// Built on the worker, waiting for Update to publish it.
+				Built,
+				Ready
+			};
+
 			static void Init();
+
+			// Concurrent reads: RenderNode, RenderNodes, FindStrip and G3D::Strip::GetSimpleMesh may be called from any
+			// number of render threads while one writer thread makes every other call. Lookups take no lock. Writers
+			// unlink what they replace and retire it, it is freed once every thread that could have seen it has left its
+			// ReadScope. RenderNode and RenderNodes open their own scope, callers holding on to a strip or mesh from
+			// FindStrip need one around the whole use. Retired memory is handed back on Update and as it piles up.
+
+			// Decode the strips of newly added meshes across a shared thread pool.
+			static void SetParallelConstruction(bool bEnabled);
+
+			// When enabled AddMesh only queues the manager and a background worker builds the G3D.
+			// Finished meshes are published into the library by Update, which should be called once per frame
+			// from the thread that renders. Until then RenderNode skips their strips.
+			static void SetAsyncIngestion(bool bEnabled);
+			void Update();
+			LoadState GetLoadState(const ed_g3d_manager* pManager) const;
+
+			// Persistent cache of decoded strip buffers, strips found in it skip PreProcessVertices entirely.
+			// Open returns whether an existing cache file was mapped, new strips are baked and written out by Save either way.
+			static bool OpenBakedStripCache(const std::string& path);
+			static bool SaveBakedStripCache();
+
+			// Records AddMesh, RemoveMesh, Update, CacheDlistStrip, ReleaseDlistStrip, RenderNode and RenderNodes to a
+			// binary trace for MeshReplay, see MeshTrace.h. Calls from several render threads go out in the order they
+			// reach the trace. Starting a trace stops the one already running.
+			static bool StartTrace(const std::string& path);
+			static void StopTrace();
+
 			void RenderNode(const edNODE* pNode, int textureLayerIndex = 0) const;
+
+			// Resolves every node up front, then submits them grouped by PRIM, node flags and mesh so draws sharing
+			// state go out back to back. The nodes must share the render state set up by the caller since they are reordered.
+			void RenderNodes(const edNODE* const* ppNodes, size_t nodeCount, int textureLayerIndex = 0) const;
+			// Decodes a display list strip, skipping the decode when its source data hashes the same as last time.
 			void CacheDlistStrip(ed_3d_strip* pStrip);
 
+			// Hands a dlist strip's object back to the pool, its mesh is reused by the next dlist strip cached.
+			static void ReleaseDlistStrip(ed_3d_strip* pStrip);
+			static void ReleaseDlistStrips();
+
 			// Debug
 			inline void ForEach(ForEachMesh func) const
 			{
@@ -116,13 +505,94 @@ namespace Renderer
 
 			inline int GetMeshCount() const { return gMeshes.size(); }
 
-			inline void Clear() { gMeshes.clear(); }
+			MeshHandle FindMesh(const ed_g3d_manager* pManager) const;
+
+			// Null for a stale or invalid handle. The G3D may move when other meshes are removed, so hold the handle
+			// rather than the pointer.
+			const G3D* GetMesh(MeshHandle handle) const;
+
+			void Clear();
+
+			// Drops the G3D built for pManager along with its strip cache entries and layer meshes.
+			// A mesh still queued for async ingestion is cancelled.
+			static void RemoveMesh(ed_g3d_manager* pManager);
+
+			// Whether SelectLod picked the LOD within the last frameWindow calls to Update.
+			static bool WasLodSelected(const G3D::Lod& lod, uint32_t frameWindow);
+
+			// Evicts the decoded meshes of every LOD SelectLod hasn't picked within the last frameWindow calls to Update.
+			// LODs that were never picked are evicted too, with lazy decoding they are simply never decoded.
+			void EvictUnselectedLods(uint32_t frameWindow);
+
+			// Caps the bytes held by decoded strip meshes, 0 for no limit. Update evicts the least recently
+			// rendered strips until under budget, keeping their tree so RenderNode can decode them again.
+			static void SetDecodedBudget(size_t budgetBytes);
+			static size_t GetDecodedBytes();
+
+			// When enabled decoded strips have identical vertices welded and their triangles reordered for the
+			// post transform cache. The ACMR before and after is kept on each strip.
+			static void SetMeshOptimization(bool bEnabled);
+
+			// When enabled strips (and layer meshes) whose source data hashes the same share one decoded SimpleMesh,
+			// even across G3D files. Shared meshes are heap allocated since they can outlive the G3D that decoded them.
+			// Their bytes count towards the decoded budget once, until the last strip holding them is evicted or removed.
+			// DedupStats only counts a saving when a strip layer's first mesh is a shared one.
+			static void SetDeduplication(bool bEnabled);
+			static DedupStats GetDedupStats();
+
+			// Walks the published meshes, cheap enough to poll but not meant for every frame.
+			std::vector<MeshStats> GetMeshStats() const;
+
+			static Counters GetCounters();
+			static void ResetCounters();
+
+			// When enabled every decoded section is checked against the scalar reference decode and the vertices that
+			// differ are counted in Counters::decodeMismatches. Each strip is also kicked through Renderer::KickVertex one
+			// vertex at a time and compared with the assembled buffers, counted in Counters::assemblyMismatches. Slow,
+			// meant for MeshBench --validate and bisecting. On from the start when built with ValidateDecode.
+			static void SetDecodeValidation(bool bEnabled);
+
+			// When enabled decoded strips are kept quantized, under half the size of the float vertices. Float meshes are
+			// expanded from them when drawn and evicted ahead of the compact copies under the decoded budget.
+			static void SetCompactStorage(bool bEnabled);
+
+			// Reports how many texture layers the material of a strip has. When set, every layer is built alongside the
+			// base mesh instead of on first use in RenderNode. Set it before adding meshes, decode threads call it.
+			using TextureLayerCountFunc = std::function<int(const ed_3d_strip*)>;
+			static void SetTextureLayerCountFunc(TextureLayerCountFunc func);
+
+			// When enabled new meshes only record their strip tree, strips decode on first use by RenderNode.
+			static void SetLazyDecoding(bool bEnabled);
+
+			// Decodes ahead of time on the background worker. Bit n of lodMask selects LOD n of every hierarchy,
+			// bit 0 also covers the cluster strips which have no LODs.
+			static void Prefetch(const G3D& mesh, uint32_t lodMask);
 
 			const G3D::Strip* FindStrip(const ed_3d_strip* pStrip) const;
 			static void AddMesh(ed_g3d_manager* pManager, std::string name);
 		private:
+			SimpleMesh* ResolveNode(const edNODE* pNode, int textureLayerIndex) const;
+			MeshHandle PublishMesh(G3D&& mesh);
+			void EnforceDecodedBudget();
+
+			// Swaps the last mesh into the hole, so gMeshes stays dense.
+			void EraseMesh(uint32_t meshIndex);
+
+			// A handle is a slot index in its low gMeshSlotBits and the slot's generation above them. Slots are reused,
+			// the generation is bumped on every removal so stale handles stop matching.
+			struct MeshSlot {
+				uint32_t meshIndex = 0;
+				uint32_t generation = 1;
+			};
+
+			static constexpr uint32_t gMeshSlotBits = 20;
+			static constexpr uint32_t gMeshSlotMask = (1u << gMeshSlotBits) - 1;
 
+			// Published meshes, packed. meshSlotIndices holds the slot of each.
 			std::vector<G3D> gMeshes;
+			std::vector<uint32_t> meshSlotIndices;
+			std::vector<MeshSlot> meshSlots;
+			std::vector<uint32_t> freeMeshSlots;
 		};
 
 		const MeshLibrary& GetMeshLibrary();
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Bump allocator owned by a G3D, its blocks are handed back together when the G3D goes away rather than one heap
+		// free per object. Only the base SimpleMesh objects (and their shared_ptr control blocks) that an eager,
+		// non-deduplicated build creates up front live here. Vertex and index storage is allocated by the renderer's
+		// VertexBufferData::Init and stays on the heap, as do meshes created later: lazy decodes, rebuilds after
+		// eviction, texture layers, deduplicated meshes that may outlive the G3D and display list strips.
+		// Not thread safe, allocate while building the tree and not from the decode workers.
+		class MeshArena
+		{
+		public:
+			static constexpr size_t gDefaultBlockSize = 64 * 1024;
+
+			explicit MeshArena(size_t blockSize = gDefaultBlockSize)
+				: blockSize(blockSize)
+			{
+			}
+
+			MeshArena(MeshArena&&) = default;
+			MeshArena& operator=(MeshArena&&) = default;
+
+			void* Allocate(size_t size, size_t alignment)
+			{
+				uintptr_t aligned = (current + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+
+				if (blocks.empty() || aligned + size > end) {
+					const size_t newBlockSize = size + alignment > blockSize ? size + alignment : blockSize;
+					blocks.emplace_back(new uint8_t[newBlockSize]);
+					current = reinterpret_cast<uintptr_t>(blocks.back().get());
+					end = current + newBlockSize;
+					reservedBytes += newBlockSize;
+
+					aligned = (current + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+				}
+
+				current = aligned + size;
+				usedBytes += size;
+				return reinterpret_cast<void*>(aligned);
+			}
+
+			template<typename T, typename... Args>
+			T* New(Args&&... args)
+			{
+				return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			}
+
+			inline size_t GetUsedBytes() const { return usedBytes; }
+			inline size_t GetReservedBytes() const { return reservedBytes; }
+			inline size_t GetBlockCount() const { return blocks.size(); }
+
+		private:
+			size_t blockSize = gDefaultBlockSize;
+			std::vector<std::unique_ptr<uint8_t[]>> blocks;
+			uintptr_t current = 0;
+			uintptr_t end = 0;
+			size_t usedBytes = 0;
+			size_t reservedBytes = 0;
+		};
+
+		// Standard allocator over a MeshArena, frees are no-ops. Used for shared_ptr control blocks of arena objects.
+		template<typename T>
+		struct ArenaAllocator
+		{
+			using value_type = T;
+
+			explicit ArenaAllocator(MeshArena& arena)
+				: pArena(&arena)
+			{
+			}
+
+			template<typename U>
+			ArenaAllocator(const ArenaAllocator<U>& other)
+				: pArena(other.pArena)
+			{
+			}
+
+			T* allocate(size_t count) { return static_cast<T*>(pArena->Allocate(count * sizeof(T), alignof(T))); }
+			void deallocate(T*, size_t) {}
+
+			template<typename U>
+			bool operator==(const ArenaAllocator<U>& other) const { return pArena == other.pArena; }
+
+			template<typename U>
+			bool operator!=(const ArenaAllocator<U>& other) const { return pArena != other.pArena; }
+
+			MeshArena* pArena;
+		};
+
+		// Deleter for objects that may live in a MeshArena. Arena objects are only destroyed, their memory goes with the arena.
+		template<typename T>
+		struct ArenaDeleter
+		{
+			bool bArenaOwned = false;
+
+			void operator()(T* pObject) const
+			{
+				if (bArenaOwned) {
+					pObject->~T();
+				}
+				else {
+					delete pObject;
+				}
+			}
+		};
+	}
+}
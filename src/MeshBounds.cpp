@@ -0,0 +1,234 @@
+#include "MeshBounds.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+Renderer::Kya::BoundingSphere Renderer::Kya::BoundingSphere::FromBox(const BoundingBox& box)
+{
+	BoundingSphere sphere;
+
+	if (box.IsEmpty()) {
+		return sphere;
+	}
+
+	float radiusSquared = 0.0f;
+
+	for (int axis = 0; axis < 3; axis++) {
+		sphere.center[axis] = (box.min[axis] + box.max[axis]) * 0.5f;
+
+		const float halfExtent = box.max[axis] - sphere.center[axis];
+		radiusSquared += halfExtent * halfExtent;
+	}
+
+	sphere.radius = std::sqrt(radiusSquared);
+	return sphere;
+}
+
+Renderer::Kya::Frustum Renderer::Kya::Frustum::FromViewProjection(const float matrix[4][4])
+{
+	// With clip = p * matrix, column c of the matrix gives clip component c. Each plane is w plus or minus one of x, y, z.
+	Frustum frustum;
+
+	for (int axis = 0; axis < 3; axis++) {
+		for (int i = 0; i < 4; i++) {
+			frustum.planes[axis * 2 + 0][i] = matrix[i][3] + matrix[i][axis];
+			frustum.planes[axis * 2 + 1][i] = matrix[i][3] - matrix[i][axis];
+		}
+	}
+
+	return frustum;
+}
+
+Renderer::Kya::Containment Renderer::Kya::TestFrustum(const Frustum& frustum, const BoundingBox& box)
+{
+	if (box.IsEmpty()) {
+		return Containment::Outside;
+	}
+
+	Containment result = Containment::Inside;
+
+	for (const float* pPlane : frustum.planes) {
+		// The box corners furthest along and against the plane normal.
+		float nearest = pPlane[3];
+		float furthest = pPlane[3];
+
+		for (int axis = 0; axis < 3; axis++) {
+			const float low = pPlane[axis] * box.min[axis];
+			const float high = pPlane[axis] * box.max[axis];
+			furthest += std::max(low, high);
+			nearest += std::min(low, high);
+		}
+
+		if (furthest < 0.0f) {
+			return Containment::Outside;
+		}
+
+		if (nearest < 0.0f) {
+			result = Containment::Intersects;
+		}
+	}
+
+	return result;
+}
+
+Renderer::Kya::Containment Renderer::Kya::TestSphere(const BoundingSphere& sphere, const BoundingBox& box)
+{
+	if (box.IsEmpty()) {
+		return Containment::Outside;
+	}
+
+	float nearestSquared = 0.0f;
+	float furthestSquared = 0.0f;
+
+	for (int axis = 0; axis < 3; axis++) {
+		const float belowMin = box.min[axis] - sphere.center[axis];
+		const float aboveMax = sphere.center[axis] - box.max[axis];
+
+		const float nearest = std::max(std::max(belowMin, aboveMax), 0.0f);
+		const float furthest = std::max(std::abs(belowMin), std::abs(aboveMax));
+
+		nearestSquared += nearest * nearest;
+		furthestSquared += furthest * furthest;
+	}
+
+	const float radiusSquared = sphere.radius * sphere.radius;
+
+	if (nearestSquared > radiusSquared) {
+		return Containment::Outside;
+	}
+
+	return furthestSquared <= radiusSquared ? Containment::Inside : Containment::Intersects;
+}
+
+void Renderer::Kya::BoundingVolumeHierarchy::Build(const std::vector<BoundingBox>& itemBounds)
+{
+	nodes.clear();
+	sortedBounds.clear();
+	itemIndices.clear();
+
+	// Empty boxes can't be hit, leaving them out keeps them from coming back with a subtree taken whole.
+	for (uint32_t i = 0; i < itemBounds.size(); i++) {
+		if (!itemBounds[i].IsEmpty()) {
+			itemIndices.push_back(i);
+		}
+	}
+
+	if (itemIndices.empty()) {
+		return;
+	}
+
+	// A binary tree with leaves of at least half gMaxLeafItems stays under this many nodes.
+	nodes.reserve(itemIndices.size() * 2);
+	BuildNode(itemBounds, 0, static_cast<uint32_t>(itemIndices.size()));
+
+	sortedBounds.reserve(itemIndices.size());
+	for (uint32_t itemIndex : itemIndices) {
+		sortedBounds.push_back(itemBounds[itemIndex]);
+	}
+}
+
+uint32_t Renderer::Kya::BoundingVolumeHierarchy::BuildNode(const std::vector<BoundingBox>& itemBounds, uint32_t firstItem, uint32_t itemCount)
+{
+	const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	BoundingBox bounds;
+	BoundingBox centroidBounds;
+
+	for (uint32_t i = firstItem; i < firstItem + itemCount; i++) {
+		const BoundingBox& item = itemBounds[itemIndices[i]];
+		bounds.Extend(item);
+
+		const float centroid[3] = { (item.min[0] + item.max[0]) * 0.5f, (item.min[1] + item.max[1]) * 0.5f, (item.min[2] + item.max[2]) * 0.5f };
+		centroidBounds.Extend(centroid);
+	}
+
+	nodes[nodeIndex].bounds = bounds;
+	nodes[nodeIndex].firstItem = firstItem;
+	nodes[nodeIndex].itemCount = itemCount;
+
+	if (itemCount <= gMaxLeafItems) {
+		return nodeIndex;
+	}
+
+	int splitAxis = 0;
+	for (int axis = 1; axis < 3; axis++) {
+		if (centroidBounds.max[axis] - centroidBounds.min[axis] > centroidBounds.max[splitAxis] - centroidBounds.min[splitAxis]) {
+			splitAxis = axis;
+		}
+	}
+
+	if (centroidBounds.max[splitAxis] <= centroidBounds.min[splitAxis]) {
+		// Every centroid in the same place, no split separates them.
+		return nodeIndex;
+	}
+
+	// Median split on the longest centroid axis keeps the tree balanced, which is what bounds the query depth.
+	auto first = itemIndices.begin() + firstItem;
+	auto middle = first + (itemCount / 2);
+
+	std::nth_element(first, middle, first + itemCount, [&itemBounds, splitAxis](uint32_t a, uint32_t b) {
+		return itemBounds[a].min[splitAxis] + itemBounds[a].max[splitAxis] < itemBounds[b].min[splitAxis] + itemBounds[b].max[splitAxis];
+	});
+
+	const uint32_t firstCount = itemCount / 2;
+
+	BuildNode(itemBounds, firstItem, firstCount);
+	const uint32_t secondChild = BuildNode(itemBounds, firstItem + firstCount, itemCount - firstCount);
+	nodes[nodeIndex].secondChild = secondChild;
+
+	return nodeIndex;
+}
+
+template<typename Test>
+void Renderer::Kya::BoundingVolumeHierarchy::Query(const Test& test, std::vector<uint32_t>& outItems) const
+{
+	if (nodes.empty()) {
+		return;
+	}
+
+	// Median splits keep the depth near log2 of the item count, far below this.
+	uint32_t stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = nodes[stack[--stackSize]];
+		const Containment containment = test(node.bounds);
+
+		if (containment == Containment::Outside) {
+			continue;
+		}
+
+		if (containment == Containment::Inside) {
+			outItems.insert(outItems.end(), itemIndices.begin() + node.firstItem, itemIndices.begin() + node.firstItem + node.itemCount);
+			continue;
+		}
+
+		if (node.secondChild == 0) {
+			for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; i++) {
+				if (test(sortedBounds[i]) != Containment::Outside) {
+					outItems.push_back(itemIndices[i]);
+				}
+			}
+
+			continue;
+		}
+
+		assert(stackSize + 2 <= 64);
+		const uint32_t nodeIndex = static_cast<uint32_t>(&node - nodes.data());
+		stack[stackSize++] = node.secondChild;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+}
+
+void Renderer::Kya::BoundingVolumeHierarchy::QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& outItems) const
+{
+	Query([&frustum](const BoundingBox& bounds) { return TestFrustum(frustum, bounds); }, outItems);
+}
+
+void Renderer::Kya::BoundingVolumeHierarchy::QuerySphere(const BoundingSphere& sphere, std::vector<uint32_t>& outItems) const
+{
+	Query([&sphere](const BoundingBox& bounds) { return TestSphere(sphere, bounds); }, outItems);
+}
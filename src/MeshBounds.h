@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		struct BoundingBox {
+			void Extend(const float point[3])
+			{
+				for (int axis = 0; axis < 3; axis++) {
+					min[axis] = point[axis] < min[axis] ? point[axis] : min[axis];
+					max[axis] = point[axis] > max[axis] ? point[axis] : max[axis];
+				}
+			}
+
+			void Extend(const BoundingBox& other)
+			{
+				if (other.IsEmpty()) {
+					return;
+				}
+
+				Extend(other.min);
+				Extend(other.max);
+			}
+
+			inline bool IsEmpty() const { return min[0] > max[0]; }
+
+			float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+			float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		};
+
+		struct BoundingSphere {
+			// Encloses the box, centred on it.
+			static BoundingSphere FromBox(const BoundingBox& box);
+
+			float center[3] = { 0.0f, 0.0f, 0.0f };
+			float radius = 0.0f;
+		};
+
+		// Six planes with normals facing in, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them.
+		struct Frustum {
+			// Extracts the planes of a view projection matrix in the row vector convention of edF32MATRIX4, so
+			// clip = p * matrix with -w <= x, y, z <= w inside. The planes are in whatever space p is in.
+			static Frustum FromViewProjection(const float matrix[4][4]);
+
+			float planes[6][4] = {};
+		};
+
+		enum class Containment {
+			Outside,
+			Intersects,
+			Inside
+		};
+
+		// Empty boxes are always outside.
+		Containment TestFrustum(const Frustum& frustum, const BoundingBox& box);
+		Containment TestSphere(const BoundingSphere& sphere, const BoundingBox& box);
+
+		// Bounding volume hierarchy over a fixed set of boxes, queries return the indices the boxes were given in.
+		// Subtrees fully inside the query volume are taken whole without testing their children.
+		class BoundingVolumeHierarchy
+		{
+		public:
+			void Build(const std::vector<BoundingBox>& itemBounds);
+
+			// Appends to outItems, which is not cleared.
+			void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& outItems) const;
+			void QuerySphere(const BoundingSphere& sphere, std::vector<uint32_t>& outItems) const;
+
+			inline bool IsEmpty() const { return nodes.empty(); }
+			inline const BoundingBox& GetBounds() const { return nodes.front().bounds; }
+			inline size_t GetNodeCount() const { return nodes.size(); }
+
+		private:
+			// Every node covers the contiguous run [firstItem, firstItem + itemCount) of itemIndices. The first child of
+			// an inner node follows it, secondChild is 0 for leaves.
+			struct Node {
+				BoundingBox bounds;
+				uint32_t firstItem = 0;
+				uint32_t itemCount = 0;
+				uint32_t secondChild = 0;
+			};
+
+			static constexpr uint32_t gMaxLeafItems = 4;
+
+			uint32_t BuildNode(const std::vector<BoundingBox>& itemBounds, uint32_t firstItem, uint32_t itemCount);
+
+			template<typename Test>
+			void Query(const Test& test, std::vector<uint32_t>& outItems) const;
+
+			std::vector<Node> nodes;
+			std::vector<uint32_t> itemIndices;
+
+			// Bounds of the items in itemIndices order, for testing the items of leaves the query only intersects.
+			std::vector<BoundingBox> sortedBounds;
+		};
+	}
+}
@@ -0,0 +1,139 @@
+#include "MeshEpoch.h"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+
+// The slot a thread pins through, taken on its first Enter and handed back when the thread exits.
+struct Renderer::Kya::EpochDomain::ThreadReader {
+	~ThreadReader()
+	{
+		if (pSlot) {
+			assert(depth == 0);
+			pSlot->bInUse.store(false, std::memory_order_release);
+		}
+	}
+
+	EpochDomain* pDomain = nullptr;
+	ReaderSlot* pSlot = nullptr;
+	int depth = 0;
+};
+
+Renderer::Kya::EpochDomain::~EpochDomain()
+{
+	for (Retired& entry : retired) {
+		entry.reclaim();
+	}
+}
+
+Renderer::Kya::EpochDomain::ReaderSlot* Renderer::Kya::EpochDomain::AcquireSlot()
+{
+	while (true) {
+		for (ReaderSlot& slot : readers) {
+			bool bExpected = false;
+			if (!slot.bInUse.load(std::memory_order_relaxed) && slot.bInUse.compare_exchange_strong(bExpected, true, std::memory_order_acquire)) {
+				return &slot;
+			}
+		}
+
+		// More reading threads than slots, wait for one to exit.
+		assert(false);
+		std::this_thread::yield();
+	}
+}
+
+Renderer::Kya::EpochDomain::ThreadReader& Renderer::Kya::EpochDomain::GetThreadReader()
+{
+	thread_local ThreadReader reader;
+	return reader;
+}
+
+void Renderer::Kya::EpochDomain::Enter()
+{
+	ThreadReader& reader = GetThreadReader();
+
+	if (reader.depth++ > 0) {
+		return;
+	}
+
+	if (!reader.pSlot) {
+		reader.pDomain = this;
+		reader.pSlot = AcquireSlot();
+	}
+
+	assert(reader.pDomain == this);
+
+	// Released so a writer that sees the new epoch also sees everything this thread did while last pinned.
+	reader.pSlot->epoch.store(globalEpoch.load(std::memory_order_seq_cst), std::memory_order_release);
+
+	// Pointer loads after this must not move above the pin, or a writer could miss this reader.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void Renderer::Kya::EpochDomain::Exit()
+{
+	ThreadReader& reader = GetThreadReader();
+	assert(reader.depth > 0);
+
+	if (--reader.depth == 0) {
+		reader.pSlot->epoch.store(0, std::memory_order_release);
+	}
+}
+
+void Renderer::Kya::EpochDomain::Retire(Reclaimer reclaim)
+{
+	size_t retiredCount = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(retiredMutex);
+
+		// The object is already unlinked, readers pinning from the next epoch on can't reach it.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		retired.push_back({ globalEpoch.fetch_add(1, std::memory_order_seq_cst), std::move(reclaim) });
+		retiredCount = retired.size();
+	}
+
+	if (retiredCount >= gReclaimThreshold) {
+		Reclaim();
+	}
+}
+
+void Renderer::Kya::EpochDomain::Reclaim()
+{
+	std::vector<Retired> due;
+
+	{
+		std::lock_guard<std::mutex> lock(retiredMutex);
+
+		if (retired.empty()) {
+			return;
+		}
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		uint64_t oldestPinned = UINT64_MAX;
+		for (const ReaderSlot& slot : readers) {
+			const uint64_t epoch = slot.epoch.load(std::memory_order_acquire);
+			if (epoch != 0) {
+				oldestPinned = std::min(oldestPinned, epoch);
+			}
+		}
+
+		// Retired in epoch order, so everything reclaimable is at the front.
+		auto firstKept = std::find_if(retired.begin(), retired.end(), [oldestPinned](const Retired& entry) { return entry.epoch >= oldestPinned; });
+
+		due.assign(std::make_move_iterator(retired.begin()), std::make_move_iterator(firstKept));
+		retired.erase(retired.begin(), firstKept);
+	}
+
+	// Outside the lock, a reclaimer is free to retire something else.
+	for (Retired& entry : due) {
+		entry.reclaim();
+	}
+}
+
+size_t Renderer::Kya::EpochDomain::GetRetiredCount() const
+{
+	std::lock_guard<std::mutex> lock(retiredMutex);
+	return retired.size();
+}
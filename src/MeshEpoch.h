@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Epoch based reclamation for the structures render threads read without locks. Readers pin the current
+		// epoch while they hold pointers into the library, writers unlink what they replace and retire it, and a
+		// retired object is only reclaimed once every reader pinned at or before its epoch has left.
+		// Readers never block or take a lock, Retire and Reclaim take one and belong to writers.
+		class EpochDomain
+		{
+		public:
+			using Reclaimer = std::function<void()>;
+
+			// Threads that can be pinned at the same time, a thread holds its slot until it exits.
+			static constexpr size_t gMaxReaders = 64;
+
+			EpochDomain() = default;
+
+			// Runs everything still retired, nothing may be pinned by then.
+			~EpochDomain();
+
+			EpochDomain(const EpochDomain&) = delete;
+			EpochDomain& operator=(const EpochDomain&) = delete;
+
+			// Pins the calling thread, nests. Every thread must only ever pin the one domain.
+			void Enter();
+			void Exit();
+
+			// reclaim runs on a later Retire or Reclaim call, once no reader can still see what it frees.
+			void Retire(Reclaimer reclaim);
+			void Reclaim();
+
+			size_t GetRetiredCount() const;
+
+			class ReadScope
+			{
+			public:
+				explicit ReadScope(EpochDomain& domain)
+					: domain(domain)
+				{
+					domain.Enter();
+				}
+
+				~ReadScope()
+				{
+					domain.Exit();
+				}
+
+				ReadScope(const ReadScope&) = delete;
+				ReadScope& operator=(const ReadScope&) = delete;
+
+			private:
+				EpochDomain& domain;
+			};
+
+		private:
+			struct alignas(64) ReaderSlot {
+				// Epoch the reader pinned, 0 while it isn't reading.
+				std::atomic<uint64_t> epoch = 0;
+				std::atomic<bool> bInUse = false;
+			};
+
+			struct Retired {
+				uint64_t epoch;
+				Reclaimer reclaim;
+			};
+
+			struct ThreadReader;
+
+			static ThreadReader& GetThreadReader();
+			ReaderSlot* AcquireSlot();
+
+			// Retire calls Reclaim itself past this many, so the list stays short without a per frame call.
+			static constexpr size_t gReclaimThreshold = 64;
+
+			ReaderSlot readers[gMaxReaders];
+			std::atomic<uint64_t> globalEpoch = 1;
+
+			mutable std::mutex retiredMutex;
+			std::vector<Retired> retired;
+		};
+	}
+}
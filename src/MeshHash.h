@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		inline uint64_t MixHash(uint64_t value)
+		{
+			value ^= value >> 33;
+			value *= 0xff51afd7ed558ccdull;
+			value ^= value >> 33;
+			value *= 0xc4ceb9fe1a85ec53ull;
+			value ^= value >> 33;
+			return value;
+		}
+
+		// Fast non cryptographic hash over raw bytes, used to key strip content and weld vertices.
+		inline uint64_t HashBytes(const void* pData, size_t size, uint64_t seed)
+		{
+			constexpr uint64_t prime = 0x9e3779b97f4a7c15ull;
+
+			const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(pData);
+			uint64_t hash = seed ^ (size * prime);
+
+			for (; size >= 8; size -= 8, pBytes += 8) {
+				uint64_t value;
+				memcpy(&value, pBytes, sizeof(value));
+				hash = (hash ^ MixHash(value)) * prime;
+			}
+
+			uint64_t tail = 0;
+			memcpy(&tail, pBytes, size);
+			return MixHash(hash ^ MixHash(tail));
+		}
+	}
+}
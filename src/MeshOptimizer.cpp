@@ -0,0 +1,291 @@
+#include "MeshOptimizer.h"
+#include "MeshHash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		namespace MeshOptimizer
+		{
+			constexpr uint32_t gUnused = 0xffffffff;
+
+			// Scoring constants from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+			constexpr float gCacheDecayPower = 1.5f;
+			constexpr float gLastTriScore = 0.75f;
+			constexpr float gValenceBoostScale = 2.0f;
+			constexpr float gValenceBoostPower = 0.5f;
+
+			static float GetVertexScore(int cachePosition, uint32_t activeTriangles, uint32_t cacheSize)
+			{
+				if (activeTriangles == 0) {
+					return -1.0f;
+				}
+
+				float score = 0.0f;
+
+				if (cachePosition >= 0) {
+					if (cachePosition < 3) {
+						// The last triangle's vertices are scored flat so it isn't simply repeated.
+						score = gLastTriScore;
+					}
+					else {
+						const float scaler = 1.0f / static_cast<float>(cacheSize - 3);
+						score = powf(1.0f - (static_cast<float>(cachePosition - 3) * scaler), gCacheDecayPower);
+					}
+				}
+
+				// Favour vertices with few triangles left so they get finished off and stop occupying the cache.
+				score += gValenceBoostScale * powf(static_cast<float>(activeTriangles), -gValenceBoostPower);
+				return score;
+			}
+		}
+	}
+}
+
+float Renderer::Kya::MeshOptimizer::ComputeAcmr(const uint32_t* pIndices, size_t indexCount, uint32_t cacheSize)
+{
+	if (indexCount < 3) {
+		return 0.0f;
+	}
+
+	std::vector<uint32_t> fifo(cacheSize, gUnused);
+	size_t head = 0;
+	uint32_t misses = 0;
+
+	for (size_t i = 0; i < indexCount; i++) {
+		const uint32_t index = pIndices[i];
+
+		if (std::find(fifo.begin(), fifo.end(), index) == fifo.end()) {
+			fifo[head] = index;
+			head = (head + 1) % cacheSize;
+			misses++;
+		}
+	}
+
+	return static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+}
+
+uint32_t Renderer::Kya::MeshOptimizer::WeldVertices(void* pVertices, size_t vertexStride, uint32_t vertexCount, uint32_t* pIndices, size_t indexCount)
+{
+	uint8_t* const pBytes = reinterpret_cast<uint8_t*>(pVertices);
+
+	size_t tableSize = 16;
+	while (tableSize < vertexCount * 2) {
+		tableSize *= 2;
+	}
+
+	// Open addressing over vertex indices, holds the first copy of each distinct vertex.
+	std::vector<uint32_t> table(tableSize, gUnused);
+	std::vector<uint32_t> remap(vertexCount);
+
+	uint32_t weldedCount = 0;
+
+	for (uint32_t i = 0; i < vertexCount; i++) {
+		const uint8_t* pVertex = pBytes + (i * vertexStride);
+		size_t slot = HashBytes(pVertex, vertexStride, 0) & (tableSize - 1);
+
+		while (table[slot] != gUnused && memcmp(pBytes + (table[slot] * vertexStride), pVertex, vertexStride) != 0) {
+			slot = (slot + 1) & (tableSize - 1);
+		}
+
+		if (table[slot] == gUnused) {
+			// Compacting in place is safe, the destination is never ahead of the vertex being read.
+			if (weldedCount != i) {
+				memcpy(pBytes + (weldedCount * vertexStride), pVertex, vertexStride);
+			}
+
+			table[slot] = weldedCount;
+			weldedCount++;
+		}
+
+		remap[i] = table[slot];
+	}
+
+	for (size_t i = 0; i < indexCount; i++) {
+		pIndices[i] = remap[pIndices[i]];
+	}
+
+	return weldedCount;
+}
+
+void Renderer::Kya::MeshOptimizer::OptimizeVertexCache(uint32_t* pIndices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+	const size_t triangleCount = indexCount / 3;
+
+	if (triangleCount < 2 || cacheSize < 4) {
+		return;
+	}
+
+	struct VertexData {
+		int cachePosition = -1;
+		uint32_t activeTriangles = 0;
+		uint32_t firstTriangle = 0;
+		uint32_t triangleCount = 0;
+		float score = 0.0f;
+	};
+
+	std::vector<VertexData> vertices(vertexCount);
+
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		vertices[pIndices[i]].triangleCount++;
+	}
+
+	uint32_t offset = 0;
+	for (VertexData& vertex : vertices) {
+		vertex.firstTriangle = offset;
+		offset += vertex.triangleCount;
+		vertex.activeTriangles = vertex.triangleCount;
+		vertex.score = GetVertexScore(-1, vertex.activeTriangles, cacheSize);
+	}
+
+	// Triangles referencing each vertex, finished ones stay in the list and are skipped.
+	std::vector<uint32_t> vertexTriangles(offset);
+	std::vector<uint32_t> fill(vertexCount, 0);
+
+	for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+		for (size_t corner = 0; corner < 3; corner++) {
+			const uint32_t index = pIndices[(triangle * 3) + corner];
+			vertexTriangles[vertices[index].firstTriangle + fill[index]++] = static_cast<uint32_t>(triangle);
+		}
+	}
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<uint8_t> triangleAdded(triangleCount, 0);
+
+	auto scoreTriangle = [&](size_t triangle) {
+		return vertices[pIndices[triangle * 3]].score + vertices[pIndices[(triangle * 3) + 1]].score + vertices[pIndices[(triangle * 3) + 2]].score;
+	};
+
+	size_t bestTriangle = 0;
+	for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+		triangleScores[triangle] = scoreTriangle(triangle);
+
+		if (triangleScores[triangle] > triangleScores[bestTriangle]) {
+			bestTriangle = triangle;
+		}
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	std::vector<uint32_t> cache;
+	cache.reserve(cacheSize + 3);
+
+	std::vector<uint32_t> nextCache;
+	nextCache.reserve(cacheSize + 3);
+
+	size_t scanCursor = 0;
+
+	for (size_t emitted = 0; emitted < triangleCount; emitted++) {
+		if (bestTriangle == SIZE_MAX) {
+			// Nothing in the cache has triangles left, restart from the next unfinished one.
+			while (triangleAdded[scanCursor]) {
+				scanCursor++;
+			}
+
+			bestTriangle = scanCursor;
+		}
+
+		triangleAdded[bestTriangle] = 1;
+
+		const uint32_t* pTriangle = pIndices + (bestTriangle * 3);
+
+		nextCache.clear();
+
+		for (size_t corner = 0; corner < 3; corner++) {
+			output.push_back(pTriangle[corner]);
+			vertices[pTriangle[corner]].activeTriangles--;
+			nextCache.push_back(pTriangle[corner]);
+		}
+
+		for (uint32_t index : cache) {
+			if (index != pTriangle[0] && index != pTriangle[1] && index != pTriangle[2]) {
+				nextCache.push_back(index);
+			}
+		}
+
+		for (size_t position = 0; position < nextCache.size(); position++) {
+			VertexData& vertex = vertices[nextCache[position]];
+			vertex.cachePosition = position < cacheSize ? static_cast<int>(position) : -1;
+			vertex.score = GetVertexScore(vertex.cachePosition, vertex.activeTriangles, cacheSize);
+		}
+
+		bestTriangle = SIZE_MAX;
+		float bestScore = -1.0f;
+
+		for (uint32_t index : nextCache) {
+			const VertexData& vertex = vertices[index];
+
+			for (uint32_t i = 0; i < vertex.triangleCount; i++) {
+				const uint32_t triangle = vertexTriangles[vertex.firstTriangle + i];
+
+				if (!triangleAdded[triangle]) {
+					triangleScores[triangle] = scoreTriangle(triangle);
+
+					if (triangleScores[triangle] > bestScore) {
+						bestScore = triangleScores[triangle];
+						bestTriangle = triangle;
+					}
+				}
+			}
+		}
+
+		if (nextCache.size() > cacheSize) {
+			nextCache.resize(cacheSize);
+		}
+
+		cache.swap(nextCache);
+	}
+
+	memcpy(pIndices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+void Renderer::Kya::MeshOptimizer::OptimizeVertexFetch(void* pVertices, size_t vertexStride, uint32_t vertexCount, uint32_t* pIndices, size_t indexCount)
+{
+	std::vector<uint32_t> remap(vertexCount, gUnused);
+	uint32_t nextIndex = 0;
+
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t& index = pIndices[i];
+
+		if (remap[index] == gUnused) {
+			remap[index] = nextIndex++;
+		}
+
+		index = remap[index];
+	}
+
+	// Vertices no triangle references keep their relative order at the end.
+	for (uint32_t& index : remap) {
+		if (index == gUnused) {
+			index = nextIndex++;
+		}
+	}
+
+	uint8_t* const pBytes = reinterpret_cast<uint8_t*>(pVertices);
+	std::vector<uint8_t> reordered(vertexCount * vertexStride);
+
+	for (uint32_t i = 0; i < vertexCount; i++) {
+		memcpy(reordered.data() + (remap[i] * vertexStride), pBytes + (i * vertexStride), vertexStride);
+	}
+
+	memcpy(pBytes, reordered.data(), reordered.size());
+}
+
+uint32_t Renderer::Kya::MeshOptimizer::GetNarrowestIndexSize(uint32_t vertexCount)
+{
+	if (vertexCount <= 0x100) {
+		return 1;
+	}
+
+	if (vertexCount <= 0x10000) {
+		return 2;
+	}
+
+	return 4;
+}
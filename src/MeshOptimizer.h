@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Index buffer optimisation for decoded strips. Works on triangle lists with 32 bit indices,
+		// callers widen the mesh's own index type into a scratch buffer and narrow it back.
+		namespace MeshOptimizer
+		{
+			constexpr uint32_t gDefaultCacheSize = 32;
+
+			struct Stats {
+				uint32_t vertexCountBefore = 0;
+				uint32_t vertexCountAfter = 0;
+				uint32_t triangleCount = 0;
+				float acmrBefore = 0.0f;
+				float acmrAfter = 0.0f;
+
+				// Smallest index size in bytes that could address the optimised vertices.
+				uint32_t narrowestIndexSize = 0;
+			};
+
+			// Average cache miss ratio of a FIFO post transform cache, in vertex transforms per triangle.
+			float ComputeAcmr(const uint32_t* pIndices, size_t indexCount, uint32_t cacheSize = gDefaultCacheSize);
+
+			// Merges bitwise identical vertices and rewrites the indices to match. Vertices are compacted in place,
+			// returns the new vertex count.
+			uint32_t WeldVertices(void* pVertices, size_t vertexStride, uint32_t vertexCount, uint32_t* pIndices, size_t indexCount);
+
+			// Reorders triangles for post transform cache reuse (Forsyth's linear speed algorithm).
+			void OptimizeVertexCache(uint32_t* pIndices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = gDefaultCacheSize);
+
+			// Reorders vertices into first use order so fetches walk the vertex buffer forwards.
+			void OptimizeVertexFetch(void* pVertices, size_t vertexStride, uint32_t vertexCount, uint32_t* pIndices, size_t indexCount);
+
+			uint32_t GetNarrowestIndexSize(uint32_t vertexCount);
+		}
+	}
+}
@@ -0,0 +1,458 @@
+#include "MeshTrace.h"
+#include "ed3D.h"
+#include "edList.h"
+
+#include <cstring>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		constexpr uint32_t gTraceMagic = 0x52544d4b; // KMTR
+		constexpr uint32_t gTraceVersion = 1;
+
+		// Buffered writes go out in blocks of this size.
+		constexpr size_t gTraceFlushSize = 64 * 1024;
+	}
+}
+
+Renderer::Kya::MeshTraceWriter::~MeshTraceWriter()
+{
+	Close();
+}
+
+bool Renderer::Kya::MeshTraceWriter::Open(const std::string& path, IdentifyStripFunc inIdentify)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (pFile) {
+		return false;
+	}
+
+	pFile = fopen(path.c_str(), "wb");
+	if (!pFile) {
+		return false;
+	}
+
+	identify = std::move(inIdentify);
+	bFailed = false;
+	buffer.reserve(gTraceFlushSize * 2);
+
+	const uint32_t header[] = { gTraceMagic, gTraceVersion };
+	Write(header, sizeof(header));
+	return true;
+}
+
+void Renderer::Kya::MeshTraceWriter::Close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!pFile) {
+		return;
+	}
+
+	Flush();
+	fclose(pFile);
+	pFile = nullptr;
+}
+
+void Renderer::Kya::MeshTraceWriter::EndFrame()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	WriteRecord(MeshTraceRecord::EndFrame);
+}
+
+void Renderer::Kya::MeshTraceWriter::AddMesh(const ed_g3d_manager* pManager, const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const uint64_t meshId = nextMeshId++;
+	meshIds[pManager] = meshId;
+
+	WriteRecord(MeshTraceRecord::AddMesh);
+	WriteVarint(meshId);
+	WriteBlob(name.data(), name.size());
+}
+
+void Renderer::Kya::MeshTraceWriter::RemoveMesh(const ed_g3d_manager* pManager)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Meshes added before the trace started are removed without a record, the replay never had them.
+	auto meshId = meshIds.find(pManager);
+	if (meshId != meshIds.end()) {
+		WriteRecord(MeshTraceRecord::RemoveMesh);
+		WriteVarint(meshId->second);
+		meshIds.erase(meshId);
+	}
+
+	// Strip ids stay, the same strip loaded again gets the same one.
+	stripRefs.clear();
+}
+
+void Renderer::Kya::MeshTraceWriter::CacheDlistStrip(const ed_3d_strip* pStrip, uint64_t contentHash, const FillStripDataFunc& fillData)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (writtenDlistContents.insert(contentHash).second) {
+		MeshTraceStripData data;
+		fillData(data);
+
+		WriteRecord(MeshTraceRecord::DlistContent);
+		WriteHash(contentHash);
+		WriteVarint(static_cast<uint64_t>(data.textureLayerCount));
+		WriteBlob(data.strip.data(), data.strip.size());
+		WriteBlob(data.gifTags.data(), data.gifTags.size());
+		WriteBlob(data.vertices.data(), data.vertices.size());
+		WriteBlob(data.normals.data(), data.normals.size());
+		WriteBlob(data.colors.data(), data.colors.size());
+		WriteBlob(data.st.data(), data.st.size());
+	}
+
+	auto slot = dlistSlots.find(pStrip);
+	if (slot == dlistSlots.end()) {
+		uint64_t newSlot = nextDlistSlot;
+
+		if (freeDlistSlots.empty()) {
+			nextDlistSlot++;
+		}
+		else {
+			newSlot = freeDlistSlots.back();
+			freeDlistSlots.pop_back();
+		}
+
+		slot = dlistSlots.emplace(pStrip, newSlot).first;
+	}
+
+	WriteRecord(MeshTraceRecord::CacheDlistStrip);
+	WriteVarint(slot->second);
+	WriteHash(contentHash);
+}
+
+void Renderer::Kya::MeshTraceWriter::ReleaseDlistStrip(const ed_3d_strip* pStrip)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto slot = dlistSlots.find(pStrip);
+	if (slot == dlistSlots.end()) {
+		return;
+	}
+
+	WriteRecord(MeshTraceRecord::ReleaseDlistStrip);
+	WriteVarint(slot->second);
+
+	freeDlistSlots.push_back(slot->second);
+	dlistSlots.erase(slot);
+}
+
+void Renderer::Kya::MeshTraceWriter::RenderNode(const edNODE* pNode, int textureLayerIndex)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const MeshTraceStripRef stripRef = ResolveStrip(reinterpret_cast<const ed_3d_strip*>(pNode->pData));
+
+	WriteRecord(MeshTraceRecord::RenderNode);
+	WriteVarint(static_cast<uint64_t>(textureLayerIndex));
+	WriteVarint(pNode->header.typeField.flags);
+	WriteVarint(stripRef);
+}
+
+void Renderer::Kya::MeshTraceWriter::RenderNodes(const edNODE* const* ppNodes, size_t nodeCount, int textureLayerIndex)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Resolved before the record starts, the DefineStrip records they write can't land in the middle of it.
+	thread_local std::vector<MeshTraceStripRef> stripRefsScratch;
+	stripRefsScratch.resize(nodeCount);
+
+	for (size_t i = 0; i < nodeCount; i++) {
+		stripRefsScratch[i] = ResolveStrip(reinterpret_cast<const ed_3d_strip*>(ppNodes[i]->pData));
+	}
+
+	WriteRecord(MeshTraceRecord::RenderNodes);
+	WriteVarint(static_cast<uint64_t>(textureLayerIndex));
+	WriteVarint(nodeCount);
+
+	for (size_t i = 0; i < nodeCount; i++) {
+		WriteVarint(ppNodes[i]->header.typeField.flags);
+		WriteVarint(stripRefsScratch[i]);
+	}
+}
+
+Renderer::Kya::MeshTraceStripRef Renderer::Kya::MeshTraceWriter::ResolveStrip(const ed_3d_strip* pStrip)
+{
+	auto slot = dlistSlots.find(pStrip);
+	if (slot != dlistSlots.end()) {
+		return (slot->second << 1) | 1;
+	}
+
+	auto stripRef = stripRefs.find(pStrip);
+	if (stripRef != stripRefs.end()) {
+		return stripRef->second;
+	}
+
+	// Strips that aren't in the library yet aren't remembered, they may be by the next draw.
+	uint64_t sourceHash = 0;
+	if (!identify || !identify(pStrip, sourceHash)) {
+		return 0;
+	}
+
+	auto stripId = stripIds.find(sourceHash);
+	if (stripId == stripIds.end()) {
+		// Ids start at 1, ref 0 is the unknown strip.
+		stripId = stripIds.emplace(sourceHash, stripIds.size() + 1).first;
+
+		WriteRecord(MeshTraceRecord::DefineStrip);
+		WriteVarint(stripId->second);
+		WriteHash(sourceHash);
+	}
+
+	const MeshTraceStripRef newRef = stripId->second << 1;
+	stripRefs.emplace(pStrip, newRef);
+	return newRef;
+}
+
+void Renderer::Kya::MeshTraceWriter::WriteRecord(MeshTraceRecord record)
+{
+	const uint8_t type = static_cast<uint8_t>(record);
+	Write(&type, sizeof(type));
+}
+
+void Renderer::Kya::MeshTraceWriter::WriteVarint(uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t count = 0;
+
+	do {
+		bytes[count] = static_cast<uint8_t>(value & 0x7f);
+		value >>= 7;
+		bytes[count] |= value ? 0x80 : 0;
+		count++;
+	} while (value);
+
+	Write(bytes, count);
+}
+
+void Renderer::Kya::MeshTraceWriter::WriteHash(uint64_t hash)
+{
+	uint8_t bytes[8];
+	for (int i = 0; i < 8; i++) {
+		bytes[i] = static_cast<uint8_t>(hash >> (i * 8));
+	}
+
+	Write(bytes, sizeof(bytes));
+}
+
+void Renderer::Kya::MeshTraceWriter::WriteBlob(const void* pData, size_t size)
+{
+	WriteVarint(size);
+	Write(pData, size);
+}
+
+void Renderer::Kya::MeshTraceWriter::Write(const void* pData, size_t size)
+{
+	if (!pFile || size == 0) {
+		return;
+	}
+
+	const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+	buffer.insert(buffer.end(), pBytes, pBytes + size);
+
+	if (buffer.size() >= gTraceFlushSize) {
+		Flush();
+	}
+}
+
+void Renderer::Kya::MeshTraceWriter::Flush()
+{
+	if (!buffer.empty() && !bFailed) {
+		bFailed = fwrite(buffer.data(), 1, buffer.size(), pFile) != buffer.size();
+	}
+
+	buffer.clear();
+}
+
+bool Renderer::Kya::MeshTraceReader::Open(const std::string& path)
+{
+	data.clear();
+	offset = 0;
+	error.clear();
+
+	FILE* pFile = fopen(path.c_str(), "rb");
+	if (!pFile) {
+		return Fail("Trace file could not be opened");
+	}
+
+	uint8_t block[gTraceFlushSize];
+	size_t read = 0;
+
+	while ((read = fread(block, 1, sizeof(block), pFile)) > 0) {
+		data.insert(data.end(), block, block + read);
+	}
+
+	fclose(pFile);
+
+	uint32_t header[2];
+	if (data.size() < sizeof(header)) {
+		return Fail("Trace file is too small for its header");
+	}
+
+	memcpy(header, data.data(), sizeof(header));
+	if (header[0] != gTraceMagic || header[1] != gTraceVersion) {
+		return Fail("Trace file has the wrong magic or version");
+	}
+
+	offset = sizeof(header);
+	return true;
+}
+
+bool Renderer::Kya::MeshTraceReader::Next(Event& event)
+{
+	if (offset >= data.size()) {
+		return false;
+	}
+
+	const uint8_t type = data[offset++];
+	if (type >= static_cast<uint8_t>(MeshTraceRecord::Count)) {
+		return Fail("Unknown record type");
+	}
+
+	event.type = static_cast<MeshTraceRecord>(type);
+
+	uint64_t value = 0;
+
+	switch (event.type) {
+	case MeshTraceRecord::EndFrame:
+		return true;
+	case MeshTraceRecord::AddMesh: {
+		std::vector<uint8_t> name;
+		if (!ReadVarint(event.id) || !ReadBlob(name)) {
+			return false;
+		}
+
+		event.name.assign(name.begin(), name.end());
+		return true;
+	}
+	case MeshTraceRecord::RemoveMesh:
+	case MeshTraceRecord::ReleaseDlistStrip:
+		return ReadVarint(event.id);
+	case MeshTraceRecord::DefineStrip:
+	case MeshTraceRecord::CacheDlistStrip:
+		return ReadVarint(event.id) && ReadHash(event.hash);
+	case MeshTraceRecord::DlistContent: {
+		MeshTraceStripData& stripData = event.stripData;
+
+		if (!ReadHash(event.hash) || !ReadVarint(value)) {
+			return false;
+		}
+
+		stripData.textureLayerCount = static_cast<int>(value);
+
+		return ReadBlob(stripData.strip) && ReadBlob(stripData.gifTags) && ReadBlob(stripData.vertices) && ReadBlob(stripData.normals) &&
+			ReadBlob(stripData.colors) && ReadBlob(stripData.st);
+	}
+	case MeshTraceRecord::RenderNode: {
+		Node node;
+
+		if (!ReadVarint(value)) {
+			return false;
+		}
+
+		event.textureLayerIndex = static_cast<int>(value);
+
+		if (!ReadVarint(value) || !ReadVarint(node.stripRef)) {
+			return false;
+		}
+
+		node.flags = static_cast<uint32_t>(value);
+
+		event.nodes.assign(1, node);
+		return true;
+	}
+	case MeshTraceRecord::RenderNodes: {
+		uint64_t nodeCount = 0;
+
+		if (!ReadVarint(value) || !ReadVarint(nodeCount)) {
+			return false;
+		}
+
+		event.textureLayerIndex = static_cast<int>(value);
+
+		// Every node takes at least two bytes, a larger count can only come from a corrupt record.
+		if (nodeCount > (data.size() - offset) / 2) {
+			return Fail("Node count runs past the end of the trace");
+		}
+
+		event.nodes.resize(nodeCount);
+
+		for (Node& node : event.nodes) {
+			if (!ReadVarint(value) || !ReadVarint(node.stripRef)) {
+				return false;
+			}
+
+			node.flags = static_cast<uint32_t>(value);
+		}
+
+		return true;
+	}
+	default:
+		return Fail("Unknown record type");
+	}
+}
+
+bool Renderer::Kya::MeshTraceReader::Fail(const char* reason)
+{
+	error = reason;
+	offset = data.size();
+	return false;
+}
+
+bool Renderer::Kya::MeshTraceReader::ReadVarint(uint64_t& value)
+{
+	value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (offset >= data.size()) {
+			return Fail("Record runs past the end of the trace");
+		}
+
+		const uint8_t byte = data[offset++];
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+
+	return Fail("Varint is too long");
+}
+
+bool Renderer::Kya::MeshTraceReader::ReadHash(uint64_t& hash)
+{
+	if (data.size() - offset < 8) {
+		return Fail("Record runs past the end of the trace");
+	}
+
+	hash = 0;
+	for (int i = 0; i < 8; i++) {
+		hash |= static_cast<uint64_t>(data[offset++]) << (i * 8);
+	}
+
+	return true;
+}
+
+bool Renderer::Kya::MeshTraceReader::ReadBlob(std::vector<uint8_t>& blob)
+{
+	uint64_t size = 0;
+	if (!ReadVarint(size)) {
+		return false;
+	}
+
+	if (size > data.size() - offset) {
+		return Fail("Record runs past the end of the trace");
+	}
+
+	blob.assign(data.begin() + offset, data.begin() + offset + size);
+	offset += size;
+	return true;
+}
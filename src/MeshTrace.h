@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct ed_3d_strip;
+struct ed_g3d_manager;
+struct edNODE;
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Binary trace of the calls a frame makes into MeshLibrary, written by MeshLibrary::StartTrace and played back by
+		// MeshReplay against the same .g3d files. The file is a header followed by records, each a type byte and its
+		// fields. Integers are LEB128 varints, hashes are 8 byte little endian and strings and blobs are a varint length
+		// followed by their bytes.
+		//
+		// Pointers mean nothing from one run to the next, so strips are named by G3D::Strip::ComputeSourceHash. The first
+		// time a strip is drawn a DefineStrip record gives its hash a small id, and draws refer to the id from then on.
+		// Display list strips are rebuilt by the engine every frame, so their source data goes into the trace itself,
+		// once per distinct content.
+		enum class MeshTraceRecord : uint8_t {
+			// Update.
+			EndFrame,
+
+			// Mesh id, file name.
+			AddMesh,
+
+			// Mesh id.
+			RemoveMesh,
+
+			// Strip id, source hash.
+			DefineStrip,
+
+			// Content hash, strip data.
+			DlistContent,
+
+			// Slot, content hash.
+			CacheDlistStrip,
+
+			// Slot.
+			ReleaseDlistStrip,
+
+			// Layer, flags, strip ref.
+			RenderNode,
+
+			// Layer, node count, then flags and strip ref per node.
+			RenderNodes,
+
+			Count
+		};
+
+		// 0 for a strip the trace couldn't name, strip id << 1 for a mesh strip, (slot << 1) | 1 for a display list strip.
+		using MeshTraceStripRef = uint64_t;
+
+		// Everything needed to rebuild a display list strip, the pointer fields of strip are meaningless.
+		struct MeshTraceStripData {
+			std::vector<uint8_t> strip;
+
+			// The 16 byte GIF tag of each section.
+			std::vector<uint8_t> gifTags;
+
+			std::vector<uint8_t> vertices;
+			std::vector<uint8_t> normals;
+			std::vector<uint8_t> colors;
+
+			// From the 16 byte header on, holding textureLayerCount layers.
+			std::vector<uint8_t> st;
+
+			int textureLayerCount = 1;
+		};
+
+		class MeshTraceWriter
+		{
+		public:
+			// Names a strip found in the library, false if it isn't there.
+			using IdentifyStripFunc = std::function<bool(const ed_3d_strip* pStrip, uint64_t& sourceHash)>;
+			using FillStripDataFunc = std::function<void(MeshTraceStripData& data)>;
+
+			MeshTraceWriter() = default;
+			~MeshTraceWriter();
+
+			MeshTraceWriter(const MeshTraceWriter&) = delete;
+			MeshTraceWriter& operator=(const MeshTraceWriter&) = delete;
+
+			bool Open(const std::string& path, IdentifyStripFunc identify);
+			void Close();
+
+			// Every call is safe from any thread, records go out in the order the calls take the lock.
+			void EndFrame();
+			void AddMesh(const ed_g3d_manager* pManager, const std::string& name);
+			void RemoveMesh(const ed_g3d_manager* pManager);
+
+			// fillData is only called the first time contentHash is seen.
+			void CacheDlistStrip(const ed_3d_strip* pStrip, uint64_t contentHash, const FillStripDataFunc& fillData);
+			void ReleaseDlistStrip(const ed_3d_strip* pStrip);
+
+			void RenderNode(const edNODE* pNode, int textureLayerIndex);
+			void RenderNodes(const edNODE* const* ppNodes, size_t nodeCount, int textureLayerIndex);
+
+		private:
+			MeshTraceStripRef ResolveStrip(const ed_3d_strip* pStrip);
+
+			void WriteRecord(MeshTraceRecord record);
+			void WriteVarint(uint64_t value);
+			void WriteHash(uint64_t hash);
+			void WriteBlob(const void* pData, size_t size);
+			void Write(const void* pData, size_t size);
+			void Flush();
+
+			std::mutex mutex;
+			FILE* pFile = nullptr;
+			std::vector<uint8_t> buffer;
+			bool bFailed = false;
+
+			IdentifyStripFunc identify;
+
+			// Strip refs by pointer, dropped whenever a mesh goes away since its strips' memory may be reused.
+			std::unordered_map<const ed_3d_strip*, MeshTraceStripRef> stripRefs;
+			std::unordered_map<uint64_t, uint64_t> stripIds;
+
+			std::unordered_map<const ed_3d_strip*, uint64_t> dlistSlots;
+			std::vector<uint64_t> freeDlistSlots;
+			uint64_t nextDlistSlot = 0;
+			std::unordered_set<uint64_t> writtenDlistContents;
+
+			std::unordered_map<const ed_g3d_manager*, uint64_t> meshIds;
+			uint64_t nextMeshId = 0;
+		};
+
+		class MeshTraceReader
+		{
+		public:
+			struct Node {
+				uint32_t flags = 0;
+				MeshTraceStripRef stripRef = 0;
+			};
+
+			// Fields the record type doesn't have are left as they were.
+			struct Event {
+				MeshTraceRecord type = MeshTraceRecord::Count;
+
+				// Mesh id, strip id or dlist slot.
+				uint64_t id = 0;
+				uint64_t hash = 0;
+				std::string name;
+
+				int textureLayerIndex = 0;
+				std::vector<Node> nodes;
+
+				MeshTraceStripData stripData;
+			};
+
+			// Reads the whole file, false if it is missing or isn't a trace.
+			bool Open(const std::string& path);
+
+			// False at the end of the trace or on a malformed record, GetError tells which.
+			bool Next(Event& event);
+
+			inline const std::string& GetError() const { return error; }
+
+		private:
+			bool Fail(const char* reason);
+			bool ReadVarint(uint64_t& value);
+			bool ReadHash(uint64_t& hash);
+			bool ReadBlob(std::vector<uint8_t>& blob);
+
+			std::vector<uint8_t> data;
+			size_t offset = 0;
+			std::string error;
+		};
+	}
+}
@@ -0,0 +1,292 @@
+#include "StripCacheFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		constexpr uint32_t gStripCacheMagic = 0x43534d4b; // KMSC
+		constexpr uint32_t gStripCacheVersion = 1;
+
+		static size_t AlignUp(size_t value, size_t alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+	}
+}
+
+Renderer::Kya::StripCacheFile::~StripCacheFile()
+{
+	Close();
+}
+
+bool Renderer::Kya::StripCacheFile::Open(const std::string& inPath, uint32_t inVertexStride, uint32_t inIndexStride)
+{
+	Close();
+
+	path = inPath;
+	vertexStride = inVertexStride;
+	indexStride = inIndexStride;
+
+	return Map();
+}
+
+void Renderer::Kya::StripCacheFile::Close()
+{
+	Unmap();
+	path.clear();
+
+	std::unique_lock<std::shared_mutex> lock(pendingMutex);
+	pending.clear();
+}
+
+bool Renderer::Kya::StripCacheFile::Map()
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(Header))) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	pMapped = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!pMapped) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	hFile = file;
+	hMapping = mapping;
+	mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(Header))) {
+		close(fd);
+		return false;
+	}
+
+	void* pView = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (pView == MAP_FAILED) {
+		return false;
+	}
+
+	pMapped = static_cast<const uint8_t*>(pView);
+	mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
+
+	const Header* pHeader = reinterpret_cast<const Header*>(pMapped);
+	const size_t tableEnd = sizeof(Header) + pHeader->entryCount * sizeof(TableEntry);
+
+	if (pHeader->magic != gStripCacheMagic || pHeader->version != gStripCacheVersion ||
+		pHeader->vertexStride != vertexStride || pHeader->indexStride != indexStride ||
+		pHeader->entryCount > mappedSize / sizeof(TableEntry) || tableEnd > mappedSize) {
+		// Stale layout, start again and overwrite it on the next save.
+		Unmap();
+		return false;
+	}
+
+	pTable = reinterpret_cast<const TableEntry*>(pHeader + 1);
+	tableEntryCount = pHeader->entryCount;
+	return true;
+}
+
+void Renderer::Kya::StripCacheFile::Unmap()
+{
+	if (pMapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(pMapped);
+		CloseHandle(hMapping);
+		CloseHandle(hFile);
+		hMapping = nullptr;
+		hFile = nullptr;
+#else
+		munmap(const_cast<uint8_t*>(pMapped), mappedSize);
+#endif
+	}
+
+	pMapped = nullptr;
+	mappedSize = 0;
+	pTable = nullptr;
+	tableEntryCount = 0;
+}
+
+Renderer::Kya::StripCacheFile::Entry Renderer::Kya::StripCacheFile::MakeEntry(const uint8_t* pData, uint32_t vertexCount, uint32_t indexCount) const
+{
+	Entry entry;
+	entry.pVertices = pData;
+	entry.vertexCount = vertexCount;
+	entry.pIndices = pData + AlignUp(static_cast<size_t>(vertexCount) * vertexStride, 16);
+	entry.indexCount = indexCount;
+	return entry;
+}
+
+bool Renderer::Kya::StripCacheFile::Find(uint64_t hash, Entry& entry) const
+{
+	if (pTable) {
+		const TableEntry* pEnd = pTable + tableEntryCount;
+		const TableEntry* pFound = std::lower_bound(pTable, pEnd, hash, [](const TableEntry& tableEntry, uint64_t value) { return tableEntry.hash < value; });
+
+		if (pFound != pEnd && pFound->hash == hash) {
+			const size_t dataSize = AlignUp(static_cast<size_t>(pFound->vertexCount) * vertexStride, 16) + static_cast<size_t>(pFound->indexCount) * indexStride;
+
+			if (pFound->dataOffset + dataSize <= mappedSize) {
+				entry = MakeEntry(pMapped + pFound->dataOffset, pFound->vertexCount, pFound->indexCount);
+				return true;
+			}
+		}
+	}
+
+	std::shared_lock<std::shared_mutex> lock(pendingMutex);
+
+	auto it = pending.find(hash);
+	if (it == pending.end()) {
+		return false;
+	}
+
+	entry = MakeEntry(it->second.data.data(), it->second.vertexCount, it->second.indexCount);
+	return true;
+}
+
+void Renderer::Kya::StripCacheFile::Add(uint64_t hash, const void* pVertices, uint32_t vertexCount, const void* pIndices, uint32_t indexCount)
+{
+	if (!IsOpen()) {
+		return;
+	}
+
+	PendingEntry entry;
+	entry.vertexCount = vertexCount;
+	entry.indexCount = indexCount;
+
+	const size_t vertexBytes = static_cast<size_t>(vertexCount) * vertexStride;
+	const size_t indexOffset = AlignUp(vertexBytes, 16);
+	entry.data.resize(indexOffset + static_cast<size_t>(indexCount) * indexStride);
+	if (vertexCount > 0) {
+		memcpy(entry.data.data(), pVertices, vertexBytes);
+	}
+
+	if (indexCount > 0) {
+		memcpy(entry.data.data() + indexOffset, pIndices, static_cast<size_t>(indexCount) * indexStride);
+	}
+
+	// Two workers may have decoded the same content, the first one added wins.
+	std::unique_lock<std::shared_mutex> lock(pendingMutex);
+	pending.emplace(hash, std::move(entry));
+}
+
+bool Renderer::Kya::StripCacheFile::Save()
+{
+	if (!IsOpen()) {
+		return false;
+	}
+
+	std::unique_lock<std::shared_mutex> lock(pendingMutex);
+
+	if (pending.empty()) {
+		return true;
+	}
+
+	struct SaveEntry {
+		uint64_t hash;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		const uint8_t* pData;
+		size_t size;
+	};
+
+	std::vector<SaveEntry> entries;
+	entries.reserve(tableEntryCount + pending.size());
+
+	for (uint64_t i = 0; i < tableEntryCount; i++) {
+		const TableEntry& tableEntry = pTable[i];
+		const size_t size = AlignUp(static_cast<size_t>(tableEntry.vertexCount) * vertexStride, 16) + static_cast<size_t>(tableEntry.indexCount) * indexStride;
+
+		if (tableEntry.dataOffset + size <= mappedSize) {
+			entries.push_back({ tableEntry.hash, tableEntry.vertexCount, tableEntry.indexCount, pMapped + tableEntry.dataOffset, size });
+		}
+	}
+
+	for (const auto& [hash, pendingEntry] : pending) {
+		entries.push_back({ hash, pendingEntry.vertexCount, pendingEntry.indexCount, pendingEntry.data.data(), pendingEntry.data.size() });
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const SaveEntry& a, const SaveEntry& b) { return a.hash < b.hash; });
+	entries.erase(std::unique(entries.begin(), entries.end(), [](const SaveEntry& a, const SaveEntry& b) { return a.hash == b.hash; }), entries.end());
+
+	const std::string tempPath = path + ".tmp";
+	FILE* pFile = fopen(tempPath.c_str(), "wb");
+	if (!pFile) {
+		return false;
+	}
+
+	Header header = { gStripCacheMagic, gStripCacheVersion, vertexStride, indexStride, entries.size() };
+	bool bWritten = fwrite(&header, sizeof(header), 1, pFile) == 1;
+
+	size_t dataOffset = AlignUp(sizeof(Header) + entries.size() * sizeof(TableEntry), 16);
+	for (const SaveEntry& entry : entries) {
+		TableEntry tableEntry = { entry.hash, dataOffset, entry.vertexCount, entry.indexCount };
+		bWritten = bWritten && fwrite(&tableEntry, sizeof(tableEntry), 1, pFile) == 1;
+		dataOffset = AlignUp(dataOffset + entry.size, 16);
+	}
+
+	static const uint8_t padding[16] = {};
+	size_t written = sizeof(Header) + entries.size() * sizeof(TableEntry);
+
+	for (const SaveEntry& entry : entries) {
+		const size_t aligned = AlignUp(written, 16);
+		bWritten = bWritten && fwrite(padding, 1, aligned - written, pFile) == aligned - written;
+		bWritten = bWritten && fwrite(entry.pData, 1, entry.size, pFile) == entry.size;
+		written = aligned + entry.size;
+	}
+
+	bWritten = fclose(pFile) == 0 && bWritten;
+
+	if (!bWritten) {
+		remove(tempPath.c_str());
+		return false;
+	}
+
+	// Nothing references the old mapping past this point, meshes copy out of it when they hit.
+	Unmap();
+	pending.clear();
+
+#ifdef _WIN32
+	const bool bReplaced = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	const bool bReplaced = rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+
+	Map();
+	return bReplaced;
+}
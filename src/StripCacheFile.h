@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// On disk cache of fully processed strip vertex and index buffers, keyed by a hash of the strip source data.
+		// The file is memory mapped on open, lookups binary search the mapped entry table and point straight into the mapping.
+		// New entries are held in memory until Save writes them out together with the mapped ones.
+		// Save remaps the file, so it must not run while strips are being decoded.
+		class StripCacheFile
+		{
+		public:
+			struct Entry {
+				const void* pVertices = nullptr;
+				uint32_t vertexCount = 0;
+				const void* pIndices = nullptr;
+				uint32_t indexCount = 0;
+			};
+
+			StripCacheFile() = default;
+			~StripCacheFile();
+
+			StripCacheFile(const StripCacheFile&) = delete;
+			StripCacheFile& operator=(const StripCacheFile&) = delete;
+
+			// Maps the file at path if it exists and matches the given vertex/index layout, a missing or stale file starts empty.
+			bool Open(const std::string& path, uint32_t vertexStride, uint32_t indexStride);
+			void Close();
+			bool Save();
+
+			inline bool IsOpen() const { return !path.empty(); }
+
+			// Safe to call from the decode workers.
+			bool Find(uint64_t hash, Entry& entry) const;
+			void Add(uint64_t hash, const void* pVertices, uint32_t vertexCount, const void* pIndices, uint32_t indexCount);
+
+		private:
+			struct Header {
+				uint32_t magic;
+				uint32_t version;
+				uint32_t vertexStride;
+				uint32_t indexStride;
+				uint64_t entryCount;
+			};
+
+			struct TableEntry {
+				uint64_t hash;
+				uint64_t dataOffset;
+				uint32_t vertexCount;
+				uint32_t indexCount;
+			};
+
+			struct PendingEntry {
+				uint32_t vertexCount;
+				uint32_t indexCount;
+				std::vector<uint8_t> data;
+			};
+
+			bool Map();
+			void Unmap();
+			Entry MakeEntry(const uint8_t* pData, uint32_t vertexCount, uint32_t indexCount) const;
+
+			std::string path;
+			uint32_t vertexStride = 0;
+			uint32_t indexStride = 0;
+
+			const uint8_t* pMapped = nullptr;
+			size_t mappedSize = 0;
+			const TableEntry* pTable = nullptr;
+			uint64_t tableEntryCount = 0;
+
+#ifdef _WIN32
+			void* hFile = nullptr;
+			void* hMapping = nullptr;
+#endif
+
+			// Every decode worker that misses the mapped table looks here, so lookups share the lock.
+			mutable std::shared_mutex pendingMutex;
+			std::unordered_map<uint64_t, PendingEntry> pending;
+		};
+	}
+}
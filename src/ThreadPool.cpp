@@ -0,0 +1,157 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cassert>
+
+Renderer::Kya::ThreadPool::ThreadPool(unsigned workerCount)
+{
+	if (workerCount == 0) {
+		// Leave a core for the thread that submits the work, it participates anyway.
+		workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+	}
+
+	for (unsigned i = 0; i < workerCount + 1; i++) {
+		queues.emplace_back(std::make_unique<Queue>());
+	}
+
+	for (unsigned i = 0; i < workerCount; i++) {
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+Renderer::Kya::ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		bStopping = true;
+	}
+
+	wakeCondition.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void Renderer::Kya::ThreadPool::ParallelFor(int count, const ForEachIndex& func)
+{
+	if (count <= 0) {
+		return;
+	}
+
+	const unsigned callerQueueIndex = static_cast<unsigned>(queues.size()) - 1;
+
+	if (workers.empty() || count == 1) {
+		for (int i = 0; i < count; i++) {
+			func(i);
+		}
+
+		return;
+	}
+
+	// A few chunks per queue keeps everyone busy when strip sizes are uneven, without paying a task per strip.
+	const int chunkCount = std::min(count, static_cast<int>(queues.size()) * 4);
+	const int chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	std::atomic<int> remainingChunks = 0;
+
+	int queueIndex = 0;
+	for (int begin = 0; begin < count; begin += chunkSize) {
+		const int end = std::min(count, begin + chunkSize);
+
+		remainingChunks++;
+		Push(queueIndex, [&func, &remainingChunks, begin, end]() {
+			for (int i = begin; i < end; i++) {
+				func(i);
+			}
+
+			remainingChunks--;
+		});
+
+		queueIndex = (queueIndex + 1) % static_cast<int>(queues.size());
+	}
+
+	wakeCondition.notify_all();
+
+	while (remainingChunks > 0) {
+		if (!TryRunOne(callerQueueIndex)) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void Renderer::Kya::ThreadPool::Push(unsigned queueIndex, Task task)
+{
+	Queue& queue = *queues[queueIndex];
+
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.emplace_back(std::move(task));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		queuedTasks++;
+	}
+}
+
+bool Renderer::Kya::ThreadPool::TryPop(unsigned queueIndex, Task& task)
+{
+	Queue& queue = *queues[queueIndex];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	if (queue.tasks.empty()) {
+		return false;
+	}
+
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool Renderer::Kya::ThreadPool::TrySteal(unsigned thiefIndex, Task& task)
+{
+	const unsigned queueCount = static_cast<unsigned>(queues.size());
+
+	for (unsigned offset = 1; offset < queueCount; offset++) {
+		Queue& queue = *queues[(thiefIndex + offset) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (!queue.tasks.empty()) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Renderer::Kya::ThreadPool::TryRunOne(unsigned queueIndex)
+{
+	Task task;
+
+	if (!TryPop(queueIndex, task) && !TrySteal(queueIndex, task)) {
+		return false;
+	}
+
+	queuedTasks--;
+	task();
+	return true;
+}
+
+void Renderer::Kya::ThreadPool::WorkerLoop(unsigned queueIndex)
+{
+	while (true) {
+		if (TryRunOne(queueIndex)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wakeMutex);
+		wakeCondition.wait(lock, [this]() { return bStopping || queuedTasks > 0; });
+
+		if (bStopping) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Renderer
+{
+	namespace Kya
+	{
+		// Small work stealing pool used to decode strips. Each worker owns a queue it pops from the back of,
+		// idle workers (and the calling thread) steal from the front of the others.
+		class ThreadPool
+		{
+		public:
+			using Task = std::function<void()>;
+			using ForEachIndex = std::function<void(int)>;
+
+			explicit ThreadPool(unsigned workerCount = 0);
+			~ThreadPool();
+
+			ThreadPool(const ThreadPool&) = delete;
+			ThreadPool& operator=(const ThreadPool&) = delete;
+
+			// Runs func for every index in [0, count) and returns once all of them have completed.
+			// The calling thread helps with the work while it waits.
+			void ParallelFor(int count, const ForEachIndex& func);
+
+			inline unsigned GetWorkerCount() const { return static_cast<unsigned>(workers.size()); }
+
+		private:
+			struct Queue {
+				std::mutex mutex;
+				std::deque<Task> tasks;
+			};
+
+			void Push(unsigned queueIndex, Task task);
+			bool TryPop(unsigned queueIndex, Task& task);
+			bool TrySteal(unsigned thiefIndex, Task& task);
+			bool TryRunOne(unsigned queueIndex);
+			void WorkerLoop(unsigned queueIndex);
+
+			// One queue per worker, plus a final one for the thread calling ParallelFor.
+			std::vector<std::unique_ptr<Queue>> queues;
+			std::vector<std::thread> workers;
+
+			std::mutex wakeMutex;
+			std::condition_variable wakeCondition;
+			std::atomic<int> queuedTasks = 0;
+			bool bStopping = false;
+		};
+	}
+}